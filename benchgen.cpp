@@ -0,0 +1,323 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Writes a synthetic corpus for benchrun: JPEG, TIFF and PNG files that
+ * are each a single grey pixel carrying an XMP packet, whose size is set
+ * by how many regions (each with a person, and every third also with an
+ * object), locations and languages per AltLang it has. Needs no XMP
+ * Toolkit. The same options and seed always give the same files.
+ */
+
+namespace {
+
+struct Shape {
+    int regions = 4;
+    int locations = 2;
+    int langs = 3;
+    size_t textLen = 40;
+    size_t padding = 2048;
+};
+
+/** A deterministic stream of words, some needing XML escaping and some not ASCII */
+class Words {
+public:
+    explicit Words(unsigned seed) : seed(seed) {}
+    unsigned next() {
+        this->seed = this->seed * 1103515245 + 12345;
+        return this->seed >> 16;
+    }
+    /** About `len` bytes of text, escaped for XML */
+    std::string text(size_t len) {
+        static const char *words[] = {
+            "Grandma", "and", "the", "twins", "at", "Lake", "Tahoe,", "summer", "1987.",
+            "Photographed", "by", "&quot;Uncle Bob&quot;", "Müller", "née", "Øster",
+            "東京", "の", "夏", "&amp;", "&lt;draft&gt;", "Москва", "القاهرة",
+        };
+        std::string s;
+        while(s.size() < len) {
+            if (s.size()) s += ' ';
+            s += words[next() % (sizeof(words) / sizeof(*words))];
+        }
+        return s;
+    }
+    double unit() { return (next() % 10000) / 10000.0; }
+private:
+    unsigned seed;
+};
+
+const char *langs[] = {"en", "de", "fr", "ja", "ru", "ar", "zh-Hans", "es", "pt-BR", "it", "ko", "nl"};
+const int langCount = sizeof(langs) / sizeof(*langs);
+
+/** An rdf:Alt with an x-default and shape.langs - 1 tagged languages, the first a copy of the x-default */
+void altLang(std::string& x, const char *prop, const Shape& shape, Words& w) {
+    x += "<"; x += prop; x += "><rdf:Alt>";
+    std::string first;
+    for(int i = 0; i < shape.langs; i += 1) {
+        std::string text = w.text(shape.textLen);
+        if (i == 0) first = text;
+        x += "<rdf:li xml:lang=\"";
+        x += i == 0 ? "x-default" : langs[(i - 1) % langCount];
+        x += "\">";
+        x += i == 1 ? first : text; // the x-default's language-tagged copy
+        x += "</rdf:li>";
+    }
+    x += "</rdf:Alt></"; x += prop; x += ">\n";
+}
+
+void number(std::string& x, const char *prop, double v) {
+    char buf[96];
+    snprintf(buf, sizeof(buf), "<Iptc4xmpExt:%s>%.6f</Iptc4xmpExt:%s>", prop, v, prop);
+    x += buf;
+}
+
+std::string packet(const Shape& shape, Words& w) {
+    std::string x;
+    x += "<?xpacket begin=\"\xEF\xBB\xBF\" id=\"W5M0MpCehiHzreSzNTczkc9d\"?>\n"
+        "<x:xmpmeta xmlns:x=\"adobe:ns:meta/\">\n"
+        "<rdf:RDF xmlns:rdf=\"http://www.w3.org/1999/02/22-rdf-syntax-ns#\">\n"
+        "<rdf:Description rdf:about=\"\"\n"
+        " xmlns:dc=\"http://purl.org/dc/elements/1.1/\"\n"
+        " xmlns:photoshop=\"http://ns.adobe.com/photoshop/1.0/\"\n"
+        " xmlns:Iptc4xmpExt=\"http://iptc.org/std/Iptc4xmpExt/2008-02-29/\"\n"
+        " xmlns:exif=\"http://ns.adobe.com/exif/1.0/\"\n"
+        " xmlns:mwg-coll=\"http://www.metadataworkinggroup.com/schemas/collections/\"\n"
+        " photoshop:DateCreated=\"1987-07-04T10:00\">\n";
+    altLang(x, "dc:title", shape, w);
+    altLang(x, "dc:description", shape, w);
+    altLang(x, "Iptc4xmpExt:Event", shape, w);
+    x += "<mwg-coll:Collections><rdf:Bag><rdf:li rdf:parseType=\"Resource\">"
+        "<mwg-coll:CollectionName>Summer 1987</mwg-coll:CollectionName>"
+        "<mwg-coll:CollectionURI>urn:album:1987</mwg-coll:CollectionURI></rdf:li></rdf:Bag></mwg-coll:Collections>\n";
+
+    if (shape.locations > 0) {
+        x += "<Iptc4xmpExt:LocationShown><rdf:Bag>\n";
+        for(int i = 0; i < shape.locations; i += 1) {
+            x += "<rdf:li rdf:parseType=\"Resource\">\n";
+            altLang(x, "Iptc4xmpExt:LocationName", shape, w);
+            char buf[128];
+            snprintf(buf, sizeof(buf), "<exif:GPSLatitude>%.6f</exif:GPSLatitude><exif:GPSLongitude>%.6f</exif:GPSLongitude>\n",
+                w.unit() * 180 - 90, w.unit() * 360 - 180);
+            x += buf;
+            snprintf(buf, sizeof(buf), "<Iptc4xmpExt:LocationId><rdf:Bag><rdf:li>urn:place:%u</rdf:li></rdf:Bag></Iptc4xmpExt:LocationId>\n", w.next());
+            x += buf;
+            x += "</rdf:li>\n";
+        }
+        x += "</rdf:Bag></Iptc4xmpExt:LocationShown>\n";
+    }
+
+    if (shape.regions > 0) {
+        x += "<Iptc4xmpExt:ImageRegion><rdf:Bag>\n";
+        for(int i = 0; i < shape.regions; i += 1) {
+            x += "<rdf:li rdf:parseType=\"Resource\">\n<Iptc4xmpExt:RegionBoundary rdf:parseType=\"Resource\">"
+                "<Iptc4xmpExt:rbUnit>relative</Iptc4xmpExt:rbUnit>";
+            switch(i % 3) {
+                case 0:
+                    x += "<Iptc4xmpExt:rbShape>rectangle</Iptc4xmpExt:rbShape>";
+                    number(x, "rbX", w.unit()); number(x, "rbY", w.unit());
+                    number(x, "rbW", w.unit() / 2); number(x, "rbH", w.unit() / 2);
+                    break;
+                case 1:
+                    x += "<Iptc4xmpExt:rbShape>circle</Iptc4xmpExt:rbShape>";
+                    number(x, "rbX", w.unit()); number(x, "rbY", w.unit());
+                    number(x, "rbRx", w.unit() / 4);
+                    break;
+                case 2:
+                    x += "<Iptc4xmpExt:rbShape>polygon</Iptc4xmpExt:rbShape><Iptc4xmpExt:rbVertices><rdf:Seq>";
+                    for(int v = 0; v < 5; v += 1) {
+                        x += "<rdf:li rdf:parseType=\"Resource\">";
+                        number(x, "rbX", w.unit()); number(x, "rbY", w.unit());
+                        x += "</rdf:li>";
+                    }
+                    x += "</rdf:Seq></Iptc4xmpExt:rbVertices>";
+                    break;
+            }
+            x += "</Iptc4xmpExt:RegionBoundary>\n";
+            x += "<Iptc4xmpExt:PersonInImageWDetails><rdf:Bag><rdf:li rdf:parseType=\"Resource\">\n";
+            altLang(x, "Iptc4xmpExt:PersonName", shape, w);
+            char buf[128];
+            snprintf(buf, sizeof(buf), "<Iptc4xmpExt:PersonId><rdf:Bag><rdf:li>urn:person:%u</rdf:li></rdf:Bag></Iptc4xmpExt:PersonId>\n", w.next());
+            x += buf;
+            x += "</rdf:li></rdf:Bag></Iptc4xmpExt:PersonInImageWDetails>\n";
+            if (i % 3 == 2) {
+                x += "<Iptc4xmpExt:ArtworkOrObject><rdf:Bag><rdf:li rdf:parseType=\"Resource\">\n";
+                altLang(x, "Iptc4xmpExt:AOTitle", shape, w);
+                x += "</rdf:li></rdf:Bag></Iptc4xmpExt:ArtworkOrObject>\n";
+            }
+            x += "</rdf:li>\n";
+        }
+        x += "</rdf:Bag></Iptc4xmpExt:ImageRegion>\n";
+    }
+    x += "</rdf:Description>\n</rdf:RDF>\n</x:xmpmeta>\n";
+    // padding in lines of 100 bytes, as the toolkit writes it, so that writer --in-place has room
+    for(size_t n = 0; n < shape.padding; n += 100) x += std::string(99, ' ') + '\n';
+    x += "<?xpacket end=\"w\"?>";
+    return x;
+}
+
+void be16(std::string& s, unsigned v) { s += (char)(v >> 8); s += (char)v; }
+void be32(std::string& s, uint32_t v) { be16(s, v >> 16); be16(s, v & 0xFFFF); }
+void le16(std::string& s, unsigned v) { s += (char)v; s += (char)(v >> 8); }
+void le32(std::string& s, uint32_t v) { le16(s, v & 0xFFFF); le16(s, v >> 16); }
+
+/** The largest packet that fits in one APP1 segment (no ExtendedXMP) */
+const size_t maxJPEGPacket = 65533 - 29;
+
+/** A baseline 1x1 greyscale JPEG: one DC and one AC code, both 0, so the scan is the single byte 0x3F */
+std::string jpeg(const std::string& xmp) {
+    std::string f("\xFF\xD8", 2);
+    f += "\xFF\xE1"; be16(f, 2 + 29 + xmp.size());
+    f.append("http://ns.adobe.com/xap/1.0/", 29); // with its NUL
+    f += xmp;
+    f += "\xFF\xDB"; be16(f, 67); f += '\0'; f += std::string(64, '\x01');
+    f += "\xFF\xC0"; be16(f, 11); f += '\x08'; be16(f, 1); be16(f, 1); f += "\x01\x01\x11"; f += '\0';
+    for(char table : {'\x00', '\x10'}) {
+        f += "\xFF\xC4"; be16(f, 20); f += table; f += '\x01'; f += std::string(15, '\0'); f += '\0';
+    }
+    f += "\xFF\xDA"; be16(f, 8); f += "\x01\x01"; f += std::string(2, '\0'); f += '\x3F'; f += '\0';
+    f += "\x3F\xFF\xD9";
+    return f;
+}
+
+/** A little-endian 1x1 greyscale TIFF with the packet in tag 700 */
+std::string tiff(const std::string& xmp) {
+    const uint32_t pixel = 8 + 2 + 9 * 12 + 4, packet = pixel + 2;
+    std::string f("II*\0", 4);
+    le32(f, 8);
+    le16(f, 9);
+    auto entry = [&](unsigned tag, unsigned type, uint32_t count, uint32_t value) {
+        le16(f, tag); le16(f, type); le32(f, count); le32(f, value);
+    };
+    entry(256, 3, 1, 1);             // ImageWidth
+    entry(257, 3, 1, 1);             // ImageLength
+    entry(258, 3, 1, 8);             // BitsPerSample
+    entry(259, 3, 1, 1);             // Compression: none
+    entry(262, 3, 1, 1);             // PhotometricInterpretation: BlackIsZero
+    entry(273, 4, 1, pixel);         // StripOffsets
+    entry(278, 3, 1, 1);             // RowsPerStrip
+    entry(279, 4, 1, 1);             // StripByteCounts
+    entry(700, 1, xmp.size(), packet); // XMP
+    le32(f, 0);
+    f += '\x80'; f += '\0'; // the pixel, and a byte to keep the packet word-aligned
+    f += xmp;
+    return f;
+}
+
+uint32_t crc32(const std::string& s, size_t from) {
+    static uint32_t table[256];
+    if (!table[1]) {
+        for(uint32_t n = 0; n < 256; n += 1) {
+            uint32_t c = n;
+            for(int k = 0; k < 8; k += 1) c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+    }
+    uint32_t c = 0xFFFFFFFF;
+    for(size_t i = from; i < s.size(); i += 1) c = table[(c ^ (unsigned char)s[i]) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFF;
+}
+
+void chunk(std::string& f, const char *type, const std::string& data) {
+    be32(f, data.size());
+    size_t from = f.size();
+    f += type;
+    f += data;
+    be32(f, crc32(f, from));
+}
+
+/** A 1x1 greyscale PNG with the packet in an iTXt chunk before the image data */
+std::string png(const std::string& xmp) {
+    std::string f("\x89PNG\r\n\x1A\n", 8), d;
+    be32(d, 1); be32(d, 1); d += '\x08'; d += std::string(4, '\0');
+    chunk(f, "IHDR", d);
+    d.assign("XML:com.adobe.xmp", 17);
+    d += std::string(5, '\0'); // keyword's NUL, uncompressed, method, empty language and translation
+    d += xmp;
+    chunk(f, "iTXt", d);
+    // zlib stream of one stored block holding the row: filter byte and pixel
+    chunk(f, "IDAT", std::string("\x78\x01\x01\x02\x00\xFD\xFF\x00\x00\x00\x02\x00\x01", 13));
+    chunk(f, "IEND", "");
+    return f;
+}
+
+int usage(const char *name) {
+    fprintf(stderr, "USAGE: %s [-n count] [-f jpg,tif,png] [-r regions] [-l locations] [-a langs] [-t textlen] [-p padding] [-s seed] outdir\n"
+        "    -n N    files of each format to write (default 100)\n"
+        "    -f LIST formats to write (default all three)\n"
+        "    -r N    ImageRegions per packet, each with a person and every third with an object (default 4)\n"
+        "    -l N    LocationShown entries per packet (default 2)\n"
+        "    -a N    languages in each AltLang, counting x-default (default 3)\n"
+        "    -t N    bytes of text in each language (default 40)\n"
+        "    -p N    bytes of packet padding (default 2048)\n"
+        "    -s N    seed for the generated text and numbers (default 1)\n"
+        "    JPEG packets are limited to one APP1 segment (about 64KB); larger ones are written only as TIFF and PNG\n", name);
+    return -1;
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[]) {
+    Shape shape;
+    long count = 100;
+    unsigned seed = 1;
+    std::string formats = "jpg,tif,png";
+    const char *dir = 0;
+    for(int i = 1; i < argc; ++i) {
+        if (argv[i][0] != '-') {
+            if (dir) return usage(argv[0]);
+            dir = argv[i];
+            continue;
+        }
+        if (i+1 >= argc || argv[i][2]) return usage(argv[0]);
+        const char *arg = argv[++i];
+        if (argv[i-1][1] == 'f') { formats = arg; continue; }
+        char *end;
+        long n = strtol(arg, &end, 10);
+        if (!*arg || *end || n < 0) return usage(argv[0]);
+        switch(argv[i-1][1]) {
+            case 'n': count = n; break;
+            case 'r': shape.regions = n; break;
+            case 'l': shape.locations = n; break;
+            case 'a': shape.langs = n; break;
+            case 't': shape.textLen = n; break;
+            case 'p': shape.padding = n; break;
+            case 's': seed = n; break;
+            default: return usage(argv[0]);
+        }
+    }
+    if (!dir) return usage(argv[0]);
+
+    Words w(seed);
+    size_t written = 0, bytes = 0, largest = 0;
+    bool warned = false;
+    for(long i = 0; i < count; i += 1) {
+        std::string xmp = packet(shape, w);
+        if (xmp.size() > largest) largest = xmp.size();
+        for(const char *ext : {"jpg", "tif", "png"}) {
+            if (("," + formats + ",").find(std::string(",") + ext + ",") == std::string::npos) continue;
+            if (ext[0] == 'j' && xmp.size() > maxJPEGPacket) {
+                if (!warned) fprintf(stderr, "packets of %zu bytes are too large for JPEG; skipping .jpg\n", xmp.size());
+                warned = true;
+                continue;
+            }
+            std::string f = ext[0] == 'j' ? jpeg(xmp) : ext[0] == 't' ? tiff(xmp) : png(xmp);
+            char name[32];
+            snprintf(name, sizeof(name), "/bench-%05ld.%s", i, ext);
+            std::string path = dir + std::string(name);
+            FILE *out = fopen(path.c_str(), "wb");
+            if (!out || fwrite(f.data(), 1, f.size(), out) != f.size() || fclose(out) != 0) {
+                fprintf(stderr, "Cannot write \"%s\": %s\n", path.c_str(), strerror(errno));
+                return -1;
+            }
+            written += 1;
+            bytes += f.size();
+        }
+    }
+    fprintf(stderr, "wrote %zu files, %zu bytes; largest packet %zu bytes\n", written, bytes, largest);
+    return 0;
+}
@@ -0,0 +1,191 @@
+#include "fhmwg1ds.hpp"
+#include "fhmwg1arena.hpp"
+#include "fhmwg1batch.hpp"
+#include "fhmwg1packet.hpp"
+#include "fhmwg1write.hpp"
+#include "fhmwg1out.hpp"
+#define TXMP_STRING_TYPE	std::string
+#define XMP_INCLUDE_XMPFILES 1
+#include <XMP.hpp>
+#include <XMP.incl_cpp>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+/**
+ * Times the stages of the FHMWG pipeline separately over a corpus (such
+ * as one benchgen wrote) and prints the results as one JSON object, so
+ * that runs on different commits can be compared by a script:
+ *
+ * - parseFile: reading a file's metadata into the model
+ * - dumpJSON, dumpGEDCOM: rendering the model
+ * - updateMetadata: applying a patch that gives every field of the
+ *   file's own model back to a copy of its XMP
+ */
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+/** The latencies and work of one stage */
+struct Stage {
+    const char *name;
+    std::vector<double> ns;
+    /** Bytes read or written, or 0 if that is not meaningful for the stage */
+    size_t bytes = 0;
+
+    explicit Stage(const char *name) : name(name) {}
+    template<class F> void time(F f) {
+        auto start = Clock::now();
+        f();
+        this->ns.push_back(std::chrono::duration<double, std::nano>(Clock::now() - start).count());
+    }
+    /** The nearest-rank percentile `p` of the sorted latencies, in microseconds */
+    double percentile(double p) const {
+        if (this->ns.empty()) return 0;
+        size_t rank = (size_t)(p / 100 * this->ns.size() + 0.999999);
+        return this->ns[std::min(std::max(rank, (size_t)1), this->ns.size()) - 1] / 1000;
+    }
+    void report(fhmwg::OutBuf& o) {
+        std::sort(this->ns.begin(), this->ns.end());
+        double total = 0;
+        for(double t : this->ns) total += t;
+        double seconds = total / 1e9;
+        o.put('"').put(this->name).put("\":{\"calls\":").integer(this->ns.size())
+         .put(",\"seconds\":").number(seconds)
+         .put(",\"per_second\":").number(seconds > 0 ? this->ns.size() / seconds : 0);
+        if (this->bytes > 0) o.put(",\"bytes\":").integer(this->bytes)
+         .put(",\"mb_per_second\":").number(seconds > 0 ? this->bytes / seconds / 1e6 : 0);
+        o.put(",\"mean_us\":").number(this->ns.empty() ? 0 : total / this->ns.size() / 1000)
+         .put(",\"p50_us\":").number(percentile(50))
+         .put(",\"p90_us\":").number(percentile(90))
+         .put(",\"p99_us\":").number(percentile(99))
+         .put(",\"max_us\":").number(percentile(100)).put('}');
+    }
+};
+
+int usage(const char *name) {
+    fprintf(stderr, "USAGE: %s [-n reps] [-x|-s] [-w] [-L label] imagefile|directory...\n"
+        "    -n N     time each stage N times per file (default 5), after one untimed pass\n"
+        "    -x, -s, -w  parse as parser does with these flags\n"
+        "    -L TEXT  include \"label\":TEXT in the output, e.g. a commit id\n"
+        "    directories are walked recursively; - reads a list of paths from stdin\n"
+        "    prints one JSON object with calls, throughput and latency percentiles per stage\n", name);
+    return -1;
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[]) {
+    int reps = 5;
+    const char *label = 0;
+    fhmwg::ParseOptions opts;
+    fhmwg::PathSource files;
+    files.recursive = true;
+    for(int i = 1; i < argc; ++i) {
+        if (!strcmp("-x", argv[i])) { opts.packetOnly = true; continue; }
+        if (!strcmp("-s", argv[i])) { opts.streaming = true; continue; }
+        if (!strcmp("-w", argv[i])) { opts.unicodeSpaces = true; continue; }
+        if (!strcmp("-L", argv[i])) {
+            if (i+1 >= argc) return usage(argv[0]);
+            label = argv[++i];
+            continue;
+        }
+        if (!strcmp("-n", argv[i])) {
+            char *end;
+            reps = i+1 < argc ? strtol(argv[++i], &end, 10) : -1;
+            if (reps < 1 || *end) return usage(argv[0]);
+            continue;
+        }
+        files.add(argv[i]);
+    }
+
+    if (!SXMPMeta::Initialize()) {
+        fprintf(stderr, "## SXMPMeta::Initialize failed!\n");
+        return -1;
+    }
+    if (!SXMPFiles::Initialize()) {
+        fprintf(stderr, "## SXMPFiles::Initialize failed!\n");
+        return -1;
+    }
+    fhmwg::ns::init();
+
+    Stage parse("parseFile"), json("dumpJSON"), gedcom("dumpGEDCOM"), update("updateMetadata");
+    fhmwg::Arena arena;
+    fhmwg::ImageMetadata md(&arena);
+    std::string out, serialized, path;
+    size_t count = 0, failed = 0, fileBytes = 0;
+    while(files.next(path)) {
+        fhmwg::MappedFile file;
+        size_t size = file.open(path.c_str()) ? file.size : 0;
+        try {
+            // untimed: warms the page cache and gets what the other stages work from
+            md.reset();
+            arena.reset();
+            md.parseFile(path.c_str(), opts);
+            fhmwg::Patch patch;
+            serialized.clear();
+            md.serialize(serialized);
+            patch.md.deserialize(serialized);
+            patch.given = (1 << fhmwg::Patch::FIELDS) - 1;
+            SXMPMeta xmp;
+            {
+                SXMPFiles source;
+                if (!source.OpenFile(path.c_str(), kXMP_UnknownFile, kXMPFiles_OpenForRead)
+                || !source.GetXMP(&xmp, 0, 0)) throw XMP_Error(kXMPErr_BadFileFormat, "no XMP to update");
+                source.CloseFile();
+            }
+
+            for(int r = 0; r < reps; r += 1) {
+                parse.time([&]() {
+                    md.reset();
+                    arena.reset();
+                    md.parseFile(path.c_str(), opts);
+                });
+                parse.bytes += size;
+                json.time([&]() {
+                    out.clear();
+                    fhmwg::OutBuf o(out);
+                    md.dumpJSON(o);
+                });
+                json.bytes += out.size();
+                gedcom.time([&]() {
+                    out.clear();
+                    fhmwg::OutBuf o(out);
+                    md.dumpGEDCOM(o);
+                });
+                gedcom.bytes += out.size();
+                SXMPMeta edited = xmp.Clone();
+                update.time([&]() { fhmwg::updateMetadata(edited, patch); });
+            }
+            count += 1;
+            fileBytes += size;
+        } catch (XMP_Error ex) {
+            fprintf(stderr, "%s: XMP error %d: %s\n", path.c_str(), ex.GetID(), ex.GetErrMsg());
+            failed += 1;
+        }
+    }
+
+    SXMPFiles::Terminate();
+    SXMPMeta::Terminate();
+
+    fhmwg::OutBuf o(stdout);
+    o.put('{');
+    if (label) o.put("\"label\":").json(label).put(',');
+    o.put("\"files\":").integer(count).put(",\"failed\":").integer(failed)
+     .put(",\"bytes\":").integer(fileBytes).put(",\"reps\":").integer(reps)
+     .put(",\"mode\":").json(opts.streaming ? "streaming" : opts.packetOnly ? "packet" : "toolkit")
+     .put(",\"stages\":{");
+    parse.report(o);
+    o.put(',');
+    json.report(o);
+    o.put(',');
+    gedcom.report(o);
+    o.put(',');
+    update.report(o);
+    o.put("}}\n");
+    return failed > 0 ? 1 : 0;
+}
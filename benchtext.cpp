@@ -0,0 +1,127 @@
+#include "fhmwg1text.hpp"
+#include "fhmwg1out.hpp"
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+
+/**
+ * Microbenchmark for the scanning kernels of fhmwg1text.cpp: times
+ * whitespace normalization and JSON string escaping of caption-like
+ * text with each kernel the CPU supports, and with the byte-at-a-time
+ * loops they replaced.
+ */
+
+using namespace fhmwg;
+
+/** whitespaceNormalize as it was before the kernels */
+static size_t legacyNormalize(char *s) {
+    size_t r = 0, w = 0;
+    bool was = true;
+    while(s[r]) {
+        bool is = std::isspace(s[r]);
+        if (is && !was) s[w++] = ' ';
+        else if (!is) s[w++] = s[r];
+        was = is;
+        r += 1;
+    }
+    s[w] = 0;
+    while(w > 0 && std::isspace(s[w-1]))
+        s[--w] = 0;
+    return w;
+}
+
+/** jsonString as it was before the kernels */
+static void legacyJSON(OutBuf& o, std::string_view payload) {
+    char tmp[8];
+    o.put('"');
+    for(int c : payload) {
+        if (c < 0x20) {
+            if (c == '\n') o.put("\\n");
+            else if (c == '\r') o.put("\\r");
+            else if (c == '\t') o.put("\\t");
+            else if (c == '\f') o.put("\\f");
+            else if (c == '\b') o.put("\\b");
+            else { snprintf(tmp, sizeof(tmp), "\\u%04x", c); o.put(tmp); }
+        } else if (c == '"') o.put("\\\"");
+        else if (c == '\\') o.put("\\\\");
+        else o.put((char)c);
+    }
+    o.put('"');
+}
+
+/** Captions of `len` bytes: mostly words, some doubled spaces and newlines, some non-ASCII */
+static std::vector<std::string> corpus(size_t count, size_t len) {
+    static const char *words[] = {
+        "Grandma", "and", "the", "twins", "at", "Lake", "Tahoe,", "summer", "1987.",
+        "Photographed", "by", "\"Uncle Bob\"", "Müller", "née", "Øster", "東京", "の", "夏",
+    };
+    std::vector<std::string> ans(count);
+    unsigned seed = 1;
+    for(std::string& s : ans) {
+        while(s.size() < len) {
+            seed = seed * 1103515245 + 12345;
+            s += words[(seed >> 16) % (sizeof(words) / sizeof(*words))];
+            unsigned gap = (seed >> 8) % 16;
+            s += gap == 0 ? "\n  " : gap == 1 ? "  " : " ";
+        }
+        s.resize(len);
+    }
+    return ans;
+}
+
+template<class F> static double nsPerByte(size_t bytes, int reps, F f) {
+    auto start = std::chrono::steady_clock::now();
+    for(int r=0; r<reps; r+=1) f();
+    std::chrono::duration<double, std::nano> took = std::chrono::steady_clock::now() - start;
+    return took.count() / ((double)bytes * reps);
+}
+
+int main(int argc, char *argv[]) {
+    size_t len = argc > 1 ? strtoul(argv[1], 0, 10) : 256;
+    size_t count = (1 << 22) / (len ? len : 1);
+    int reps = 20;
+    std::vector<std::string> text = corpus(count, len);
+    std::vector<std::string> work(text.size());
+    std::string out;
+    out.reserve(len * 2 * count + 2 * count);
+    size_t bytes = len * count;
+    volatile size_t sink = 0;
+
+    printf("%zu strings of %zu bytes, ns/byte\n", count, len);
+    printf("%-8s %12s %12s %12s\n", "kernel", "normalize", "unicode", "json");
+
+    auto normalize = [&](auto fn) {
+        return nsPerByte(bytes, reps, [&]() {
+            for(size_t i=0; i<text.size(); i+=1) {
+                work[i].assign(text[i]);
+                sink = sink + fn(work[i]);
+            }
+        });
+    };
+    auto escape = [&](auto fn) {
+        return nsPerByte(bytes, reps, [&]() {
+            out.clear();
+            OutBuf o(out);
+            for(const std::string& s : text) fn(o, s);
+            sink = sink + out.size();
+        });
+    };
+
+    printf("%-8s %12.3f %12s %12.3f\n", "legacy",
+        normalize([](std::string& s) { return legacyNormalize(&s[0]); }), "-",
+        escape([](OutBuf& o, const std::string& s) { legacyJSON(o, s); }));
+
+    static const char *names[] = { "scalar", "sse2", "avx2" };
+    for(TextKernel k : { SCALAR_KERNEL, SSE2_KERNEL, AVX2_KERNEL }) {
+        if (!useTextKernel(k)) continue;
+        printf("%-8s %12.3f %12.3f %12.3f\n", names[k],
+            normalize([](std::string& s) { whitespaceNormalize(s); return s.size(); }),
+            normalize([](std::string& s) { whitespaceNormalize(s, UNICODE_SPACES); return s.size(); }),
+            escape([](OutBuf& o, const std::string& s) { o.json(s); }));
+    }
+    return 0;
+}
@@ -0,0 +1,49 @@
+#include "fhmwg1arena.hpp"
+#include <cstdlib>
+#include <new>
+
+namespace fhmwg {
+
+Arena::Arena(size_t initial) {
+    this->blocks.reserve(8);
+    addBlock(initial);
+}
+
+Arena::~Arena() {
+    for(Block& b : this->blocks) free(b.data);
+}
+
+void Arena::addBlock(size_t size) {
+    char *data = (char *)malloc(size);
+    if (!data) throw std::bad_alloc();
+    this->blocks.push_back(Block{data, size});
+    this->total += size;
+    this->used = 0;
+    this->grown += 1;
+}
+
+void *Arena::do_allocate(size_t bytes, size_t align) {
+    Block& b = this->blocks.back();
+    size_t at = (this->used + align - 1) & ~(align - 1);
+    if (at + bytes > b.size) {
+        // double the arena each time it grows, so a large file needs few blocks
+        size_t size = this->total > bytes ? this->total : bytes + align;
+        addBlock(size);
+        return do_allocate(bytes, align);
+    }
+    this->used = at + bytes;
+    return b.data + at;
+}
+
+void Arena::reset() {
+    if (this->blocks.size() > 1) {
+        size_t size = this->total;
+        for(Block& b : this->blocks) free(b.data);
+        this->blocks.clear();
+        this->total = 0;
+        addBlock(size);
+    }
+    this->used = 0;
+}
+
+} // namespace fhmwg
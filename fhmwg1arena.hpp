@@ -0,0 +1,44 @@
+#pragma once
+#include <memory_resource>
+#include <vector>
+#include <cstddef>
+
+namespace fhmwg {
+
+/**
+ * A bump allocator for everything built while handling one file.
+ * Deallocation is a no-op; reset() forgets every allocation at once.
+ *
+ * When a file needed more than one block, reset() replaces them all with
+ * a single block as large as their total, so that once the arena has seen
+ * its largest file it stops allocating from the heap altogether.
+ * Not thread-safe: use one per worker thread.
+ */
+class Arena : public std::pmr::memory_resource {
+public:
+    explicit Arena(size_t initial = 64 * 1024);
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    /** Makes all memory handed out so far available again. Nothing allocated from it may be used afterwards. */
+    void reset();
+
+    /** Number of blocks taken from the heap over the arena's lifetime */
+    size_t heapAllocations() const { return this->grown; }
+
+protected:
+    void *do_allocate(size_t bytes, size_t align) override;
+    void do_deallocate(void *, size_t, size_t) override {}
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+private:
+    struct Block { char *data; size_t size; };
+    std::vector<Block> blocks;
+    size_t used = 0;  // bytes used in blocks.back()
+    size_t total = 0; // bytes in all blocks
+    size_t grown = 0;
+    void addBlock(size_t size);
+};
+
+} // namespace fhmwg
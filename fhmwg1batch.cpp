@@ -0,0 +1,212 @@
+#include "fhmwg1batch.hpp"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace fhmwg {
+
+/** A finished input waiting for its turn to be emitted */
+struct Finished {
+    std::string input, output;
+};
+
+void runBatch(int jobs, bool ordered,
+    const std::function<bool(std::string&)>& next,
+    const std::function<void(const std::string&, std::string&)>& work,
+    const std::function<void(const std::string&, const std::string&)>& emit) {
+
+    if (jobs < 2) {
+        std::string input, output;
+        while(next(input)) {
+            output.clear();
+            work(input, output);
+            emit(input, output);
+        }
+        return;
+    }
+
+    std::mutex lock, emitLock;
+    std::condition_variable room;
+    size_t issued = 0, emitted = 0;
+    bool exhausted = false;
+    std::exception_ptr failure;
+    std::map<size_t, Finished> pending;
+    // bounds how far workers may run ahead of a slow file in ordered mode
+    const size_t window = 4 * (size_t)jobs;
+
+    auto worker = [&]() {
+        std::string input, output;
+        for(;;) {
+            size_t seq;
+            {
+                std::unique_lock<std::mutex> l(lock);
+                if (ordered)
+                    room.wait(l, [&]{ return exhausted || failure || issued - emitted < window; });
+                if (exhausted || failure) return;
+                try {
+                    if (!next(input)) { exhausted = true; room.notify_all(); return; }
+                } catch (...) {
+                    failure = std::current_exception();
+                    room.notify_all();
+                    return;
+                }
+                seq = issued++;
+            }
+            try {
+                output.clear();
+                work(input, output);
+                if (!ordered) {
+                    std::lock_guard<std::mutex> l(emitLock);
+                    emit(input, output);
+                    continue;
+                }
+                std::unique_lock<std::mutex> l(lock);
+                if (seq != emitted) {
+                    // someone else will emit this once everything before it is out
+                    Finished &slot = pending[seq];
+                    slot.input.swap(input);
+                    slot.output.swap(output);
+                    continue;
+                }
+                // this thread holds the next result in order, so it emits
+                // it and then everything queued up behind it
+                l.unlock();
+                emit(input, output);
+                l.lock();
+                emitted += 1;
+                for(auto it = pending.find(emitted); it != pending.end(); it = pending.find(emitted)) {
+                    Finished done = std::move(it->second);
+                    pending.erase(it);
+                    l.unlock();
+                    emit(done.input, done.output);
+                    l.lock();
+                    emitted += 1;
+                }
+                room.notify_all();
+            } catch (...) {
+                std::lock_guard<std::mutex> l(lock);
+                if (!failure) failure = std::current_exception();
+                room.notify_all();
+                return;
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for(int i=0; i<jobs; i+=1) pool.emplace_back(worker);
+    for(std::thread& t : pool) t.join();
+    if (failure) std::rethrow_exception(failure);
+}
+
+PathSource::~PathSource() {
+    free(this->line);
+}
+
+void PathSource::add(const char *path) {
+    this->roots.push_back(path);
+}
+
+void PathSource::extensions(const char *list) {
+    while(*list) {
+        const char *end = strchr(list, ',');
+        if (!end) end = list + strlen(list);
+        std::string ext;
+        for(const char *c = list; c < end; c += 1) ext += (char)std::tolower(*c);
+        if (ext.size() > 0 && ext[0] == '.') ext.erase(0, 1);
+        if (ext.size() > 0) this->exts.push_back(ext);
+        list = *end ? end + 1 : end;
+    }
+}
+
+bool PathSource::wanted(const std::string& name) {
+    if (this->exts.size() == 0) return true;
+    size_t dot = name.rfind('.');
+    if (dot == std::string::npos) return false;
+    for(const std::string& ext : this->exts) {
+        if (name.size() - dot - 1 != ext.size()) continue;
+        size_t i = 0;
+        while(i < ext.size() && std::tolower(name[dot+1+i]) == ext[i]) i += 1;
+        if (i == ext.size()) return true;
+    }
+    return false;
+}
+
+/**
+ * If `path` is a directory to be walked, opens it as a new frame and
+ * returns true; otherwise returns false and `path` should be emitted.
+ */
+bool PathSource::expand(const std::string& path) {
+    if (!this->recursive) return false;
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) return false;
+
+    DIR *d = opendir(path.c_str());
+    if (!d) {
+        fprintf(stderr, "Cannot read directory \"%s\"\n", path.c_str());
+        return true;
+    }
+    Frame frame;
+    frame.dir = path;
+    while(frame.dir.size() > 1 && frame.dir.back() == '/') frame.dir.pop_back();
+    struct dirent *ent;
+    while((ent = readdir(d))) {
+        if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) continue;
+        bool dir = ent->d_type == DT_DIR, link = ent->d_type == DT_LNK;
+        if (ent->d_type == DT_UNKNOWN) {
+            std::string full = frame.dir + '/' + ent->d_name;
+            bool known = lstat(full.c_str(), &st) == 0;
+            dir = known && S_ISDIR(st.st_mode);
+            link = known && S_ISLNK(st.st_mode);
+        }
+        if (link) {
+            // symbolic links to files are followed, but not those to directories, which could loop
+            std::string full = frame.dir + '/' + ent->d_name;
+            if (stat(full.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) continue;
+        }
+        frame.entries.emplace_back(ent->d_name, dir);
+    }
+    closedir(d);
+    std::sort(frame.entries.begin(), frame.entries.end());
+    this->walk.push_back(std::move(frame));
+    return true;
+}
+
+bool PathSource::next(std::string& path) {
+    for(;;) {
+        while(this->walk.size() > 0) {
+            Frame& top = this->walk.back();
+            if (top.at >= top.entries.size()) { this->walk.pop_back(); continue; }
+            const std::pair<std::string, bool>& ent = top.entries[top.at++];
+            path = top.dir;
+            if (path != "/") path += '/';
+            path += ent.first;
+            if (ent.second) expand(path);
+            else if (wanted(ent.first)) return true;
+        }
+        if (this->list) {
+            ssize_t got = getdelim(&this->line, &this->lineCap, this->delim, this->list);
+            if (got < 0) { this->list = 0; continue; }
+            if (got > 0 && this->line[got-1] == this->delim) got -= 1;
+            if (this->delim == '\n' && got > 0 && this->line[got-1] == '\r') got -= 1;
+            if (got == 0) continue;
+            path.assign(this->line, got);
+            if (!expand(path)) return true;
+            continue;
+        }
+        if (this->root >= this->roots.size()) return false;
+        path = this->roots[this->root++];
+        if (path == "-") { this->list = stdin; continue; }
+        if (!expand(path)) return true;
+    }
+}
+
+} // namespace fhmwg
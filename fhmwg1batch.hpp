@@ -0,0 +1,65 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdio>
+
+namespace fhmwg {
+
+/**
+ * Runs a stream of inputs through a pool of worker threads.
+ *
+ * `next` is asked for inputs one at a time (never concurrently) and
+ * returns false once the stream is exhausted. `work` turns an input into
+ * an output on whichever worker picked it up. `emit` is called once per
+ * input, never concurrently; if `ordered` it is called in input order,
+ * otherwise in completion order.
+ *
+ * With `jobs` less than 2 everything runs on the calling thread.
+ * If `work` throws, no further inputs are started, the inputs already in
+ * flight are finished, and the exception is rethrown on the calling thread.
+ */
+void runBatch(int jobs, bool ordered,
+    const std::function<bool(std::string&)>& next,
+    const std::function<void(const std::string&, std::string&)>& work,
+    const std::function<void(const std::string&, const std::string&)>& emit);
+
+/**
+ * Produces image paths one at a time, in the order they were added, from
+ * plain paths, from newline- or NUL-separated lists read off a stream,
+ * and (if `recursive`) from walking any directory it is given. Walks visit
+ * entries in byte-wise name order so that repeated runs agree; symbolic
+ * links to directories are skipped, neither followed nor produced. The
+ * extension filter applies only to files found by walking, not to paths
+ * given explicitly.
+ */
+class PathSource {
+public:
+    bool recursive = false;
+    ~PathSource();
+    /** Adds a path; "-" stands for the list on `stdin` */
+    void add(const char *path);
+    /** Sets the list separator: '\n' (the default) or '\0' */
+    void separator(char delim) { this->delim = delim; }
+    /** Accepts a comma-separated list of extensions, e.g. "jpg,jpeg,tif" */
+    void extensions(const char *list);
+    bool next(std::string& path);
+private:
+    struct Frame {
+        std::string dir;
+        std::vector<std::pair<std::string, bool>> entries; // name, is-directory
+        size_t at = 0;
+    };
+    std::vector<std::string> roots;
+    size_t root = 0;
+    FILE *list = 0;
+    char delim = '\n';
+    char *line = 0;
+    size_t lineCap = 0;
+    std::vector<Frame> walk;
+    std::vector<std::string> exts;
+    bool expand(const std::string& path);
+    bool wanted(const std::string& name);
+};
+
+} // namespace fhmwg
@@ -0,0 +1,329 @@
+#include "fhmwg1cache.hpp"
+#include "fhmwg1packet.hpp"
+#include <cstddef>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace fhmwg {
+
+namespace {
+
+const char magic[8] = {'F','H','M','W','G','C','1','\n'};
+
+/** Buffered stores are appended once they reach this size */
+const size_t flushAt = 1 << 20;
+
+/** Logs smaller than this are never compacted */
+const size_t compactFrom = 4 << 20;
+
+/** The fixed part of each record; the serialized model follows it */
+struct RecordHead {
+    uint32_t length; // of the whole record
+    uint32_t check;  // of everything after this field
+    uint64_t dev, ino, size;
+    int64_t mtime;
+    uint64_t hash;
+    uint32_t opts;
+    uint32_t languages; // languageBits of the options
+};
+
+/** A fast non-cryptographic 64-bit hash, used both for checksums and for file contents */
+uint64_t hash64(const unsigned char *p, size_t n) {
+    const uint64_t k = 0x9E3779B97F4A7C15ull;
+    uint64_t h = n * k;
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        h = (h ^ w) * k;
+        h ^= h >> 29;
+    }
+    uint64_t w = 0;
+    memcpy(&w, p + i, n - i);
+    h = (h ^ w) * k;
+    return h ^ (h >> 32);
+}
+
+/** The checksum of the `length`-byte record at `r`, which need not be aligned */
+uint32_t checksum(const unsigned char *r, uint32_t length) {
+    const size_t from = offsetof(RecordHead, dev);
+    return (uint32_t)hash64(r + from, length - from);
+}
+
+/**
+ * The options that change a result, other than the languages. Fields left
+ * out are stored so that the default of all fields encodes as 0, as in
+ * logs written before there was a choice.
+ */
+uint32_t optionBits(const ParseOptions& opts) {
+    return (opts.packetOnly ? 1 : 0) | (opts.streaming ? 2 : 0) | (opts.unicodeSpaces ? 4 : 0)
+        | (~opts.fields & ALL_FIELDS) << 8;
+}
+
+/** A hash of the language list, or 0 if there is none, as in logs written before there was one */
+uint32_t languageBits(const ParseOptions& opts) {
+    if (opts.languages.size() == 0) return 0;
+    uint32_t h = (uint32_t)hash64((const unsigned char *)opts.languages.data(), opts.languages.size());
+    return h ? h : 1;
+}
+
+/** Writes all of `len` bytes, retrying short writes */
+bool writeAll(int fd, const char *data, size_t len) {
+    while(len > 0) {
+        ssize_t wrote = write(fd, data, len);
+        if (wrote < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += wrote;
+        len -= wrote;
+    }
+    return true;
+}
+
+/**
+ * The end of the last intact record of the log `fd`, which is `size` bytes
+ * long, checking the records from `from`, which must be the start of one
+ */
+size_t intactEnd(int fd, size_t from, size_t size) {
+    std::string record;
+    while(from + sizeof(RecordHead) <= size) {
+        RecordHead head;
+        if (pread(fd, &head, sizeof(head), from) != (ssize_t)sizeof(head)
+        || head.length < sizeof(head) || head.length > size - from) break;
+        record.resize(head.length);
+        if (pread(fd, &record[0], head.length, from) != (ssize_t)head.length
+        || head.check != checksum((const unsigned char *)record.data(), head.length)) break;
+        from += head.length;
+    }
+    return from;
+}
+
+/** True if `fd` is still the file at `path`, rather than one a compaction replaced */
+bool current(int fd, const char *path) {
+    struct stat a, b;
+    return fstat(fd, &a) == 0 && stat(path, &b) == 0 && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+}
+
+} // anonymous namespace
+
+Cache::~Cache() {
+    close();
+}
+
+bool Cache::open(const char *path) {
+    close();
+    this->path = path;
+    return load(true);
+}
+
+void Cache::close() {
+    if (this->fd < 0) return;
+    flush();
+    unmap();
+    this->index.clear();
+    ::close(this->fd);
+    this->fd = -1;
+}
+
+void Cache::unmap() {
+    if (this->map) munmap((void *)this->map, this->mapLen);
+    this->map = 0;
+    this->mapLen = 0;
+}
+
+/**
+ * Opens the log, locks it, drops a torn tail, and indexes its records;
+ * compacting it first (once) if allowed and worthwhile.
+ */
+bool Cache::load(bool mayCompact) {
+    for(;;) {
+        this->fd = ::open(this->path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (this->fd < 0) return false;
+        if (flock(this->fd, LOCK_EX) < 0) { ::close(this->fd); this->fd = -1; return false; }
+        if (current(this->fd, this->path.c_str())) break;
+        // compacted while we waited for the lock
+        ::close(this->fd);
+    }
+
+    struct stat st;
+    fstat(this->fd, &st);
+    size_t size = st.st_size;
+    if (size == 0) {
+        if (!writeAll(this->fd, magic, sizeof(magic))) goto fail;
+        size = sizeof(magic);
+    }
+    if (size < sizeof(magic)) { errno = EINVAL; goto fail; }
+    this->map = (const unsigned char *)mmap(0, size, PROT_READ, MAP_SHARED, this->fd, 0);
+    if (this->map == MAP_FAILED) { this->map = 0; goto fail; }
+    this->mapLen = size;
+    if (memcmp(this->map, magic, sizeof(magic)) != 0) { errno = EINVAL; goto fail; } // not a cache; leave it be
+
+    {
+        size_t at = sizeof(magic), live = 0;
+        while(at + sizeof(RecordHead) <= size) {
+            RecordHead head;
+            memcpy(&head, this->map + at, sizeof(head));
+            if (head.length < sizeof(head) || head.length > size - at
+            || head.check != checksum(this->map + at, head.length)) break;
+            Key k{head.dev, head.ino, head.opts, head.languages};
+            auto it = this->index.find(k);
+            if (it != this->index.end()) {
+                RecordHead old;
+                memcpy(&old, this->map + it->second, sizeof(old));
+                live -= old.length;
+                it->second = at;
+            } else this->index.emplace(k, at);
+            live += head.length;
+            at += head.length;
+        }
+        // whatever follows the last good record was torn by a crash mid-append
+        if (at < size && ftruncate(this->fd, at) < 0) goto fail;
+        this->end = at;
+
+        if (mayCompact && at >= compactFrom && live < (at - sizeof(magic)) / 2) {
+            if (compact()) {
+                close();
+                return load(false);
+            }
+        }
+    }
+    flock(this->fd, LOCK_UN);
+    return true;
+
+fail:
+    int e = errno;
+    unmap();
+    this->index.clear();
+    ::close(this->fd);
+    this->fd = -1;
+    errno = e;
+    return false;
+}
+
+/** Replaces the log with one holding only its live records. Called with the lock held. */
+bool Cache::compact() {
+    std::string tmp = this->path + ".tmp" + std::to_string(getpid());
+    int out = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0) return false;
+    std::string buf(magic, sizeof(magic));
+    bool ok = true;
+    for(const auto& entry : this->index) {
+        RecordHead head;
+        memcpy(&head, this->map + entry.second, sizeof(head));
+        buf.append((const char *)this->map + entry.second, head.length);
+        if (buf.size() >= flushAt) {
+            ok = ok && writeAll(out, buf.data(), buf.size());
+            buf.clear();
+        }
+    }
+    ok = ok && writeAll(out, buf.data(), buf.size()) && fsync(out) == 0;
+    ::close(out);
+    // other processes notice the new inode when they next take the lock
+    if (!ok || rename(tmp.c_str(), this->path.c_str()) < 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool Cache::lookup(const char *fileName, const ParseOptions& opts, FileIdentity& id, ImageMetadata& md) {
+    id = FileIdentity();
+    struct stat st;
+    if (stat(fileName, &st) < 0) {
+        this->missCount += 1;
+        return false;
+    }
+    id.dev = st.st_dev;
+    id.ino = st.st_ino;
+    id.size = st.st_size;
+    id.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    if (this->hashContents) {
+        MappedFile file;
+        if (!file.open(fileName)) {
+            this->missCount += 1;
+            return false;
+        }
+        id.hash = hash64(file.data, file.size);
+    }
+    id.valid = true;
+
+    auto it = !this->map ? this->index.end() : this->index.find(Key{id.dev, id.ino, optionBits(opts), languageBits(opts)});
+    if (it != this->index.end()) {
+        RecordHead head;
+        memcpy(&head, this->map + it->second, sizeof(head));
+        if (head.size == id.size && head.mtime == id.mtime && (!this->hashContents || head.hash == id.hash)) {
+            std::string_view payload((const char *)this->map + it->second + sizeof(head), head.length - sizeof(head));
+            if (md.deserialize(payload)) {
+                this->hitCount += 1;
+                return true;
+            }
+        }
+    }
+    this->missCount += 1;
+    return false;
+}
+
+void Cache::store(const FileIdentity& id, const ParseOptions& opts, const ImageMetadata& md) {
+    if (!id.valid || this->fd < 0) return;
+    std::lock_guard<std::mutex> hold(this->pendingLock);
+    size_t at = this->pending.size();
+    this->pending.resize(at + sizeof(RecordHead));
+    md.serialize(this->pending);
+    RecordHead head = {};
+    head.length = this->pending.size() - at;
+    head.dev = id.dev;
+    head.ino = id.ino;
+    head.size = id.size;
+    head.mtime = id.mtime;
+    head.hash = id.hash;
+    head.opts = optionBits(opts);
+    head.languages = languageBits(opts);
+    memcpy(&this->pending[at], &head, sizeof(head));
+    head.check = checksum((const unsigned char *)&this->pending[at], head.length);
+    memcpy(&this->pending[at], &head, sizeof(head));
+    this->storeCount += 1;
+    if (this->pending.size() >= flushAt) flush();
+}
+
+/** Appends the buffered stores in one write. Called with pendingLock held, or from close(). */
+bool Cache::flush() {
+    if (this->pending.size() == 0) return true;
+    bool ok = false;
+    if (flock(this->fd, LOCK_EX) == 0) {
+        if (!current(this->fd, this->path.c_str())) {
+            // another process compacted the log: append to the new one
+            int fresh = ::open(this->path.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+            if (fresh >= 0) {
+                ::close(this->fd); // also drops the lock on the old log
+                this->fd = fresh;
+                if (flock(this->fd, LOCK_EX) < 0) { this->pending.clear(); return false; }
+                this->end = sizeof(magic);
+            }
+        }
+        // a process that died mid-append leaves a torn record, which must not end up
+        // in front of ours: the next load() would drop everything from it on
+        struct stat st;
+        if (fstat(this->fd, &st) == 0) {
+            size_t size = st.st_size;
+            bool intact = true;
+            if (size != this->end) {
+                size_t from = size > this->end ? this->end : sizeof(magic);
+                this->end = intactEnd(this->fd, from, size);
+                intact = this->end == size || ftruncate(this->fd, this->end) == 0;
+            }
+            ok = intact && writeAll(this->fd, this->pending.data(), this->pending.size());
+            if (ok) this->end += this->pending.size();
+        }
+        flock(this->fd, LOCK_UN);
+    }
+    this->pending.clear();
+    return ok;
+}
+
+} // namespace fhmwg
@@ -0,0 +1,94 @@
+#pragma once
+#include "fhmwg1ds.hpp"
+#include <string>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+
+namespace fhmwg {
+
+/** What identifies one version of a file: where it is, its size and modification time */
+struct FileIdentity {
+    uint64_t dev = 0, ino = 0, size = 0;
+    int64_t mtime = 0; // nanoseconds
+    /** Hash of the contents, or 0 if not hashed */
+    uint64_t hash = 0;
+    /** False if the file could not be examined, in which case nothing is cached for it */
+    bool valid = false;
+};
+
+/**
+ * A persistent cache of parse results, keyed on file identity (device,
+ * inode, size and modification time, plus the parse options and, if
+ * `hashContents` is set, a hash of the file's contents).
+ *
+ * The cache is a single append-only log of records, each holding a key
+ * and ImageMetadata::serialize's form of the result, with a checksum so
+ * that a record torn by a crash is detected and dropped. Any number of
+ * processes can share one log: appends take an exclusive flock and are
+ * single writes. When more than half of a large log is superseded
+ * records, open() rewrites it with only the live ones.
+ *
+ * lookup() and store() may be called from several threads at once. A
+ * process sees the log as it was when opened; its own stores are
+ * buffered and appended in blocks, and at the latest when it is closed.
+ */
+class Cache {
+public:
+    /** Also hash each file's contents, to catch changes that keep its size and mtime */
+    bool hashContents = false;
+
+    ~Cache();
+    /** Opens the log at `path`, creating it if need be. False, with errno set, on failure. */
+    bool open(const char *path);
+    /** Appends any buffered stores and closes the log */
+    void close();
+
+    /**
+     * Identifies `fileName` in `id` and, if the log has a result for that
+     * exact version parsed with `opts`, replaces `md` with it and returns true.
+     */
+    bool lookup(const char *fileName, const ParseOptions& opts, FileIdentity& id, ImageMetadata& md);
+    /** Records `md` as the result of parsing the file version `id` with `opts` */
+    void store(const FileIdentity& id, const ParseOptions& opts, const ImageMetadata& md);
+
+    size_t hits() const { return this->hitCount; }
+    size_t misses() const { return this->missCount; }
+    size_t stores() const { return this->storeCount; }
+
+private:
+    struct Key {
+        uint64_t dev, ino;
+        uint32_t opts, languages;
+        bool operator==(const Key& o) const {
+            return dev == o.dev && ino == o.ino && opts == o.opts && languages == o.languages;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& k) const {
+            return (k.ino * 0x9E3779B97F4A7C15ull) ^ k.dev ^ ((uint64_t)k.opts << 56) ^ ((uint64_t)k.languages << 24);
+        }
+    };
+
+    std::string path;
+    int fd = -1;
+    const unsigned char *map = 0;
+    size_t mapLen = 0;
+    /** The end of the last record known to be intact, and of our last append */
+    size_t end = 0;
+    /** offset in `map` of the newest record for each key */
+    std::unordered_map<Key, size_t, KeyHash> index;
+
+    std::mutex pendingLock;
+    std::string pending;
+
+    std::atomic<size_t> hitCount{0}, missCount{0}, storeCount{0};
+
+    bool load(bool mayCompact);
+    bool compact();
+    void unmap();
+    bool flush();
+};
+
+} // namespace fhmwg
@@ -0,0 +1,53 @@
+#include "fhmwg1checkpoint.hpp"
+#include <cstdio>
+#include <cerrno>
+#include <cinttypes>
+#include <unistd.h>
+
+namespace fhmwg {
+
+static const char magic[] = "FHMWG checkpoint 1\n";
+
+bool Checkpoint::load(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return false;
+    std::string text;
+    char buf[4096];
+    size_t got;
+    while((got = fread(buf, 1, sizeof(buf), f)) > 0) text.append(buf, got);
+    fclose(f);
+
+    // the path is last, and taken to the end of the file, so it may hold any byte but NUL
+    int used = 0;
+    if (text.compare(0, sizeof(magic) - 1, magic) != 0
+    || sscanf(text.c_str() + sizeof(magic) - 1, "done %" SCNu64 "\noutput %" SCNd64 "\nlast%n",
+        &this->done, &this->outputBytes, &used) != 2 || used == 0
+    || text.size() < sizeof(magic) + used || text[sizeof(magic) - 1 + used] != ' ' || text.back() != '\n') {
+        errno = EINVAL;
+        return false;
+    }
+    size_t at = sizeof(magic) + used;
+    this->last.assign(text, at, text.size() - at - 1);
+    return true;
+}
+
+bool Checkpoint::save(const char *path) const {
+    std::string tmp = std::string(path) + ".tmp" + std::to_string(getpid());
+    FILE *f = fopen(tmp.c_str(), "w");
+    if (!f) return false;
+    fprintf(f, "%sdone %" PRIu64 "\noutput %" PRId64 "\nlast ", magic, this->done, this->outputBytes);
+    fwrite(this->last.data(), 1, this->last.size(), f);
+    fputc('\n', f);
+    bool ok = fflush(f) == 0 && fsync(fileno(f)) == 0;
+    int e = errno;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path) < 0) {
+        if (ok) e = errno;
+        unlink(tmp.c_str());
+        errno = e;
+        return false;
+    }
+    return true;
+}
+
+} // namespace fhmwg
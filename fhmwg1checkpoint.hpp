@@ -0,0 +1,37 @@
+#pragma once
+#include <string>
+#include <cstdint>
+
+namespace fhmwg {
+
+/**
+ * How far a long batch had got, so that a restarted run can skip the
+ * inputs it already finished instead of parsing them again.
+ *
+ * A batch emits its results in input order, and PathSource produces the
+ * same inputs in the same order each time it is given the same paths, so
+ * the number of inputs completed is enough to resume from; the last of
+ * them is kept too, to check that the inputs really are the same. The
+ * size of the output at that point lets a resumed run cut off results
+ * written after the checkpoint, which it is about to write again.
+ *
+ * The file is a few lines of text, replaced atomically by save().
+ */
+struct Checkpoint {
+    /** Inputs completed */
+    uint64_t done = 0;
+    /** Bytes of output written for them, or -1 if the output was not a regular file */
+    int64_t outputBytes = -1;
+    /** The last input completed */
+    std::string last;
+
+    /**
+     * Reads the checkpoint at `path`. False, with errno set, if there is
+     * none (ENOENT) or it is not a checkpoint (EINVAL).
+     */
+    bool load(const char *path);
+    /** Replaces the checkpoint at `path` with this one. False, with errno set, on failure. */
+    bool save(const char *path) const;
+};
+
+} // namespace fhmwg
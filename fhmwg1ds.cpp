@@ -2,351 +2,581 @@
 #include <cstring>
 #include <cstdlib>
 #include <cmath>
+#include <cctype>
+#include <algorithm>
 
 namespace fhmwg {
 
-static void jsonString(FILE *f, std::string payload) {
-    putc('"', f);
-    for(int c : payload) {
-        if (c < 0x20) {
-            if (c == '\n') fputs("\\n", f);
-            else if (c == '\r') fputs("\\r", f);
-            else if (c == '\t') fputs("\\t", f);
-            else if (c == '\f') fputs("\\f", f);
-            else if (c == '\b') fputs("\\b", f);
-            else fprintf(f, "\\u%04x", c);
-        } else if (c == '"') fputs("\\\"", f);
-        else if (c == '\\') fputs("\\\\", f);
-        else putc(c, f);
-    }
-    putc('"', f);
+static const char *const fieldKeys[FIELD_COUNT] = {"title", "caption", "event", "date", "albums", "locations", "people", "objects"};
+
+const char *fieldKey(int i) {
+    return fieldKeys[i];
 }
 
+unsigned parseFields(std::string_view list) {
+    unsigned ans = 0;
+    while(list.size() > 0) {
+        size_t comma = list.find(',');
+        std::string_view key = list.substr(0, comma);
+        list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+        if (key.size() == 0) continue;
+        int i = 0;
+        while(i < FIELD_COUNT && key != fieldKeys[i]) i += 1;
+        if (i == FIELD_COUNT) return 0;
+        ans |= 1 << i;
+    }
+    return ans;
+}
 
-static void gedcomBlockText(FILE *f, std::string payload, int level) {
-    char *tmp = strdup(payload.c_str());
-    bool init = 1;
-    for(;;) {
-        char *delim = strpbrk(tmp, "\n\r");
-        if (!delim) {
-            fprintf(f, "%s\n", tmp);
-            break;
-        } else {
-            if (delim[0] == '\r' && delim[1] == '\n') {
-                delim[0] = delim[1] = 0;
-                delim += 2;
-            } else {
-                delim[0] = 0;
-                delim += 2;
-            }
-            fprintf(f, "%s\n", tmp);
-            tmp = delim;
-            if (!init) fprintf(f, "%d CONT ", level+1);
+/** Whether `lang` is `want` or one of its subtags, ignoring case */
+static bool languageMatches(std::string_view lang, std::string_view want) {
+    if (lang.size() < want.size() || (lang.size() > want.size() && lang[want.size()] != '-')) return false;
+    for(size_t i = 0; i < want.size(); i += 1) {
+        if (std::tolower((unsigned char)lang[i]) != std::tolower((unsigned char)want[i])) return false;
+    }
+    return true;
+}
+
+/** Drops the entries of `alt` in languages not in the comma-separated `list` */
+static void keepLanguages(AltLang& alt, std::string_view list) {
+    auto unwanted = [&](const LangStr& e) {
+        for(std::string_view rest = list; rest.size() > 0; ) {
+            size_t comma = rest.find(',');
+            std::string_view want = rest.substr(0, comma);
+            if (want.size() > 0 && languageMatches(e.lang, want)) return false;
+            rest = comma == std::string_view::npos ? std::string_view() : rest.substr(comma + 1);
         }
-        tmp = delim;
+        return true;
+    };
+    alt.entries.erase(std::remove_if(alt.entries.begin(), alt.entries.end(), unwanted), alt.entries.end());
+}
+
+void ImageMetadata::keepLanguages(std::string_view list) {
+    if (list.size() == 0) return;
+    fhmwg::keepLanguages(this->title, list);
+    fhmwg::keepLanguages(this->caption, list);
+    fhmwg::keepLanguages(this->event, list);
+    for(Location& x : this->locations) fhmwg::keepLanguages(x.name, list);
+    for(Person& x : this->people) {
+        fhmwg::keepLanguages(x.name, list);
+        fhmwg::keepLanguages(x.description, list);
+    }
+    for(Object& x : this->objects) fhmwg::keepLanguages(x.title, list);
+}
+
+/** Starts a GEDCOM line: its level, a space, and the tag */
+static OutBuf& gedcomTag(OutBuf& o, int level, std::string_view tag) {
+    return o.integer(level).put(' ').put(tag);
+}
+
+/**
+ * Writes the rest of a GEDCOM line, continuing each further line of
+ * `payload` (ended by LF, CR LF, or CR) on its own CONT line.
+ */
+static void gedcomBlockText(OutBuf& o, std::string_view payload, int level) {
+    size_t at = 0;
+    for(;;) {
+        size_t end = payload.find_first_of("\n\r", at);
+        o.put(payload.substr(at, end == std::string_view::npos ? end : end - at)).put('\n');
+        if (end == std::string_view::npos) break;
+        at = end + 1;
+        if (payload[end] == '\r' && at < payload.size() && payload[at] == '\n') at += 1;
+        gedcomTag(o, level+1, "CONT ");
     }
-    free(tmp);
 }
 
-void AltLang::dumpGEDCOM(FILE *f, int level) {
-    gedcomBlockText(f, this->entries[0].text, level);
+void AltLang::dumpGEDCOM(OutBuf& o, int level) const {
+    gedcomBlockText(o, this->entries[0].text, level);
     if (this->entries[0].lang != "x-default")
-        fprintf(f, "%d LANG %s\n", level+1, this->entries[0].lang.c_str());
+        gedcomTag(o, level+1, "LANG ").put(this->entries[0].lang).put('\n');
     for(size_t i=1; i<this->entries.size(); i+=1) {
-        fprintf(f, "%d TRAN ", level+1);
-        gedcomBlockText(f, this->entries[i].text, level+1);
-        fprintf(f, "%d LANG %s\n", level+2, this->entries[i].lang.c_str());
+        gedcomTag(o, level+1, "TRAN ");
+        gedcomBlockText(o, this->entries[i].text, level+1);
+        gedcomTag(o, level+2, "LANG ").put(this->entries[i].lang).put('\n');
     }
 }
-void AltLang::dumpJSON(FILE *f) {
+void AltLang::dumpJSON(OutBuf& o) const {
     char pfx = '{';
-    for(LangStr x : this->entries) {
-        fputc(pfx, f);
+    for(const LangStr& x : this->entries) {
+        o.put(pfx);
         pfx = ',';
-        jsonString(f, x.lang);
-        fputc(':', f);
-        jsonString(f, x.text);
+        o.json(x.lang);
+        o.put(':');
+        o.json(x.text);
     }
-    if (pfx == '{') fputc('{', f);
-    fputc('}', f);
+    if (pfx == '{') o.put('{');
+    o.put('}');
 }
 
 
 
-void Album::dumpGEDCOM(FILE *f) {
-    fprintf(f, "0 _ALBUM\n");
+void Album::dumpGEDCOM(OutBuf& o) const {
+    o.put("0 _ALBUM\n");
     if (this->name.size() > 0) {
-        fprintf(f, "1 _NAME ");
-        gedcomBlockText(f, this->name, 1);
+        o.put("1 _NAME ");
+        gedcomBlockText(o, this->name, 1);
     }
     if (this->id.size() > 0) {
-        fprintf(f, "1 _ID %s\n", this->id.c_str());
+        o.put("1 _ID ").put(this->id).put('\n');
     }
 }
-void Album::dumpJSON(FILE *f) {
+void Album::dumpJSON(OutBuf& o) const {
     char pfx = '{';
     if (this->name.size() > 0) {
-        putc(pfx, f);
-        fputs("\"name\":", f);
-        jsonString(f, this->name);
+        o.put(pfx);
+        o.put("\"name\":");
+        o.json(this->name);
         pfx = ',';
     }
     if (this->id.size() > 0) {
-        putc(pfx, f);
-        fputs("\"id\":", f);
-        jsonString(f, this->id);
+        o.put(pfx);
+        o.put("\"id\":");
+        o.json(this->id);
+        pfx = ',';
     }
-    if (pfx != '{') putc('}', f);
+    if (pfx != '{') o.put('}');
 }
 
-void Location::dumpGEDCOM(FILE *f) {
-    fprintf(f, "0 _LOCATION\n");
+void Location::dumpGEDCOM(OutBuf& o) const {
+    o.put("0 _LOCATION\n");
     if (!std::isnan(this->lat) && !std::isnan(this->lon)) {
-        fprintf(f, "1 _LATITUDE %.15f\n1 _LONGITUDE %.15f\n", this->lat, this->lon);
+        o.put("1 _LATITUDE ").fixed(this->lat).put("\n1 _LONGITUDE ").fixed(this->lon).put('\n');
     }
     if (this->name.entries.size() > 0) {
-        fprintf(f, "1 _NAME ");
-        this->name.dumpGEDCOM(f, 1);
+        o.put("1 _NAME ");
+        this->name.dumpGEDCOM(o, 1);
     }
-    for(IRI id : this->ids) {
-        fprintf(f, "1 _ID %s\n", id.c_str());
+    for(const IRI& id : this->ids) {
+        o.put("1 _ID ").put(id).put('\n');
     }
 }
-void Location::dumpJSON(FILE *f) {
+void Location::dumpJSON(OutBuf& o) const {
     char pfx = '{';
     if (this->name.entries.size() > 0) {
-        putc(pfx, f); pfx=',';
-        fputs("\"name\":", f);
-        this->name.dumpJSON(f);
+        o.put(pfx); pfx=',';
+        o.put("\"name\":");
+        this->name.dumpJSON(o);
     }
     if (!std::isnan(this->lat) && !std::isnan(this->lon)) {
-        putc(pfx, f); pfx=',';
-        fprintf(f, "\"latitude\":%.15g,\"longitude\":%15g", this->lat, this->lon);
+        o.put(pfx); pfx=',';
+        o.put("\"latitude\":").number(this->lat).put(",\"longitude\":").number(this->lon);
     }
     if (this->ids.size() > 0) {
-        putc(pfx, f); pfx='[';
-        fputs("\"ids\":", f);
-        for(IRI id : this->ids) {
-            putc(pfx, f); pfx=',';
-            jsonString(f, id);
+        o.put(pfx); pfx='[';
+        o.put("\"ids\":");
+        for(const IRI& id : this->ids) {
+            o.put(pfx); pfx=',';
+            o.json(id);
         }
-        putc(']', f);
+        o.put(']');
     }
-    if (pfx != '{') putc('}', f);
+    if (pfx != '{') o.put('}');
 }
 
 
-void Region::dumpGEDCOM(FILE *f, int level) {
+void Region::dumpGEDCOM(OutBuf& o, int level) const {
     switch(this->type) {
         case Region::Types::NONE: break;
         case Region::Types::CIRCLE:
-            fprintf(f, "%d _CIRCLE\n", level);
-            fprintf(f, "%d _X %.15f\n", level+1, this->circ.x);
-            fprintf(f, "%d _Y %.15f\n", level+1, this->circ.y);
-            fprintf(f, "%d _RX %.15f\n", level+1, this->circ.rx);
+            gedcomTag(o, level, "_CIRCLE\n");
+            gedcomTag(o, level+1, "_X ").fixed(this->circ.x).put('\n');
+            gedcomTag(o, level+1, "_Y ").fixed(this->circ.y).put('\n');
+            gedcomTag(o, level+1, "_RX ").fixed(this->circ.rx).put('\n');
         break;
         case Region::Types::POLYGON:
-            fprintf(f, "%d _POLYGON\n", level);
-            for(std::pair<double,double> pt : this->pts) {
-                fprintf(f, "%d _VERTEX\n", level+1);
-                fprintf(f, "%d _X %.15f\n", level+2, std::get<0>(pt));
-                fprintf(f, "%d _Y %.15f\n", level+2, std::get<1>(pt));
+            gedcomTag(o, level, "_POLYGON\n");
+            for(const std::pair<double,double>& pt : this->pts) {
+                gedcomTag(o, level+1, "_VERTEX\n");
+                gedcomTag(o, level+2, "_X ").fixed(std::get<0>(pt)).put('\n');
+                gedcomTag(o, level+2, "_Y ").fixed(std::get<1>(pt)).put('\n');
             }
         break;
         case Region::Types::RECTANGLE:
-            fprintf(f, "%d _RECTANGLE\n", level);
-            fprintf(f, "%d _X %.15f\n", level+1, this->rect.x);
-            fprintf(f, "%d _Y %.15f\n", level+1, this->rect.y);
-            fprintf(f, "%d _W %.15f\n", level+1, this->rect.w);
-            fprintf(f, "%d _H %.15f\n", level+1, this->rect.h);
+            gedcomTag(o, level, "_RECTANGLE\n");
+            gedcomTag(o, level+1, "_X ").fixed(this->rect.x).put('\n');
+            gedcomTag(o, level+1, "_Y ").fixed(this->rect.y).put('\n');
+            gedcomTag(o, level+1, "_W ").fixed(this->rect.w).put('\n');
+            gedcomTag(o, level+1, "_H ").fixed(this->rect.h).put('\n');
         break;
     }
 }
-bool Region::dumpJSON(FILE *f, char pfx) {
+bool Region::dumpJSON(OutBuf& o, char pfx) const {
     switch(this->type) {
         case Region::Types::NONE: return false;
         case Region::Types::CIRCLE:
-            fprintf(f, "%c\"circle\":{\"x\":%.15g,\"y\":%.15g,\"rx\":%.15g}", 
-            pfx, this->circ.x, this->circ.y, this->circ.rx);
+            o.put(pfx).put("\"circle\":{\"x\":").number(this->circ.x)
+             .put(",\"y\":").number(this->circ.y)
+             .put(",\"rx\":").number(this->circ.rx).put('}');
             return true;
         case Region::Types::POLYGON:
-            fprintf(f, "%c\"polygon\":", pfx);
+            o.put(pfx).put("\"polygon\":");
             pfx = '[';
-            for(std::pair<double,double> pt : this->pts) {
-                fprintf(f, "%c{\"x\":%.15g,\"y\":%.15g}", pfx, std::get<0>(pt), std::get<1>(pt));
+            for(const std::pair<double,double>& pt : this->pts) {
+                o.put(pfx).put("{\"x\":").number(std::get<0>(pt))
+                 .put(",\"y\":").number(std::get<1>(pt)).put('}');
                 pfx = ',';
             }
-            if (pfx == '[') fputs("[]", f);
-            else putc(']',f);
+            if (pfx == '[') o.put("[]");
+            else o.put(']');
             return true;
         case Region::Types::RECTANGLE:
-            fprintf(f, "%c\"rectangle\":{\"x\":%.15g,\"y\":%.15g,\"w\":%.15g,\"h\":%.15g}", 
-            pfx, this->rect.x, this->rect.y, this->rect.w, this->rect.h);
+            o.put(pfx).put("\"rectangle\":{\"x\":").number(this->rect.x)
+             .put(",\"y\":").number(this->rect.y)
+             .put(",\"w\":").number(this->rect.w)
+             .put(",\"h\":").number(this->rect.h).put('}');
             return true;
     }
     return false;
 }
 
-void Person::dumpGEDCOM(FILE *f) {
-    fprintf(f, "0 _PERSON\n");
-    if (this->region.type) this->region.dumpGEDCOM(f, 1);
+void Person::dumpGEDCOM(OutBuf& o) const {
+    o.put("0 _PERSON\n");
+    if (this->region.type) this->region.dumpGEDCOM(o, 1);
     if (this->name.entries.size() > 0) {
-        fprintf(f, "1 _NAME ");
-        this->name.dumpGEDCOM(f, 1);
+        o.put("1 _NAME ");
+        this->name.dumpGEDCOM(o, 1);
     }
     if (this->description.entries.size() > 0) {
-        fprintf(f, "1 _DESCRIPTION ");
-        this->description.dumpGEDCOM(f, 1);
+        o.put("1 _DESCRIPTION ");
+        this->description.dumpGEDCOM(o, 1);
     }
-    for(IRI id : this->ids) {
-        fprintf(f, "1 _ID %s\n", id.c_str());
+    for(const IRI& id : this->ids) {
+        o.put("1 _ID ").put(id).put('\n');
     }
 }
-void Person::dumpJSON(FILE *f) {
+void Person::dumpJSON(OutBuf& o) const {
     char pfx = '{';
     if (this->name.entries.size() > 0) {
-        putc(pfx, f); pfx=',';
-        fputs("\"name\":", f);
-        this->name.dumpJSON(f);
+        o.put(pfx); pfx=',';
+        o.put("\"name\":");
+        this->name.dumpJSON(o);
     }
     if (this->description.entries.size() > 0) {
-        putc(pfx, f); pfx=',';
-        fputs("\"description\":", f);
-        this->description.dumpJSON(f);
+        o.put(pfx); pfx=',';
+        o.put("\"description\":");
+        this->description.dumpJSON(o);
     }
     if (this->ids.size() > 0) {
-        putc(pfx, f); pfx='[';
-        fputs("\"ids\":", f);
-        for(IRI id : this->ids) {
-            putc(pfx, f); pfx=',';
-            jsonString(f, id);
+        o.put(pfx); pfx='[';
+        o.put("\"ids\":");
+        for(const IRI& id : this->ids) {
+            o.put(pfx); pfx=',';
+            o.json(id);
         }
-        putc(']', f);
+        o.put(']');
     }
-    if (this->region.dumpJSON(f, pfx)) pfx = ',';
-    if (pfx != '{') putc('}', f);
+    if (this->region.dumpJSON(o, pfx)) pfx = ',';
+    if (pfx != '{') o.put('}');
 }
 
 
-void Object::dumpGEDCOM(FILE *f) {
-    fprintf(f, "0 _OBJECT\n");
-    if (this->region.type) this->region.dumpGEDCOM(f, 1);
+void Object::dumpGEDCOM(OutBuf& o) const {
+    o.put("0 _OBJECT\n");
+    if (this->region.type) this->region.dumpGEDCOM(o, 1);
     if (this->title.entries.size() > 0) {
-        fprintf(f, "1 _TITLE ");
-        this->title.dumpGEDCOM(f, 1);
+        o.put("1 _TITLE ");
+        this->title.dumpGEDCOM(o, 1);
     }
 }
-void Object::dumpJSON(FILE *f) {
+void Object::dumpJSON(OutBuf& o) const {
     char pfx = '{';
     if (this->title.entries.size() > 0) {
-        putc(pfx, f); pfx=',';
-        fputs("\"title\":", f);
-        this->title.dumpJSON(f);
+        o.put(pfx); pfx=',';
+        o.put("\"title\":");
+        this->title.dumpJSON(o);
     }
-    if (this->region.dumpJSON(f, pfx)) pfx = ',';
-    if (pfx != '{') putc('}', f);
+    if (this->region.dumpJSON(o, pfx)) pfx = ',';
+    if (pfx != '{') o.put('}');
 }
 
-void ImageMetadata::dumpGEDCOM(FILE *f) {
+void ImageMetadata::dumpGEDCOM(OutBuf& o) const {
     if (title.entries.size() > 0) {
-        fprintf(f, "0 _TITLE ");
-        title.dumpGEDCOM(f, 1);
+        o.put("0 _TITLE ");
+        title.dumpGEDCOM(o, 1);
     }
     if (caption.entries.size() > 0) {
-        fprintf(f, "0 _CAPTION ");
-        caption.dumpGEDCOM(f, 1);
+        o.put("0 _CAPTION ");
+        caption.dumpGEDCOM(o, 1);
     }
     if (event.entries.size() > 0) {
-        fprintf(f, "0 _EVENT ");
-        title.dumpGEDCOM(f, 1);
+        o.put("0 _EVENT ");
+        event.dumpGEDCOM(o, 1);
     }
     if (date.size() > 0)
-        fprintf(f, "0 _DATE %s\n", date.c_str());
+        o.put("0 _DATE ").put(date).put('\n');
     
-    for(Album x : albums) x.dumpGEDCOM(f);
-    for(Location x : locations) x.dumpGEDCOM(f);
-    for(Person x : people) x.dumpGEDCOM(f);
-    for(Object x : objects) x.dumpGEDCOM(f);
+    for(const Album& x : albums) x.dumpGEDCOM(o);
+    for(const Location& x : locations) x.dumpGEDCOM(o);
+    for(const Person& x : people) x.dumpGEDCOM(o);
+    for(const Object& x : objects) x.dumpGEDCOM(o);
 }
 
-void ImageMetadata::dumpJSON(FILE *f, bool newlines) {
+void ImageMetadata::dumpJSON(OutBuf& o, bool newlines) const {
     char pfx = '{';
     if (title.entries.size() > 0) {
-        putc(pfx, f); pfx = ',';
-        fputs("\"title\":", f);
-        title.dumpJSON(f);
-        if(newlines) putc('\n', f);
+        o.put(pfx); pfx = ',';
+        o.put("\"title\":");
+        title.dumpJSON(o);
+        if(newlines) o.put('\n');
     }
     if (caption.entries.size() > 0) {
-        putc(pfx, f); pfx = ',';
-        fputs("\"caption\":", f);
-        caption.dumpJSON(f);
-        if(newlines) putc('\n', f);
+        o.put(pfx); pfx = ',';
+        o.put("\"caption\":");
+        caption.dumpJSON(o);
+        if(newlines) o.put('\n');
     }
     if (event.entries.size() > 0) {
-        putc(pfx, f); pfx = ',';
-        fputs("\"event\":", f);
-        event.dumpJSON(f);
-        if(newlines) putc('\n', f);
+        o.put(pfx); pfx = ',';
+        o.put("\"event\":");
+        event.dumpJSON(o);
+        if(newlines) o.put('\n');
     }
     if (date.size() > 0) {
-        putc(pfx, f); pfx = ',';
-        fputs("\"date\":", f);
-        jsonString(f, date);
-        if(newlines) putc('\n', f);
+        o.put(pfx); pfx = ',';
+        o.put("\"date\":");
+        o.json(date);
+        if(newlines) o.put('\n');
     }
     
     if (albums.size() > 0) {
-        putc(pfx, f); pfx = '[';
-        fputs("\"albums\":", f);
-        for(Album x : albums) {
-            putc(pfx, f); pfx=',';
-            x.dumpJSON(f);
-            if(newlines) fputs("\n  ", f);
+        o.put(pfx); pfx = '[';
+        o.put("\"albums\":");
+        for(const Album& x : albums) {
+            o.put(pfx); pfx=',';
+            x.dumpJSON(o);
+            if(newlines) o.put("\n  ");
         }
-        putc(']',f);
-        if(newlines) putc('\n', f);
+        o.put(']');
+        if(newlines) o.put('\n');
     }
 
     if (locations.size() > 0) {
-        putc(pfx, f); pfx = '[';
-        fputs("\"locations\":", f);
-        for(Location x : locations) {
-            putc(pfx, f); pfx=',';
-            x.dumpJSON(f);
-            if(newlines) fputs("\n  ", f);
+        o.put(pfx); pfx = '[';
+        o.put("\"locations\":");
+        for(const Location& x : locations) {
+            o.put(pfx); pfx=',';
+            x.dumpJSON(o);
+            if(newlines) o.put("\n  ");
         }
-        putc(']',f);
-        if(newlines) putc('\n', f);
+        o.put(']');
+        if(newlines) o.put('\n');
     }
 
     if (people.size() > 0) {
-        putc(pfx, f); pfx = '[';
-        fputs("\"people\":", f);
-        for(Person x : people) {
-            putc(pfx, f); pfx=',';
-            x.dumpJSON(f);
-            if(newlines) fputs("\n  ", f);
+        o.put(pfx); pfx = '[';
+        o.put("\"people\":");
+        for(const Person& x : people) {
+            o.put(pfx); pfx=',';
+            x.dumpJSON(o);
+            if(newlines) o.put("\n  ");
         }
-        putc(']',f);
-        if(newlines) putc('\n', f);
+        o.put(']');
+        if(newlines) o.put('\n');
     }
  
     if (objects.size() > 0) {
-        putc(pfx, f); pfx = '[';
-        fputs("\"objects\":", f);
-        for(Object x : objects) {
-            putc(pfx, f); pfx=',';
-            x.dumpJSON(f);
-            if(newlines) fputs("\n  ", f);
+        o.put(pfx); pfx = '[';
+        o.put("\"objects\":");
+        for(const Object& x : objects) {
+            o.put(pfx); pfx=',';
+            x.dumpJSON(o);
+            if(newlines) o.put("\n  ");
         }
-        putc(']',f);
-        if(newlines) putc('\n', f);
+        o.put(']');
+        if(newlines) o.put('\n');
     }
     
-    if (pfx != '{') putc('}', f);
+    if (pfx != '{') o.put('}');
 }
 
+namespace {
+
+/** Bumped whenever the serialized form changes */
+const unsigned char serialVersion = 1;
+
+/** Writes the pieces of serialize's output: LEB128 counts, length-prefixed strings and raw doubles */
+struct Encoder {
+    std::string& out;
+
+    void count(size_t n) {
+        while(n >= 0x80) { out.push_back((char)(n | 0x80)); n >>= 7; }
+        out.push_back((char)n);
+    }
+    void text(std::string_view s) { count(s.size()); out.append(s); }
+    void number(double v) { char b[sizeof(v)]; memcpy(b, &v, sizeof(v)); out.append(b, sizeof(v)); }
+    void alt(const AltLang& a) {
+        count(a.entries.size());
+        for(const LangStr& x : a.entries) { text(x.lang); text(x.text); }
+    }
+    void ids(const Vec<IRI>& v) {
+        count(v.size());
+        for(const IRI& id : v) text(id);
+    }
+    void region(const Region& r) {
+        out.push_back((char)r.type);
+        switch(r.type) {
+            case Region::Types::NONE: break;
+            case Region::Types::CIRCLE: number(r.circ.x); number(r.circ.y); number(r.circ.rx); break;
+            case Region::Types::RECTANGLE: number(r.rect.x); number(r.rect.y); number(r.rect.w); number(r.rect.h); break;
+            case Region::Types::POLYGON:
+                count(r.pts.size());
+                for(const std::pair<double,double>& pt : r.pts) { number(pt.first); number(pt.second); }
+            break;
+        }
+    }
+};
+
+/** Reads what Encoder wrote; `ok` turns false, and stays false, at the first malformed piece */
+struct Decoder {
+    const char *at, *end;
+    bool ok = true;
+
+    size_t count() {
+        size_t n = 0;
+        for(int shift = 0; ok && shift < 64; shift += 7) {
+            if (at == end) break;
+            unsigned char b = *at++;
+            n |= (size_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) return n;
+        }
+        ok = false;
+        return 0;
+    }
+    /** A count of items that each take at least one byte, so never more than remain */
+    size_t items() {
+        size_t n = count();
+        if (n > (size_t)(end - at)) ok = false;
+        return ok ? n : 0;
+    }
+    void text(Text& s) {
+        size_t n = items();
+        if (ok) { s.assign(at, n); at += n; }
+    }
+    double number() {
+        double v = 0;
+        if ((size_t)(end - at) < sizeof(v)) ok = false;
+        else { memcpy(&v, at, sizeof(v)); at += sizeof(v); }
+        return v;
+    }
+    void alt(AltLang& a) {
+        size_t n = items();
+        a.entries.reserve(n);
+        for(size_t i=0; i<n && ok; i+=1) {
+            LangStr& x = a.entries.emplace_back();
+            text(x.lang);
+            text(x.text);
+        }
+    }
+    void ids(Vec<IRI>& v) {
+        size_t n = items();
+        v.reserve(n);
+        for(size_t i=0; i<n && ok; i+=1) text(v.emplace_back());
+    }
+    void region(Region& r) {
+        unsigned char type = at < end ? *at++ : 0xFF;
+        switch(type) {
+            case Region::Types::NONE: r.type = Region::Types::NONE; break;
+            case Region::Types::CIRCLE:
+                r.type = Region::Types::CIRCLE;
+                r.circ.x = number(); r.circ.y = number(); r.circ.rx = number();
+            break;
+            case Region::Types::RECTANGLE:
+                r.type = Region::Types::RECTANGLE;
+                r.rect.x = number(); r.rect.y = number(); r.rect.w = number(); r.rect.h = number();
+            break;
+            case Region::Types::POLYGON: {
+                r.type = Region::Types::POLYGON;
+                size_t n = items();
+                r.pts.reserve(n);
+                for(size_t i=0; i<n && ok; i+=1) {
+                    double x = number(), y = number();
+                    r.pts.push_back(std::pair<double,double>(x,y));
+                }
+            } break;
+            default: ok = false;
+        }
+    }
+};
+
+} // anonymous namespace
+
+void ImageMetadata::serialize(std::string& out) const {
+    Encoder e{out};
+    out.push_back((char)serialVersion);
+    e.alt(title);
+    e.alt(caption);
+    e.alt(event);
+    e.text(date);
+    e.count(albums.size());
+    for(const Album& x : albums) { e.text(x.name); e.text(x.id); }
+    e.count(locations.size());
+    for(const Location& x : locations) {
+        e.alt(x.name);
+        e.number(x.lat);
+        e.number(x.lon);
+        e.ids(x.ids);
+    }
+    e.count(people.size());
+    for(const Person& x : people) {
+        e.region(x.region);
+        e.alt(x.name);
+        e.alt(x.description);
+        e.ids(x.ids);
+    }
+    e.count(objects.size());
+    for(const Object& x : objects) {
+        e.region(x.region);
+        e.alt(x.title);
+    }
+}
+
+bool ImageMetadata::deserialize(std::string_view in) {
+    reset();
+    Decoder d{in.data(), in.data() + in.size()};
+    if (in.size() == 0 || (unsigned char)in[0] != serialVersion) return false;
+    d.at += 1;
+    d.alt(title);
+    d.alt(caption);
+    d.alt(event);
+    d.text(date);
+    size_t n = d.items();
+    albums.reserve(n);
+    for(size_t i=0; i<n && d.ok; i+=1) {
+        Album& x = albums.emplace_back();
+        d.text(x.name);
+        d.text(x.id);
+    }
+    n = d.items();
+    locations.reserve(n);
+    for(size_t i=0; i<n && d.ok; i+=1) {
+        Location& x = locations.emplace_back();
+        d.alt(x.name);
+        x.lat = d.number();
+        x.lon = d.number();
+        d.ids(x.ids);
+    }
+    n = d.items();
+    people.reserve(n);
+    for(size_t i=0; i<n && d.ok; i+=1) {
+        Person& x = people.emplace_back();
+        d.region(x.region);
+        d.alt(x.name);
+        d.alt(x.description);
+        d.ids(x.ids);
+    }
+    n = d.items();
+    objects.reserve(n);
+    for(size_t i=0; i<n && d.ok; i+=1) {
+        Object& x = objects.emplace_back();
+        d.region(x.region);
+        d.alt(x.title);
+    }
+    if (!d.ok || d.at != d.end) {
+        reset();
+        return false;
+    }
+    return true;
+}
 
 } // namespace fhmwg
 
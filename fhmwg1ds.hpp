@@ -1,79 +1,258 @@
+#pragma once
 #include <string>
+#include <string_view>
 #include <vector>
+#include <memory_resource>
 #include <utility>
 #include <cstdio>
+#include <cstring>
+#include "fhmwg1out.hpp"
+#ifdef FHMWG_SERIAL_XMP
+#include <mutex>
+#endif
 
 namespace fhmwg {
 
+struct FileStats;
+
+/**
+ * The model is allocator-aware: give ImageMetadata a memory resource
+ * (such as an Arena) and every string and array inside it, however deeply
+ * nested, is allocated from that resource. Without one it uses the heap.
+ */
+typedef std::pmr::polymorphic_allocator<char> Alloc;
+typedef std::pmr::string Text;
+template<class T> using Vec = std::pmr::vector<T>;
+
 struct LangStr {
-    std::string text;
-    std::string lang;
+    Text text;
+    Text lang;
+
+    typedef Alloc allocator_type;
+    explicit LangStr(const Alloc& a = {}) : text(a), lang(a) {}
+    LangStr(const LangStr& o, const Alloc& a = {}) : text(o.text, a), lang(o.lang, a) {}
+    LangStr(LangStr&& o) = default;
+    LangStr(LangStr&& o, const Alloc& a) : text(std::move(o.text), a), lang(std::move(o.lang), a) {}
+    LangStr& operator=(const LangStr&) = default;
+    LangStr& operator=(LangStr&&) = default;
 };
 
 struct AltLang {
-    std::vector<LangStr> entries;
-    void dumpGEDCOM(FILE *, int);
-    void dumpJSON(FILE *);
+    Vec<LangStr> entries;
+    void dumpGEDCOM(OutBuf&, int) const;
+    void dumpJSON(OutBuf&) const;
+
+    typedef Alloc allocator_type;
+    explicit AltLang(const Alloc& a = {}) : entries(a) {}
+    AltLang(const AltLang& o, const Alloc& a = {}) : entries(o.entries, a) {}
+    AltLang(AltLang&& o) = default;
+    AltLang(AltLang&& o, const Alloc& a) : entries(std::move(o.entries), a) {}
+    AltLang& operator=(const AltLang&) = default;
+    AltLang& operator=(AltLang&&) = default;
 };
 
-typedef std::string Date;
-typedef std::string IRI;
+typedef Text Date;
+typedef Text IRI;
 
 
 struct Album {
-    std::string name;
+    Text name;
     IRI id;
-    void dumpGEDCOM(FILE *);
-    void dumpJSON(FILE *);
+    void dumpGEDCOM(OutBuf&) const;
+    void dumpJSON(OutBuf&) const;
+
+    typedef Alloc allocator_type;
+    explicit Album(const Alloc& a = {}) : name(a), id(a) {}
+    Album(const Album& o, const Alloc& a = {}) : name(o.name, a), id(o.id, a) {}
+    Album(Album&& o) = default;
+    Album(Album&& o, const Alloc& a) : name(std::move(o.name), a), id(std::move(o.id), a) {}
+    Album& operator=(const Album&) = default;
+    Album& operator=(Album&&) = default;
 };
 
 struct Location {
     double lat, lon;
     AltLang name;
-    std::vector<IRI> ids;
-    void dumpGEDCOM(FILE *);
-    void dumpJSON(FILE *);
+    Vec<IRI> ids;
+    void dumpGEDCOM(OutBuf&) const;
+    void dumpJSON(OutBuf&) const;
+
+    typedef Alloc allocator_type;
+    explicit Location(const Alloc& a = {}) : name(a), ids(a) {}
+    Location(const Location& o, const Alloc& a = {}) : lat(o.lat), lon(o.lon), name(o.name, a), ids(o.ids, a) {}
+    Location(Location&& o) = default;
+    Location(Location&& o, const Alloc& a) : lat(o.lat), lon(o.lon), name(std::move(o.name), a), ids(std::move(o.ids), a) {}
+    Location& operator=(const Location&) = default;
+    Location& operator=(Location&&) = default;
 };
 
 struct Region {
     enum Types { NONE=0, RECTANGLE, CIRCLE, POLYGON };
     Types type = Types::NONE;
     union {
-        struct {double x, y, w, h;} rect;
+        struct {double x, y, w, h;} rect = {0, 0, 0, 0};
         struct {double x, y, rx;} circ;
     };
-    std::vector<std::pair<double, double>> pts;
-    void dumpGEDCOM(FILE *, int);
-    bool dumpJSON(FILE *, char);
+    Vec<std::pair<double, double>> pts;
+    void dumpGEDCOM(OutBuf&, int) const;
+    bool dumpJSON(OutBuf&, char) const;
+
+    typedef Alloc allocator_type;
+    explicit Region(const Alloc& a = {}) : pts(a) {}
+    Region(const Region& o, const Alloc& a = {}) : type(o.type), pts(o.pts, a) { memcpy(&rect, &o.rect, sizeof(rect)); }
+    Region(Region&& o) = default;
+    Region(Region&& o, const Alloc& a) : type(o.type), pts(std::move(o.pts), a) { memcpy(&rect, &o.rect, sizeof(rect)); }
+    Region& operator=(const Region&) = default;
+    Region& operator=(Region&&) = default;
 };
 
 struct Person {
     Region region;
     AltLang name;
     AltLang description;
-    std::vector<IRI> ids;
-    void dumpGEDCOM(FILE *);
-    void dumpJSON(FILE *);
+    Vec<IRI> ids;
+    void dumpGEDCOM(OutBuf&) const;
+    void dumpJSON(OutBuf&) const;
+
+    typedef Alloc allocator_type;
+    explicit Person(const Alloc& a = {}) : region(a), name(a), description(a), ids(a) {}
+    Person(const Person& o, const Alloc& a = {})
+        : region(o.region, a), name(o.name, a), description(o.description, a), ids(o.ids, a) {}
+    Person(Person&& o) = default;
+    Person(Person&& o, const Alloc& a)
+        : region(std::move(o.region), a), name(std::move(o.name), a),
+          description(std::move(o.description), a), ids(std::move(o.ids), a) {}
+    Person& operator=(const Person&) = default;
+    Person& operator=(Person&&) = default;
 };
 
 struct Object {
     Region region;
     AltLang title;
-    void dumpGEDCOM(FILE *);
-    void dumpJSON(FILE *);
+    void dumpGEDCOM(OutBuf&) const;
+    void dumpJSON(OutBuf&) const;
+
+    typedef Alloc allocator_type;
+    explicit Object(const Alloc& a = {}) : region(a), title(a) {}
+    Object(const Object& o, const Alloc& a = {}) : region(o.region, a), title(o.title, a) {}
+    Object(Object&& o) = default;
+    Object(Object&& o, const Alloc& a) : region(std::move(o.region), a), title(std::move(o.title), a) {}
+    Object& operator=(const Object&) = default;
+    Object& operator=(Object&&) = default;
+};
+
+/** The top-level fields of ImageMetadata, as bits to or together */
+enum FieldBits {
+    FIELD_TITLE = 1 << 0,
+    FIELD_CAPTION = 1 << 1,
+    FIELD_EVENT = 1 << 2,
+    FIELD_DATE = 1 << 3,
+    FIELD_ALBUMS = 1 << 4,
+    FIELD_LOCATIONS = 1 << 5,
+    FIELD_PEOPLE = 1 << 6,
+    FIELD_OBJECTS = 1 << 7,
+    ALL_FIELDS = (1 << 8) - 1,
+};
+/** How many FieldBits there are; field `i` is `1 << i` */
+const int FIELD_COUNT = 8;
+/** The JSON key of field `1 << i`, such as "date" */
+const char *fieldKey(int i);
+/** The fields named in a comma-separated list of JSON keys such as "date,people"; 0 if any is unknown */
+unsigned parseFields(std::string_view list);
+
+/**
+ * Choices about how ImageMetadata::parseFile reads an image
+ */
+struct ParseOptions {
+    /**
+     * Read the XMP packet straight out of JPEG, PNG and TIFF containers
+     * instead of opening them with the full SXMPFiles format handler.
+     * Much less I/O, but legacy EXIF and IPTC metadata is not reconciled
+     * into the XMP. Other formats always use SXMPFiles.
+     */
+    bool packetOnly = false;
+    /**
+     * Read the packet with the streaming extractor of fhmwg1sax.hpp
+     * instead of building the toolkit's data model. Implies packetOnly
+     * for the containers that the packet locator understands.
+     */
+    bool streaming = false;
+    /**
+     * Also treat non-ASCII Unicode spaces, such as the no-break and
+     * ideographic spaces, as whitespace when normalizing names and IDs.
+     */
+    bool unicodeSpaces = false;
+    /**
+     * The FieldBits to extract. The lookups for the others are skipped
+     * altogether, so asking only for the date reads a handful of properties.
+     */
+    unsigned fields = ALL_FIELDS;
+    /**
+     * A comma-separated list of languages, such as "en,x-default", to keep
+     * in AltLangs; empty keeps all. A language also matches its subtags,
+     * so "en" keeps "en-GB". The text is not copied, so must outlive the options.
+     */
+    std::string_view languages;
+    /**
+     * If set, the time spent in each phase and the size of what was read
+     * are added to it (see fhmwg1stats.hpp). Null costs nothing.
+     */
+    FileStats *stats = 0;
 };
 
+#ifdef FHMWG_SERIAL_XMP
+/** Serializes toolkit use when it was built without thread support */
+extern std::mutex xmpLock;
+#endif
+
 struct ImageMetadata {
     AltLang title, caption, event;
     Date date;
-    std::vector<Album> albums;
-    std::vector<Location> locations;
-    std::vector<Person> people;
-    std::vector<Object> objects;
-    void dumpGEDCOM(FILE *);
-    void dumpJSON(FILE *, bool newlines=false);
-    
-    void parseFile(const char *filename);
+    Vec<Album> albums;
+    Vec<Location> locations;
+    Vec<Person> people;
+    Vec<Object> objects;
+    void dumpGEDCOM(OutBuf&) const;
+    void dumpJSON(OutBuf&, bool newlines=false) const;
+    void dumpGEDCOM(FILE *f) const { OutBuf o(f); dumpGEDCOM(o); }
+    void dumpJSON(FILE *f, bool newlines=false) const { OutBuf o(f); dumpJSON(o, newlines); }
+    /**
+     * Appends a compact binary form of the model to `out`, for caching.
+     * Numbers are stored in the machine's own representation, so it is
+     * only meant to be read back by deserialize on the same kind of machine.
+     */
+    void serialize(std::string& out) const;
+    /** Replaces the model with one read back from serialize's output; false, leaving it reset, if `in` is malformed */
+    bool deserialize(std::string_view in);
+
+    typedef Alloc allocator_type;
+    /** Takes an allocator or a std::pmr::memory_resource * such as an Arena */
+    ImageMetadata(const Alloc& a = {})
+        : title(a), caption(a), event(a), date(a), albums(a), locations(a), people(a), objects(a) {}
+    ImageMetadata(ImageMetadata&&) = default;
+    ImageMetadata& operator=(ImageMetadata&&) = default;
+    allocator_type get_allocator() const { return this->date.get_allocator(); }
+    /**
+     * Empties every field, releasing (not just clearing) their storage so
+     * that an Arena they were allocated from can then be reset for the
+     * next file.
+     */
+    void reset() { *this = ImageMetadata(get_allocator()); }
+
+    void parseFile(const char *filename, const ParseOptions& opts = ParseOptions());
+    /** Like parseFile, but from a serialized packet and optional JPEG ExtendedXMP packet */
+    void parsePacket(const char *packet, size_t len, const char *extended = 0, size_t extendedLen = 0,
+        const ParseOptions& opts = ParseOptions());
+    /**
+     * Like parseFile, but from an image file's bytes already in memory.
+     * JPEG, PNG and TIFF packets are located as with packetOnly, and such
+     * an image without XMP leaves the model empty; any other bytes are
+     * parsed as a bare XMP packet. Throws std::runtime_error for an image
+     * whose packet the locator cannot read (see PacketSearch).
+     */
+    void parseBuffer(const void *data, size_t len, const ParseOptions& opts = ParseOptions());
+    /** Drops AltLang entries in languages not in `list`, as ParseOptions::languages describes; an empty list keeps all */
+    void keepLanguages(std::string_view list);
 };
 
 
@@ -0,0 +1,442 @@
+#include "fhmwg1index.hpp"
+#include "fhmwg1text.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace fhmwg {
+
+namespace {
+const char magic[8] = {'F','H','M','W','G','I','2','\n'};
+}
+
+struct Index::Header {
+    char magic[8];
+    uint64_t fileSize;
+    uint32_t images, reserved;
+    /** offset of `images` Terms naming the images (count and postings unused) */
+    uint64_t paths;
+    uint64_t terms[INDEX_TABLES];
+    uint64_t termCount[INDEX_TABLES];
+    /** offset of `dateCount` DateEntries */
+    uint64_t dates;
+    uint64_t dateCount;
+    /** offset of `pointCount` Points in Hilbert order, and of the R-tree's `boxCount` Boxes, lowest level first */
+    uint64_t points, pointCount;
+    uint64_t boxes, boxCount;
+};
+
+struct Index::Term {
+    uint64_t text;
+    uint32_t len;
+    uint32_t count;
+    uint64_t postings;
+};
+
+struct Index::Box {
+    double south, west, north, east;
+};
+
+namespace {
+
+struct DateEntry {
+    uint64_t key;
+    uint32_t image;
+    uint32_t reserved;
+};
+
+/** Appends `v`'s bytes to `out`, returning where they start */
+template<class T> uint64_t append(std::string& out, const T& v) {
+    uint64_t at = out.size();
+    out.append((const char *)&v, sizeof(v));
+    return at;
+}
+
+void align8(std::string& out) {
+    out.resize((out.size() + 7) & ~(size_t)7);
+}
+
+bool writeAll(int fd, const char *data, size_t len) {
+    while(len > 0) {
+        ssize_t wrote = ::write(fd, data, len);
+        if (wrote < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += wrote;
+        len -= wrote;
+    }
+    return true;
+}
+
+struct Point {
+    double lat, lon;
+    uint32_t image, reserved;
+};
+
+/** Mean radius of the Earth */
+const double earthKm = 6371.0088;
+const double degree = M_PI / 180;
+
+/** Position of a point along a Hilbert curve filling a 65536 x 65536 grid over the globe */
+uint64_t hilbert(double lat, double lon) {
+    const uint32_t side = 1 << 16;
+    uint32_t x = std::min((uint32_t)((lon + 180) / 360 * side), side - 1);
+    uint32_t y = std::min((uint32_t)((lat + 90) / 180 * side), side - 1);
+    uint64_t d = 0;
+    for(uint32_t s = side / 2; s > 0; s /= 2) {
+        uint32_t rx = (x & s) ? 1 : 0, ry = (y & s) ? 1 : 0;
+        d += (uint64_t)s * s * ((3 * rx) ^ ry);
+        if (ry == 0) {
+            if (rx == 1) {
+                x = side - 1 - x;
+                y = side - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+/**
+ * The number of boxes on each level of an R-tree over `points` points,
+ * lowest level first. There are none if there are no points.
+ */
+std::vector<uint64_t> levelSizes(uint64_t points) {
+    std::vector<uint64_t> ans;
+    for(uint64_t n = points; n > 1 || (n == 1 && ans.size() == 0); ) {
+        n = (n + Index::fanout - 1) / Index::fanout;
+        ans.push_back(n);
+    }
+    return ans;
+}
+
+/** Great-circle distance in kilometres */
+double distance(double lat1, double lon1, double lat2, double lon2) {
+    double dlat = sin((lat2 - lat1) * degree / 2), dlon = sin((lon2 - lon1) * degree / 2);
+    double a = dlat * dlat + cos(lat1 * degree) * cos(lat2 * degree) * dlon * dlon;
+    return 2 * earthKm * asin(std::min(1.0, sqrt(a)));
+}
+
+} // anonymous namespace
+
+std::string normalizeName(std::string_view name) {
+    std::string ans(name);
+    whitespaceNormalize(ans, UNICODE_SPACES);
+    for(char& c : ans) if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+    return ans;
+}
+
+uint64_t dateKey(std::string_view date, int pad) {
+    uint64_t key = 0;
+    int digits = 0;
+    for(char c : date) {
+        if (c < '0' || c > '9') continue;
+        key = key * 10 + (c - '0');
+        if (++digits == 14) break;
+    }
+    if (digits == 0) return 0;
+    for(; digits < 14; digits += 1) key = key * 10 + pad;
+    return key;
+}
+
+
+void IndexBuilder::post(IndexTable t, const std::string& term, uint32_t image) {
+    if (term.size() == 0) return;
+    std::vector<uint32_t>& postings = this->tables[t][term];
+    // images arrive in order, so a repeat can only be the last one
+    if (postings.size() == 0 || postings.back() != image) postings.push_back(image);
+}
+
+void IndexBuilder::add(const std::string& path, const ImageMetadata& md) {
+    uint32_t image = this->paths.size();
+    this->paths.push_back(path);
+    for(const Person& p : md.people) {
+        for(const IRI& id : p.ids) post(PERSON_IDS, std::string(id), image);
+        for(const LangStr& name : p.name.entries) post(PERSON_NAMES, normalizeName(name.text), image);
+    }
+    for(const Album& a : md.albums) {
+        post(ALBUM_IDS, std::string(a.id), image);
+        post(ALBUM_NAMES, normalizeName(a.name), image);
+    }
+    for(const Location& l : md.locations) {
+        for(const IRI& id : l.ids) post(LOCATION_IDS, std::string(id), image);
+    }
+    uint64_t key = dateKey(md.date);
+    if (key) this->dates.push_back(std::pair<uint64_t, uint32_t>(key, image));
+    for(const Location& l : md.locations) {
+        // NaN fails both tests
+        if (l.lat >= -90 && l.lat <= 90 && l.lon >= -180 && l.lon <= 180)
+            this->places.push_back(Place{l.lat, l.lon, image, 0});
+    }
+}
+
+bool IndexBuilder::write(const char *fileName) const {
+    std::string out(sizeof(Index::Header), '\0');
+    Index::Header h = {};
+    memcpy(h.magic, magic, sizeof(magic));
+    h.images = this->paths.size();
+
+    // the strings, then the postings, then the fixed-size arrays that point into them
+    std::vector<uint64_t> pathAt, termAt[INDEX_TABLES], postingsAt[INDEX_TABLES];
+    for(const std::string& p : this->paths) {
+        pathAt.push_back(out.size());
+        out += p;
+    }
+    for(int t=0; t<INDEX_TABLES; t+=1)
+        for(const auto& entry : this->tables[t]) {
+            termAt[t].push_back(out.size());
+            out += entry.first;
+        }
+    align8(out);
+    for(int t=0; t<INDEX_TABLES; t+=1)
+        for(const auto& entry : this->tables[t]) {
+            postingsAt[t].push_back(out.size());
+            out.append((const char *)entry.second.data(), entry.second.size() * sizeof(uint32_t));
+        }
+    align8(out);
+
+    h.paths = out.size();
+    for(size_t i=0; i<this->paths.size(); i+=1)
+        append(out, Index::Term{pathAt[i], (uint32_t)this->paths[i].size(), 0, 0});
+    for(int t=0; t<INDEX_TABLES; t+=1) {
+        h.terms[t] = out.size();
+        h.termCount[t] = this->tables[t].size();
+        size_t i = 0;
+        for(const auto& entry : this->tables[t]) {
+            append(out, Index::Term{termAt[t][i], (uint32_t)entry.first.size(), (uint32_t)entry.second.size(), postingsAt[t][i]});
+            i += 1;
+        }
+    }
+
+    std::vector<std::pair<uint64_t, uint32_t>> sorted(this->dates);
+    std::sort(sorted.begin(), sorted.end());
+    h.dates = out.size();
+    h.dateCount = sorted.size();
+    for(const auto& d : sorted) append(out, DateEntry{d.first, d.second, 0});
+
+    std::vector<std::pair<uint64_t, size_t>> order;
+    for(size_t i=0; i<this->places.size(); i+=1)
+        order.push_back(std::pair<uint64_t, size_t>(hilbert(this->places[i].lat, this->places[i].lon), i));
+    std::sort(order.begin(), order.end());
+    h.points = out.size();
+    h.pointCount = order.size();
+    std::vector<Index::Box> below;
+    for(const auto& o : order) {
+        const Place& p = this->places[o.second];
+        append(out, Point{p.lat, p.lon, p.image, 0});
+        below.push_back(Index::Box{p.lat, p.lon, p.lat, p.lon});
+    }
+    h.boxes = out.size();
+    for(uint64_t n : levelSizes(order.size())) {
+        std::vector<Index::Box> level(n);
+        for(size_t i=0; i<n; i+=1) {
+            Index::Box& b = level[i];
+            size_t from = i * Index::fanout, to = std::min(below.size(), from + Index::fanout);
+            b = below[from];
+            for(size_t j=from+1; j<to; j+=1) {
+                b.south = std::min(b.south, below[j].south);
+                b.west = std::min(b.west, below[j].west);
+                b.north = std::max(b.north, below[j].north);
+                b.east = std::max(b.east, below[j].east);
+            }
+            append(out, b);
+        }
+        h.boxCount += n;
+        below.swap(level);
+    }
+
+    h.fileSize = out.size();
+    memcpy(&out[0], &h, sizeof(h));
+
+    std::string tmp = std::string(fileName) + ".tmp" + std::to_string(getpid());
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    bool ok = writeAll(fd, out.data(), out.size());
+    int e = errno;
+    ok = ::close(fd) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), fileName) < 0) {
+        if (ok) e = errno;
+        unlink(tmp.c_str());
+        errno = e;
+        return false;
+    }
+    return true;
+}
+
+
+Index::~Index() {
+    if (this->map) munmap((void *)this->map, this->mapLen);
+}
+
+bool Index::open(const char *fileName) {
+    int fd = ::open(fileName, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) < 0) { ::close(fd); return false; }
+    size_t len = st.st_size;
+    if (len < sizeof(Header)) { ::close(fd); errno = EINVAL; return false; }
+    void *m = mmap(0, len, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) return false;
+    this->map = (const unsigned char *)m;
+    this->mapLen = len;
+
+    // check that every array lies within the file, so that lookups need only check strings and postings
+    const Header *h = header();
+    bool ok = memcmp(h->magic, magic, sizeof(magic)) == 0 && h->fileSize == len;
+    auto fits = [&](uint64_t at, uint64_t count, size_t size) {
+        return at % 8 == 0 && at <= len && count <= (len - at) / size;
+    };
+    ok = ok && fits(h->paths, h->images, sizeof(Term)) && fits(h->dates, h->dateCount, sizeof(DateEntry));
+    for(int t=0; ok && t<INDEX_TABLES; t+=1) ok = fits(h->terms[t], h->termCount[t], sizeof(Term));
+    ok = ok && fits(h->points, h->pointCount, sizeof(Point)) && fits(h->boxes, h->boxCount, sizeof(Box));
+    if (ok) {
+        uint64_t boxes = 0;
+        for(uint64_t n : levelSizes(h->pointCount)) boxes += n;
+        ok = boxes == h->boxCount;
+    }
+    if (!ok) {
+        munmap(m, len);
+        this->map = 0;
+        errno = EINVAL;
+        return false;
+    }
+    return true;
+}
+
+size_t Index::size() const {
+    return this->map ? header()->images : 0;
+}
+
+std::string_view Index::string(uint64_t offset, uint32_t len) const {
+    if (offset > this->mapLen || len > this->mapLen - offset) return std::string_view();
+    return std::string_view((const char *)this->map + offset, len);
+}
+
+std::string_view Index::path(uint32_t image) const {
+    if (image >= size()) return std::string_view();
+    const Term *t = (const Term *)(this->map + header()->paths) + image;
+    return string(t->text, t->len);
+}
+
+std::vector<uint32_t> Index::find(IndexTable table, std::string_view term) const {
+    std::vector<uint32_t> ans;
+    if (!this->map) return ans;
+    bool prefix = term.size() > 0 && term.back() == '*';
+    if (prefix) term.remove_suffix(1);
+    const Term *first = (const Term *)(this->map + header()->terms[table]);
+    const Term *last = first + header()->termCount[table];
+    const Term *at = std::lower_bound(first, last, term,
+        [&](const Term& t, std::string_view key) { return string(t.text, t.len) < key; });
+    for(; at != last; at += 1) {
+        std::string_view text = string(at->text, at->len);
+        if (prefix ? text.substr(0, term.size()) != term : text != term) break;
+        if (at->postings % 4 != 0 || at->postings > this->mapLen
+        || at->count > (this->mapLen - at->postings) / sizeof(uint32_t)) continue;
+        const uint32_t *p = (const uint32_t *)(this->map + at->postings);
+        ans.insert(ans.end(), p, p + at->count);
+        if (!prefix) break;
+    }
+    if (prefix) {
+        std::sort(ans.begin(), ans.end());
+        ans.erase(std::unique(ans.begin(), ans.end()), ans.end());
+    }
+    return ans;
+}
+
+std::vector<uint32_t> Index::dated(uint64_t from, uint64_t to) const {
+    std::vector<uint32_t> ans;
+    if (!this->map) return ans;
+    const DateEntry *first = (const DateEntry *)(this->map + header()->dates);
+    const DateEntry *last = first + header()->dateCount;
+    const DateEntry *at = std::lower_bound(first, last, from,
+        [](const DateEntry& d, uint64_t key) { return d.key < key; });
+    for(; at != last && at->key <= to; at += 1) ans.push_back(at->image);
+    std::sort(ans.begin(), ans.end());
+    return ans;
+}
+
+void Index::search(const GeoBox& box, const std::function<void(double lat, double lon, uint32_t image)>& found) const {
+    if (!this->map) return;
+    const Header *h = header();
+    const Box *boxes = (const Box *)(this->map + h->boxes);
+    const Point *points = (const Point *)(this->map + h->points);
+    std::vector<uint64_t> sizes = levelSizes(h->pointCount), start(sizes.size());
+    for(size_t l=1; l<sizes.size(); l+=1) start[l] = start[l-1] + sizes[l-1];
+
+    bool wraps = box.west > box.east;
+    auto overlaps = [&](const Box& b) {
+        if (b.north < box.south || b.south > box.north) return false;
+        if (wraps) return b.east >= box.west || b.west <= box.east;
+        return b.east >= box.west && b.west <= box.east;
+    };
+
+    // (level, box) pairs still to look inside
+    std::vector<std::pair<size_t, uint64_t>> todo;
+    if (sizes.size() > 0) todo.push_back(std::pair<size_t, uint64_t>(sizes.size() - 1, 0));
+    while(todo.size() > 0) {
+        size_t level = todo.back().first;
+        uint64_t i = todo.back().second;
+        todo.pop_back();
+        if (!overlaps(boxes[start[level] + i])) continue;
+        uint64_t from = i * fanout;
+        if (level == 0) {
+            uint64_t to = std::min(h->pointCount, from + fanout);
+            for(uint64_t j=from; j<to; j+=1) {
+                const Point& p = points[j];
+                if (overlaps(Box{p.lat, p.lon, p.lat, p.lon})) found(p.lat, p.lon, p.image);
+            }
+        } else {
+            uint64_t to = std::min(sizes[level - 1], from + fanout);
+            for(uint64_t j=from; j<to; j+=1) todo.push_back(std::pair<size_t, uint64_t>(level - 1, j));
+        }
+    }
+}
+
+/** Sorts `images` and drops repeats, since one image can have several locations */
+static void unique(std::vector<uint32_t>& images) {
+    std::sort(images.begin(), images.end());
+    images.erase(std::unique(images.begin(), images.end()), images.end());
+}
+
+std::vector<uint32_t> Index::within(const GeoBox& box) const {
+    std::vector<uint32_t> ans;
+    search(box, [&](double, double, uint32_t image) { ans.push_back(image); });
+    unique(ans);
+    return ans;
+}
+
+std::vector<uint32_t> Index::near(double lat, double lon, double km) const {
+    std::vector<uint32_t> ans;
+    if (!(km >= 0)) return ans;
+    // the smallest box holding the circle, then the exact distance of each point in it
+    double dlat = km / earthKm / degree;
+    GeoBox box = {lat - dlat, -180, lat + dlat, 180};
+    double s = sin(km / earthKm) / cos(lat * degree);
+    if (box.south > -90 && box.north < 90 && s < 1) {
+        double dlon = asin(s) / degree;
+        box.west = lon - dlon;
+        box.east = lon + dlon;
+        if (box.west < -180) box.west += 360;
+        if (box.east > 180) box.east -= 360;
+    }
+    search(box, [&](double plat, double plon, uint32_t image) {
+        if (distance(lat, lon, plat, plon) <= km) ans.push_back(image);
+    });
+    unique(ans);
+    return ans;
+}
+
+std::vector<uint32_t> intersect(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b) {
+    std::vector<uint32_t> ans;
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(ans));
+    return ans;
+}
+
+} // namespace fhmwg
@@ -0,0 +1,124 @@
+#pragma once
+#include "fhmwg1ds.hpp"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <functional>
+#include <cstdint>
+
+namespace fhmwg {
+
+/**
+ * The lookup tables of an index: each maps terms to the images that
+ * have them.
+ */
+enum IndexTable {
+    /** Person::ids */
+    PERSON_IDS = 0,
+    /** Every language's Person::name, normalized with normalizeName */
+    PERSON_NAMES,
+    /** Album::id */
+    ALBUM_IDS,
+    /** Album::name, normalized with normalizeName */
+    ALBUM_NAMES,
+    /** Location::ids */
+    LOCATION_IDS,
+    INDEX_TABLES
+};
+
+/**
+ * Puts a name into the form the index stores it in: whitespace normalized
+ * (Unicode spaces included) and with ASCII letters in lower case.
+ */
+std::string normalizeName(std::string_view name);
+
+/**
+ * Turns a date into a number that sorts in date order: its first 14
+ * digits (YYYYMMDDhhmmss), padded with `pad` (0 or 9) if it has fewer.
+ * Works for XMP ("1962-07-04T10:00") and EXIF ("1962:07:04 10:00:00")
+ * forms alike, and for partial dates such as "1962" or "1962-07".
+ * Returns 0 if `date` has no digits.
+ */
+uint64_t dateKey(std::string_view date, int pad = 0);
+
+/** A rectangle of latitude and longitude in degrees; west > east if it crosses the 180th meridian */
+struct GeoBox {
+    double south, west, north, east;
+};
+
+/**
+ * Collects the metadata of many images and writes it out as an index
+ * that Index can memory-map.
+ */
+class IndexBuilder {
+public:
+    /** Adds an image; the images are numbered in the order they are added */
+    void add(const std::string& path, const ImageMetadata& md);
+    /** Writes the index to `fileName`, replacing it atomically. False, with errno set, on failure. */
+    bool write(const char *fileName) const;
+    size_t size() const { return this->paths.size(); }
+private:
+    std::vector<std::string> paths;
+    std::map<std::string, std::vector<uint32_t>> tables[INDEX_TABLES];
+    std::vector<std::pair<uint64_t, uint32_t>> dates;
+    struct Place { double lat, lon; uint32_t image, reserved; };
+    std::vector<Place> places;
+    void post(IndexTable t, const std::string& term, uint32_t image);
+};
+
+/**
+ * A memory-mapped index written by IndexBuilder.
+ *
+ * The file is a header, then 8-byte aligned arrays that are used in place:
+ * image paths, each table's terms in byte order with their postings (the
+ * sorted numbers of the images that have the term), and (date, image)
+ * pairs sorted by date. Lookups are binary searches, so a query reads a
+ * handful of pages.
+ *
+ * Location coordinates are kept as a packed R-tree: the points sorted
+ * along a Hilbert curve, so that neighbours on the globe are mostly
+ * neighbours in the array, and above them levels of bounding boxes
+ * each covering `fanout` boxes (or points) of the level below. A
+ * spatial query descends only into the boxes that overlap it.
+ */
+class Index {
+public:
+    ~Index();
+    /** False, with errno set, if `fileName` cannot be mapped or is not an index */
+    bool open(const char *fileName);
+
+    size_t size() const;
+    std::string_view path(uint32_t image) const;
+
+    /**
+     * The images having `term` in `table`, in ascending order. A term
+     * ending in '*' matches every term it is a prefix of.
+     */
+    std::vector<uint32_t> find(IndexTable table, std::string_view term) const;
+    /** The images dated from `from` to `to` inclusive (dateKey form), in ascending order */
+    std::vector<uint32_t> dated(uint64_t from, uint64_t to) const;
+    /** The images with a location inside `box`, in ascending order */
+    std::vector<uint32_t> within(const GeoBox& box) const;
+    /** The images with a location within `km` kilometres (great-circle distance) of `lat`, `lon`, in ascending order */
+    std::vector<uint32_t> near(double lat, double lon, double km) const;
+
+    /** Boxes or points per box of the R-tree */
+    static const unsigned fanout = 16;
+
+private:
+    friend class IndexBuilder;
+    const unsigned char *map = 0;
+    size_t mapLen = 0;
+    struct Header;
+    struct Term;
+    struct Box;
+    void search(const GeoBox& box, const std::function<void(double lat, double lon, uint32_t image)>& found) const;
+    const Header *header() const { return (const Header *)this->map; }
+    std::string_view string(uint64_t offset, uint32_t len) const;
+};
+
+/** Both lists are sorted; returns the numbers in both */
+std::vector<uint32_t> intersect(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b);
+
+} // namespace fhmwg
@@ -0,0 +1,117 @@
+#include "fhmwg1lib.hpp"
+#include "fhmwg1ds.hpp"
+#include "fhmwg1arena.hpp"
+#include "fhmwg1packet.hpp"
+#include "fhmwg1patch.hpp"
+#include "fhmwg1write.hpp"
+#include <string>
+#include <cstring>
+
+namespace {
+
+/** Why this thread's last call failed */
+thread_local std::string lastError;
+
+/** Initializes the toolkit and the namespaces once per process; false if that failed */
+bool ready() {
+    static const bool ok = []() {
+        if (!SXMPMeta::Initialize()) return false;
+        fhmwg::ns::init();
+        return true;
+    }();
+    if (!ok) lastError = "SXMPMeta::Initialize failed";
+    return ok;
+}
+
+/** Copies `result` to the caller's buffer if it fits */
+int deliver(const std::string& result, char *out, size_t cap, size_t *outLen) {
+    *outLen = result.size();
+    if (result.size() > cap) {
+        lastError = "output needs " + std::to_string(result.size()) + " bytes";
+        return FHMWG_TOO_SMALL;
+    }
+    memcpy(out, result.data(), result.size());
+    return FHMWG_OK;
+}
+
+} // anonymous namespace
+
+extern "C" int fhmwg_version(void) {
+    return FHMWG_API_VERSION;
+}
+
+extern "C" const char *fhmwg_last_error(void) {
+    return lastError.c_str();
+}
+
+extern "C" int fhmwg_parse(const void *data, size_t len, unsigned flags, char *out, size_t cap, size_t *outLen) {
+    lastError.clear();
+    *outLen = 0;
+    if (!ready()) return FHMWG_FAILED;
+    // one model per calling thread, built in an arena that is recycled between calls
+    static thread_local fhmwg::Arena arena;
+    static thread_local fhmwg::ImageMetadata md(&arena);
+    static thread_local std::string result;
+    md.reset();
+    arena.reset();
+    result.clear();
+    fhmwg::ParseOptions opts;
+    opts.streaming = flags & FHMWG_STREAMING;
+    opts.unicodeSpaces = flags & FHMWG_UNICODE_SPACES;
+    try {
+        md.parseBuffer(data, len, opts);
+        if (flags & FHMWG_SERIALIZED) md.serialize(result);
+        else {
+            fhmwg::OutBuf o(result);
+            if (flags & FHMWG_GEDCOM) md.dumpGEDCOM(o);
+            else { md.dumpJSON(o); o.put('\n'); }
+        }
+    } catch (XMP_Error ex) {
+        lastError = "XMP error " + std::to_string(ex.GetID()) + ": " + ex.GetErrMsg();
+        return FHMWG_XMP_ERROR;
+    } catch (const std::exception& ex) {
+        lastError = ex.what();
+        return FHMWG_FAILED;
+    }
+    return deliver(result, out, cap, outLen);
+}
+
+extern "C" int fhmwg_update(const void *data, size_t len, const char *edits, size_t editsLen, unsigned padding,
+    char *out, size_t cap, size_t *outLen) {
+    lastError.clear();
+    *outLen = 0;
+    if (!ready()) return FHMWG_FAILED;
+    static thread_local std::string result;
+    try {
+        fhmwg::Patch patch;
+        patch.parse(std::string_view(edits, editsLen));
+        fhmwg::XMPPacket packet;
+        switch(fhmwg::locateXMPPacket((const unsigned char *)data, len, packet)) {
+            case fhmwg::PACKET_FOUND: {
+                const char *ext = packet.extended.size() > 0 ? packet.extended.data() : 0;
+                fhmwg::updatePacket(packet.main, packet.mainLen, ext, packet.extended.size(), patch, result, padding);
+                break;
+            }
+            case fhmwg::NO_PACKET:
+                // an image without XMP yet: the edits make its first packet
+                fhmwg::updatePacket(0, 0, 0, 0, patch, result, padding);
+                break;
+            case fhmwg::PACKET_UNREADABLE:
+                lastError = "the image's XMP is compressed, in a BigTIFF, or past damage, and cannot be read from memory";
+                return FHMWG_FAILED;
+            case fhmwg::NOT_A_CONTAINER:
+                fhmwg::updatePacket((const char *)data, len, 0, 0, patch, result, padding);
+                break;
+        }
+    } catch (const fhmwg::JSONError& ex) {
+        lastError = ex.what();
+        return FHMWG_BAD_EDITS;
+    } catch (XMP_Error ex) {
+        lastError = "XMP error " + std::to_string(ex.GetID()) + ": " + ex.GetErrMsg();
+        return FHMWG_XMP_ERROR;
+    } catch (const std::exception& ex) {
+        lastError = ex.what();
+        return FHMWG_FAILED;
+    }
+    return deliver(result, out, cap, outLen);
+}
@@ -0,0 +1,85 @@
+#pragma once
+/*
+ * libfhmwg: the FHMWG parser and writer as a library that works on bytes
+ * already in memory, so that a service holding an upload or an
+ * object-store fetch need not write it to a temporary file.
+ *
+ * This is a C interface, so that its ABI stays stable across compilers
+ * and releases of the C++ code behind it: only plain types cross it, and
+ * functions are only ever added. C++ callers that link the same build can
+ * instead use ImageMetadata::parseBuffer (fhmwg1ds.hpp) and updatePacket
+ * (fhmwg1write.hpp) directly, or ask for FHMWG_SERIALIZED output and read
+ * it with ImageMetadata::deserialize.
+ *
+ * Every function may be called from any number of threads at once. The
+ * XMP toolkit is initialized on first use and stays so; each thread keeps
+ * its own model and arena, reused from call to call.
+ */
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Bumped only when functions or flags are added */
+#define FHMWG_API_VERSION 1
+
+/** Flags for fhmwg_parse */
+enum {
+    /** GEDCOM output instead of JSON, as parser -g */
+    FHMWG_GEDCOM = 1,
+    /** Extract with the streaming reader instead of the toolkit, as parser -s */
+    FHMWG_STREAMING = 2,
+    /** Also collapse non-ASCII Unicode spaces in names, as parser -w */
+    FHMWG_UNICODE_SPACES = 4,
+    /** ImageMetadata::serialize's form instead of text, for C++ callers of the same build and machine */
+    FHMWG_SERIALIZED = 8
+};
+
+/** Results of the functions below */
+enum {
+    FHMWG_OK = 0,
+    /** The output did not fit; the size it needs is in *outLen */
+    FHMWG_TOO_SMALL = 1,
+    /** The edits were not valid JSON or had fields of the wrong type */
+    FHMWG_BAD_EDITS = 2,
+    /** The toolkit could not parse or update the XMP */
+    FHMWG_XMP_ERROR = 3,
+    /** The toolkit could not be initialized, or some other failure */
+    FHMWG_FAILED = 4
+};
+
+/** The FHMWG_API_VERSION the library was built with */
+int fhmwg_version(void);
+
+/**
+ * Parses `data`, the bytes of a JPEG, PNG or TIFF image or a bare XMP
+ * packet, and writes what parser would print for it into `out`, which
+ * has room for `cap` bytes. The output is not NUL-terminated; its length
+ * is put in *outLen, both on success and, as the size needed, on
+ * FHMWG_TOO_SMALL. An image without XMP gives the output for no metadata;
+ * one whose XMP is compressed, in a BigTIFF or past damage in the file
+ * gives FHMWG_FAILED, as only the uncompressed layouts are read here.
+ */
+int fhmwg_parse(const void *data, size_t len, unsigned flags, char *out, size_t cap, size_t *outLen);
+
+/**
+ * Applies the JSON edits that writer reads from stdin (`edits`, `editsLen`
+ * bytes) to the XMP of `data`, the bytes of an image as for fhmwg_parse or
+ * a bare packet, and writes the edited packet, with `padding` bytes of
+ * padding, into `out` as fhmwg_parse does. For an image without XMP the
+ * edits make a new packet. Putting the packet back into an image
+ * container is left to the caller, or to writer.
+ */
+int fhmwg_update(const void *data, size_t len, const char *edits, size_t editsLen, unsigned padding,
+    char *out, size_t cap, size_t *outLen);
+
+/**
+ * Why the calling thread's last call failed, or "" if it did not. Valid
+ * until that thread next calls the library.
+ */
+const char *fhmwg_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
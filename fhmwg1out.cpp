@@ -0,0 +1,60 @@
+#include "fhmwg1out.hpp"
+#include "fhmwg1text.hpp"
+#include <charconv>
+
+namespace fhmwg {
+
+OutBuf::OutBuf(FILE *sink, size_t block) : buf(own), sink(sink), block(block) {
+    this->own.reserve(block + 512);
+}
+
+OutBuf::~OutBuf() {
+    flush();
+}
+
+void OutBuf::flush() {
+    if (!this->sink || this->buf.size() == 0) return;
+    fwrite(this->buf.data(), 1, this->buf.size(), this->sink);
+    this->buf.clear();
+}
+
+OutBuf& OutBuf::number(double v) {
+    char tmp[32];
+    char *end = std::to_chars(tmp, tmp + sizeof(tmp), v, std::chars_format::general, 15).ptr;
+    return put(std::string_view(tmp, end - tmp));
+}
+
+OutBuf& OutBuf::fixed(double v) {
+    char tmp[400]; // room for the 309 integer digits of DBL_MAX
+    char *end = std::to_chars(tmp, tmp + sizeof(tmp), v, std::chars_format::fixed, 15).ptr;
+    return put(std::string_view(tmp, end - tmp));
+}
+
+OutBuf& OutBuf::integer(long v) {
+    char tmp[24];
+    char *end = std::to_chars(tmp, tmp + sizeof(tmp), v).ptr;
+    return put(std::string_view(tmp, end - tmp));
+}
+
+OutBuf& OutBuf::json(std::string_view s) {
+    static const char hex[] = "0123456789abcdef";
+    put('"');
+    for(;;) {
+        size_t n = jsonSafeSpan(s.data(), s.size());
+        put(s.substr(0, n));
+        if (n == s.size()) break;
+        unsigned char c = s[n];
+        s.remove_prefix(n + 1);
+        if (c == '\n') put("\\n");
+        else if (c == '\r') put("\\r");
+        else if (c == '\t') put("\\t");
+        else if (c == '\f') put("\\f");
+        else if (c == '\b') put("\\b");
+        else if (c == '"') put("\\\"");
+        else if (c == '\\') put("\\\\");
+        else put("\\u00").put(hex[c >> 4]).put(hex[c & 15]);
+    }
+    return put('"');
+}
+
+} // namespace fhmwg
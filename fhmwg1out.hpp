@@ -0,0 +1,45 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <cstdio>
+
+namespace fhmwg {
+
+/**
+ * A growable output buffer for the dumpers. Bytes are appended to a
+ * contiguous std::string, either one the caller owns and takes the
+ * result from, or an internal one that is written to a FILE * in large
+ * blocks and when the OutBuf is destroyed.
+ */
+class OutBuf {
+public:
+    /** Appends to `into`, which the caller owns */
+    explicit OutBuf(std::string& into) : buf(into) {}
+    /** Writes to `sink` whenever at least `block` bytes are waiting */
+    explicit OutBuf(FILE *sink, size_t block = 64 * 1024);
+    ~OutBuf();
+    OutBuf(const OutBuf&) = delete;
+    OutBuf& operator=(const OutBuf&) = delete;
+
+    OutBuf& put(char c) { this->buf.push_back(c); return *this; }
+    OutBuf& put(std::string_view s) { this->buf.append(s); spill(); return *this; }
+    /** As printf's %.15g */
+    OutBuf& number(double v);
+    /** As printf's %.15f */
+    OutBuf& fixed(double v);
+    OutBuf& integer(long v);
+    /** Appends `s` as a quoted JSON string, escaping what must be escaped */
+    OutBuf& json(std::string_view s);
+
+    /** Writes out whatever is waiting, if there is a sink */
+    void flush();
+
+private:
+    std::string own;
+    std::string& buf;
+    FILE *sink = 0;
+    size_t block = 0;
+    void spill() { if (this->sink && this->buf.size() >= this->block) flush(); }
+};
+
+} // namespace fhmwg
@@ -0,0 +1,180 @@
+#include "fhmwg1packet.hpp"
+#include <cstring>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace fhmwg {
+
+static const char jpegXMP[] = "http://ns.adobe.com/xap/1.0/";              // 29 bytes with NUL
+static const char jpegExtXMP[] = "http://ns.adobe.com/xmp/extension/";     // 35 bytes with NUL
+static const char pngXMP[] = "XML:com.adobe.xmp";                          // 18 bytes with NUL
+
+static unsigned be16(const unsigned char *p) { return (p[0] << 8) | p[1]; }
+static unsigned long be32(const unsigned char *p) { return ((unsigned long)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+static unsigned le16(const unsigned char *p) { return (p[1] << 8) | p[0]; }
+static unsigned long le32(const unsigned char *p) { return ((unsigned long)p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0]; }
+
+/**
+ * Finds the GUID named by xmpNote:HasExtendedXMP in the main packet,
+ * either as an attribute or as element content. Returns false if absent.
+ */
+static bool extendedGUID(const char *packet, size_t len, std::string& guid) {
+    static const char key[] = "HasExtendedXMP";
+    const char *end = packet + len;
+    const char *at = packet;
+    while(at < end) {
+        at = (const char *)memmem(at, end - at, key, sizeof(key)-1);
+        if (!at) return false;
+        at += sizeof(key)-1;
+        while(at < end && (*at == ' ' || *at == '=' || *at == '"' || *at == '\'' || *at == '>')) at += 1;
+        const char *hex = at;
+        while(at < end && ((*at >= '0' && *at <= '9') || (*at >= 'A' && *at <= 'F') || (*at >= 'a' && *at <= 'f'))) at += 1;
+        if (at - hex == 32) { guid.assign(hex, 32); return true; }
+    }
+    return false;
+}
+
+static PacketSearch findInJPEG(const unsigned char *data, size_t len, XMPPacket& out) {
+    std::string guid;
+    bool haveGUID = false;
+    std::vector<std::pair<size_t, size_t>> parts; // offset and length of each chunk copied
+    size_t pos = 2;
+    bool ended = false; // reached the image data, so there are no more segments to find
+    while(pos + 4 <= len) {
+        if (data[pos] != 0xFF) break;
+        unsigned char marker = data[pos+1];
+        if (marker == 0xFF) { pos += 1; continue; } // fill byte
+        if (marker == 0xD8 || (marker >= 0xD0 && marker <= 0xD7) || marker == 0x01) { pos += 2; continue; }
+        if (marker == 0xDA || marker == 0xD9) { ended = true; break; } // image data: no more metadata segments
+        size_t seglen = be16(data + pos + 2);
+        if (seglen < 2 || pos + 2 + seglen > len) break;
+        const unsigned char *body = data + pos + 4;
+        size_t bodyLen = seglen - 2;
+        if (marker == 0xE1) {
+            if (!out.main && bodyLen > sizeof(jpegXMP) && !memcmp(body, jpegXMP, sizeof(jpegXMP))) {
+                out.main = (const char *)body + sizeof(jpegXMP);
+                out.mainLen = bodyLen - sizeof(jpegXMP);
+                haveGUID = extendedGUID(out.main, out.mainLen, guid);
+            } else if (bodyLen > sizeof(jpegExtXMP) + 40 && !memcmp(body, jpegExtXMP, sizeof(jpegExtXMP))) {
+                // GUID[32] full-length[4] offset[4] data
+                const unsigned char *chunk = body + sizeof(jpegExtXMP);
+                if (!haveGUID || memcmp(chunk, guid.data(), 32)) { pos += 2 + seglen; continue; }
+                size_t full = be32(chunk + 32), offset = be32(chunk + 36);
+                size_t n = bodyLen - sizeof(jpegExtXMP) - 40;
+                // the chunks cannot hold more than the file does, whatever the header claims
+                if (full == 0 || full > len) return PACKET_UNREADABLE;
+                if (out.extended.size() == 0) out.extended.resize(full);
+                if (full != out.extended.size() || offset + n > full) return PACKET_UNREADABLE;
+                bool repeated = false;
+                for(const auto& part : parts) repeated = repeated || part.first == offset;
+                if (!repeated) {
+                    memcpy(&out.extended[offset], chunk + 40, n);
+                    parts.emplace_back(offset, n);
+                }
+            }
+        }
+        pos += 2 + seglen;
+    }
+    // incomplete unless the chunks cover every byte; ignore it then, like the toolkit does
+    std::sort(parts.begin(), parts.end());
+    size_t covered = 0;
+    for(const auto& part : parts) {
+        if (part.first > covered) break;
+        covered = std::max(covered, part.first + part.second);
+    }
+    if (covered != out.extended.size()) out.extended.clear();
+    return out.main ? PACKET_FOUND : ended ? NO_PACKET : PACKET_UNREADABLE;
+}
+
+static PacketSearch findInPNG(const unsigned char *data, size_t len, XMPPacket& out) {
+    size_t pos = 8;
+    while(pos + 12 <= len) {
+        size_t chunkLen = be32(data + pos);
+        const unsigned char *type = data + pos + 4, *body = data + pos + 8;
+        if (chunkLen > len - pos - 12) return PACKET_UNREADABLE;
+        if (!memcmp(type, "IEND", 4)) return NO_PACKET;
+        if (!memcmp(type, "iTXt", 4) && chunkLen > sizeof(pngXMP) + 2 && !memcmp(body, pngXMP, sizeof(pngXMP))) {
+            // keyword\0 compression-flag compression-method language\0 translated-keyword\0 text
+            const unsigned char *p = body + sizeof(pngXMP), *end = body + chunkLen;
+            if (p[0] != 0) return PACKET_UNREADABLE; // compressed; leave that to the toolkit
+            p += 2;
+            p = (const unsigned char *)memchr(p, 0, end - p);
+            if (!p) return PACKET_UNREADABLE;
+            p = (const unsigned char *)memchr(p + 1, 0, end - p - 1);
+            if (!p) return PACKET_UNREADABLE;
+            p += 1;
+            out.main = (const char *)p;
+            out.mainLen = end - p;
+            return PACKET_FOUND;
+        }
+        pos += chunkLen + 12;
+    }
+    return PACKET_UNREADABLE; // truncated before IEND
+}
+
+static PacketSearch findInTIFF(const unsigned char *data, size_t len, XMPPacket& out) {
+    bool big = data[0] == 'M';
+    auto u16 = big ? be16 : le16;
+    auto u32 = big ? be32 : le32;
+    if (u16(data + 2) == 43) return PACKET_UNREADABLE; // BigTIFF, which the toolkit handles
+    if (u16(data + 2) != 42) return NOT_A_CONTAINER;
+    size_t ifd = u32(data + 4);
+    if (ifd < 8 || ifd + 2 > len) return PACKET_UNREADABLE;
+    size_t count = u16(data + ifd);
+    if (ifd + 2 + count * 12 > len) return PACKET_UNREADABLE;
+    for(size_t i=0; i<count; i+=1) {
+        const unsigned char *entry = data + ifd + 2 + i * 12;
+        unsigned tag = u16(entry);
+        if (tag < 700) continue;
+        if (tag > 700) return NO_PACKET; // entries are sorted by tag
+        unsigned type = u16(entry + 2);
+        if (type != 1 && type != 7) return PACKET_UNREADABLE;
+        size_t n = u32(entry + 4);
+        size_t offset = n <= 4 ? (size_t)(entry + 8 - data) : u32(entry + 8);
+        if (offset > len || n > len - offset) return PACKET_UNREADABLE;
+        out.main = (const char *)data + offset;
+        out.mainLen = n;
+        return PACKET_FOUND;
+    }
+    return NO_PACKET;
+}
+
+PacketSearch locateXMPPacket(const unsigned char *data, size_t len, XMPPacket& out) {
+    out = XMPPacket();
+    if (len >= 4 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF)
+        return findInJPEG(data, len, out);
+    if (len >= 8 && !memcmp(data, "\x89PNG\r\n\x1A\n", 8))
+        return findInPNG(data, len, out);
+    if (len >= 8 && (!memcmp(data, "II", 2) || !memcmp(data, "MM", 2)))
+        return findInTIFF(data, len, out);
+    return NOT_A_CONTAINER;
+}
+
+bool findXMPPacket(const unsigned char *data, size_t len, XMPPacket& out) {
+    return locateXMPPacket(data, len, out) == PACKET_FOUND;
+}
+
+bool MappedFile::open(const char *fileName) {
+    int fd = ::open(fileName, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) { close(fd); return false; }
+    void *map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+    madvise(map, st.st_size, MADV_RANDOM);
+    this->data = (const unsigned char *)map;
+    this->size = st.st_size;
+    return true;
+}
+
+MappedFile::~MappedFile() {
+    if (this->data) munmap((void *)this->data, this->size);
+}
+
+} // namespace fhmwg
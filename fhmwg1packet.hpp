@@ -0,0 +1,54 @@
+#pragma once
+#include <string>
+#include <cstddef>
+
+namespace fhmwg {
+
+/**
+ * The XMP found in an image container: a view of the main packet, plus
+ * the reassembled JPEG ExtendedXMP packet if the main packet refers to one.
+ */
+struct XMPPacket {
+    const char *main = 0;
+    size_t mainLen = 0;
+    std::string extended;
+};
+
+/** What locateXMPPacket found */
+enum PacketSearch {
+    /** The packet is in the XMPPacket */
+    PACKET_FOUND,
+    /** A JPEG, PNG or TIFF image that has no XMP */
+    NO_PACKET,
+    /**
+     * A JPEG, PNG or TIFF image whose XMP, if any, is where the locator
+     * cannot read it: compressed, in a BigTIFF, or past damage
+     */
+    PACKET_UNREADABLE,
+    /** Not a JPEG, PNG or TIFF image */
+    NOT_A_CONTAINER
+};
+
+/**
+ * Locates the XMP packet by walking only the container structure of a
+ * JPEG (APP1 and ExtendedXMP segments), PNG (uncompressed iTXt) or TIFF
+ * (tag 700 of the first IFD) image.
+ */
+PacketSearch locateXMPPacket(const unsigned char *data, size_t len, XMPPacket& out);
+
+/** True if locateXMPPacket found the packet; callers fall back to SXMPFiles if not */
+bool findXMPPacket(const unsigned char *data, size_t len, XMPPacket& out);
+
+/**
+ * A read-only memory map of a whole file. Access is advised as random so
+ * that only the pages actually touched are read from disk.
+ */
+class MappedFile {
+public:
+    const unsigned char *data = 0;
+    size_t size = 0;
+    bool open(const char *fileName);
+    ~MappedFile();
+};
+
+} // namespace fhmwg
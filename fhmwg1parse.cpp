@@ -1,47 +1,20 @@
 #include "fhmwg1ds.hpp"
-#include <cctype>
+#include "fhmwg1packet.hpp"
+#include "fhmwg1text.hpp"
+#include "fhmwg1sax.hpp"
+#include "fhmwg1path.hpp"
+#include "fhmwg1stats.hpp"
+#include <sys/stat.h>
 #include <cmath>
+#include <stdexcept>
 
 #define TXMP_STRING_TYPE	std::string
 #define XMP_INCLUDE_XMPFILES 1
 #include <XMP.hpp>
 #include <XMP.incl_cpp>
 
-
 namespace fhmwg {
 
-/**
- * Edits a char* in place to whitespace normalize it: that is, strips
- * leading and trailing whitespace and collapses each other substring 
- * of whitespace with a single space character.
- * 
- * Returns the new length of the string.
- */
-static size_t whitespaceNormalize(char *s) {
-    size_t r = 0, w = 0;
-    bool was = true;
-    while(s[r]) {
-        bool is = std::isspace(s[r]);
-        if (is && !was) s[w++] = ' ';
-        else if (!is) s[w++] = s[r];
-        was = is;
-        r += 1;
-    }
-    s[w] = 0;
-    while(w > 0 && std::isspace(s[w-1]))
-        s[--w] = 0;
-    return w;
-}
-
-/**
- * Edits a std::string in place to whitespace normalize it: that is,
- * strips leading and trailing whitespace and collapses each other
- * substring of whitespace with a single space character.
- */
-static void whitespaceNormalize(std::string& s) {
-    s.resize(whitespaceNormalize(&s[0]));
-}
-
 namespace ns {
     std::string dc, Iptc4xmpExt, mwg_coll, photoshop, rdf, exif, xml, xmp;
     const char *_dc = "http://purl.org/dc/elements/1.1/",
@@ -69,123 +42,113 @@ namespace ns {
         || SXMPMeta::RegisterNamespace(_xml, "xml", &xml);
         SXMPMeta::GetNamespacePrefix(_xmp, &xmp)
         || SXMPMeta::RegisterNamespace(_xmp, "xmp", &xmp);
+        path::init();
     }
 }
 
 
 /**
- * helper for LangString
+ * Per-thread buffers for values on their way from the toolkit, which
+ * only returns std::string, into the model's allocator
  */
-static void getArrayItemQuntifier(SXMPMeta xmpMeta,
-XMP_StringPtr   schemaNS,
-XMP_StringPtr   arrayName,
-XMP_Index       itemIndex,
-XMP_StringPtr   qualNS,
-XMP_StringPtr   qualName,
-std::string    *qualValue,
-XMP_OptionBits *options) {
-    std::string arrayPath;
-    SXMPUtils::ComposeArrayItemPath(schemaNS, arrayName, itemIndex, &arrayPath);
-    xmpMeta.GetQualifier(schemaNS, arrayPath.c_str(), qualNS, qualName, qualValue, options);
-}
+static thread_local std::string textBuf, langBuf, itemBuf;
 
-AltLang getAltLang(SXMPMeta xmp, const char *iri, const char *prop, bool normalize=false) {
-    AltLang ans;
-    LangStr tmp;
+AltLang getAltLang(SXMPMeta xmp, const char *iri, const char *prop, const Alloc& a, Whitespace normalize=KEEP_SPACES) {
+    AltLang ans(a);
     XMP_OptionBits opt;
-    if (!xmp.GetProperty(iri, prop, &tmp.text, &opt)) return ans;
+    if (!xmp.GetProperty(iri, prop, &textBuf, &opt)) return ans;
     if (!(opt & kXMP_PropArrayIsAltText)) { // error, wrong type
-        if (tmp.text.size() > 0) { // recoverable
+        if (textBuf.size() > 0) { // recoverable
+            LangStr& tmp = ans.entries.emplace_back();
+            tmp.text = textBuf;
             if (opt & kXMP_PropHasLang) {
-                xmp.GetQualifier(iri, prop, ns::_xml, "xml:lang", &tmp.lang, 0);
+                xmp.GetQualifier(iri, prop, ns::_xml, "xml:lang", &langBuf, 0);
+                tmp.lang = langBuf;
             } else tmp.lang = "x-default";
-            if (normalize) whitespaceNormalize(tmp.text);
-            ans.entries.push_back(tmp);
+            whitespaceNormalize(tmp.text, normalize);
         }
     } else { // AltLang
+        // `prop` may already live in the caller's path buffer
         XMP_Index num = xmp.CountArrayItems(iri, prop);
+        ans.entries.reserve(num);
         for(int i=0; i<num; i+=1) {
-            xmp.GetArrayItem(iri, prop, i+1, &tmp.text, &opt);
-            getArrayItemQuntifier(xmp, iri, prop, i+1, ns::_xml, "xml:lang", &tmp.lang, 0);
-            if (normalize) whitespaceNormalize(tmp.text);
-            ans.entries.push_back(tmp);
+            itemBuf.assign(prop);
+            appendIndex(itemBuf, i+1);
+            xmp.GetProperty(iri, itemBuf.c_str(), &textBuf, &opt);
+            xmp.GetQualifier(iri, itemBuf.c_str(), ns::_xml, "xml:lang", &langBuf, 0);
+            LangStr& tmp = ans.entries.emplace_back();
+            tmp.text = textBuf;
+            tmp.lang = langBuf;
+            whitespaceNormalize(tmp.text, normalize);
         }
     }
     return ans;
 }
 
-std::string getLineText(SXMPMeta xmp, const char *iri, const char *prop) {
-    std::string ans;
-    xmp.GetProperty(iri, prop, &ans, 0);
-    return ans;
+/** Fills `out` with a simple property's value, leaving it unchanged if absent */
+void getLineText(SXMPMeta xmp, const char *iri, const char *prop, Text& out) {
+    if (xmp.GetProperty(iri, prop, &textBuf, 0)) out = textBuf;
 }
 
-std::vector<IRI> getIDs(SXMPMeta xmp, const char *iri, const char *prop) {
-    std::vector<IRI> ans;
-    IRI tmp;
+Vec<IRI> getIDs(SXMPMeta xmp, const char *iri, const char *prop, const Alloc& a, Whitespace ws) {
+    Vec<IRI> ans(a);
     XMP_OptionBits opt;
-    if (!xmp.GetProperty(iri, prop, &tmp, &opt)) return ans;
+    if (!xmp.GetProperty(iri, prop, &textBuf, &opt)) return ans;
     if (opt & kXMP_PropArrayIsAltText) return ans;
     if (opt & kXMP_PropValueIsArray || opt & kXMP_PropArrayIsOrdered || opt & kXMP_PropArrayIsAlternate) {
         XMP_Index num = xmp.CountArrayItems(iri, prop);
+        ans.reserve(num);
         for(int i=0; i<num; i+=1) {
-            xmp.GetArrayItem(iri, prop, i+1, &tmp, &opt);
-            whitespaceNormalize(tmp);
-            ans.push_back(tmp);
+            xmp.GetArrayItem(iri, prop, i+1, &textBuf, &opt);
+            IRI& tmp = ans.emplace_back(textBuf);
+            whitespaceNormalize(tmp, ws);
         }
     } else {
-        whitespaceNormalize(tmp);
-        ans.push_back(tmp);
+        IRI& tmp = ans.emplace_back(textBuf);
+        whitespaceNormalize(tmp, ws);
     }
     return ans;
 }
 
-std::vector<Location> getLocations(SXMPMeta xmp) {
-    std::vector<Location> ans;
+void getLocations(SXMPMeta xmp, Whitespace ws, Vec<Location>& ans) {
+    Alloc a = ans.get_allocator();
+    std::string prop;
     XMP_Index num = xmp.CountArrayItems(ns::_iptc, "LocationShown");
+    ans.reserve(num);
     for(int i=0; i<num; i+=1) {
-        Location tmp;
+        Location& tmp = ans.emplace_back();
 
-        std::string cell, prop;
-        SXMPUtils::ComposeArrayItemPath(ns::_iptc, "LocationShown", i+1, &cell);
-        SXMPUtils::ComposeStructFieldPath(ns::_iptc, cell.c_str(), ns::_iptc, "LocationName", &prop);
-        tmp.name = getAltLang(xmp, ns::_iptc, prop.c_str());
+        tmp.name = getAltLang(xmp, ns::_iptc, path::locationName(prop, i+1), a);
         if (tmp.name.entries.size() == 0) {
             // assemble a name from other parts
-            LangStr built;
+            LangStr built(a);
             built.lang = "x-default";
             
-            SXMPUtils::ComposeStructFieldPath(ns::_iptc, cell.c_str(), ns::_iptc, "Sublocation", &prop);
-            AltLang sub = getAltLang(xmp, ns::_iptc, prop.c_str());
+            AltLang sub = getAltLang(xmp, ns::_iptc, path::sublocation(prop, i+1), a);
             if (sub.entries.size() > 0) built.text = sub.entries[0].text;
             
-            SXMPUtils::ComposeStructFieldPath(ns::_iptc, cell.c_str(), ns::_iptc, "City", &prop);
-            AltLang city = getAltLang(xmp, ns::_iptc, prop.c_str());
+            AltLang city = getAltLang(xmp, ns::_iptc, path::city(prop, i+1), a);
             if (city.entries.size() > 0) {
                 if (built.text.size() > 0) built.text += ", ";
                 built.text += city.entries[0].text;
             }
             
-            SXMPUtils::ComposeStructFieldPath(ns::_iptc, cell.c_str(), ns::_iptc, "ProvinceState", &prop);
-            AltLang state = getAltLang(xmp, ns::_iptc, prop.c_str());
+            AltLang state = getAltLang(xmp, ns::_iptc, path::provinceState(prop, i+1), a);
             if (state.entries.size() > 0) {
                 if (built.text.size() > 0) built.text += ", ";
                 built.text += state.entries[0].text;
             }
 
-            SXMPUtils::ComposeStructFieldPath(ns::_iptc, cell.c_str(), ns::_iptc, "CountryName", &prop);
-            AltLang country = getAltLang(xmp, ns::_iptc, prop.c_str());
+            AltLang country = getAltLang(xmp, ns::_iptc, path::countryName(prop, i+1), a);
             if (country.entries.size() == 0) {
-                SXMPUtils::ComposeStructFieldPath(ns::_iptc, cell.c_str(), ns::_iptc, "CountryCode", &prop);
-                country = getAltLang(xmp, ns::_iptc, prop.c_str());
+                country = getAltLang(xmp, ns::_iptc, path::countryCode(prop, i+1), a);
             }
             if (country.entries.size() > 0) {
                 if (built.text.size() > 0) built.text += ", ";
                 built.text += country.entries[0].text;
             }
             
-            SXMPUtils::ComposeStructFieldPath(ns::_iptc, cell.c_str(), ns::_iptc, "WorldRegion", &prop);
-            AltLang region = getAltLang(xmp, ns::_iptc, prop.c_str());
+            AltLang region = getAltLang(xmp, ns::_iptc, path::worldRegion(prop, i+1), a);
             if (region.entries.size() > 0) {
                 if (built.text.size() > 0) built.text += ", ";
                 built.text += region.entries[0].text;
@@ -195,152 +158,119 @@ std::vector<Location> getLocations(SXMPMeta xmp) {
                 tmp.name.entries.push_back(built);
         }
         
-        SXMPUtils::ComposeStructFieldPath(ns::_iptc, cell.c_str(), ns::_exif, "GPSLatitude", &prop);
-        if (!xmp.GetProperty_Float(ns::_iptc, prop.c_str(), &tmp.lat, 0)) tmp.lat = NAN;
-        SXMPUtils::ComposeStructFieldPath(ns::_iptc, cell.c_str(), ns::_exif, "GPSLongitutde", &prop);
-        if (!xmp.GetProperty_Float(ns::_iptc, prop.c_str(), &tmp.lon, 0)) tmp.lon = NAN;
-        
-        SXMPUtils::ComposeStructFieldPath(ns::_iptc, cell.c_str(), ns::_exif, "LocationId", &prop);
-        tmp.ids = getIDs(xmp, ns::_iptc, prop.c_str());
+        if (!xmp.GetProperty_Float(ns::_iptc, path::latitude(prop, i+1), &tmp.lat, 0)) tmp.lat = NAN;
+        if (!xmp.GetProperty_Float(ns::_iptc, path::longitude(prop, i+1), &tmp.lon, 0)) tmp.lon = NAN;
         
-        ans.push_back(tmp);
+        tmp.ids = getIDs(xmp, ns::_iptc, path::locationId(prop, i+1), a, ws);
     }
-    return ans;
 }
 
-std::vector<Album> getAlbums(SXMPMeta xmp) {
-    std::vector<Album> ans;
+void getAlbums(SXMPMeta xmp, Vec<Album>& ans) {
+    std::string prop;
     XMP_Index num = xmp.CountArrayItems(ns::_mwg, "Collections");
     for(int i=0; i<num; i+=1) {
-        Album tmp;
-
-        std::string cell, prop;
-        SXMPUtils::ComposeArrayItemPath(ns::_mwg, "Collections", i+1, &cell);
-        SXMPUtils::ComposeStructFieldPath(ns::_mwg, cell.c_str(), ns::_mwg, "CollectionName", &prop);
-        xmp.GetProperty(ns::_mwg, prop.c_str(), &tmp.name, 0);
-        SXMPUtils::ComposeStructFieldPath(ns::_mwg, cell.c_str(), ns::_mwg, "CollectionURI", &prop);
-        xmp.GetProperty(ns::_mwg, prop.c_str(), &tmp.id, 0);
+        Album& tmp = ans.emplace_back();
+
+        getLineText(xmp, ns::_mwg, path::collectionName(prop, i+1), tmp.name);
+        getLineText(xmp, ns::_mwg, path::collectionURI(prop, i+1), tmp.id);
         
-        if (tmp.name.size() > 0 || tmp.id.size() > 0)
-            ans.push_back(tmp);
+        if (tmp.name.size() == 0 && tmp.id.size() == 0)
+            ans.pop_back();
     }
-    return ans;
 }
 
-/** Given path to a PersonInImageWDetails, add those people to out */
-static void processPeople(SXMPMeta xmp, const char *piiwd, const Region& region, std::vector<Person>& out) {
-    XMP_Index num = xmp.CountArrayItems(ns::_iptc, piiwd);
+/**
+ * Path templates for the people and objects of the root (`cell` 0) or
+ * of ImageRegion[cell], with the item index filled in last.
+ */
+static const char *groupPath(std::string& out, const PathTemplate& t, int cell, int i = 0) {
+    return cell ? t(out, cell, i) : t(out, i);
+}
+
+/** Given a group's PersonInImageWDetails, add those people to out */
+static void processPeople(SXMPMeta xmp, const path::Group& g, int cell, const Region& region, Whitespace ws, Vec<Person>& out) {
+    Alloc a = out.get_allocator();
+    std::string prop;
+    XMP_Index num = xmp.CountArrayItems(ns::_iptc, groupPath(prop, g.detailed, cell));
     for(int i=0; i<num; i+=1) {
-        Person tmp;
+        Person& tmp = out.emplace_back();
         tmp.region = region;
         
-        std::string cell, prop;
-        SXMPUtils::ComposeArrayItemPath(ns::_iptc, piiwd, i+1, &cell);
-        SXMPUtils::ComposeStructFieldPath(ns::_mwg, cell.c_str(), ns::_iptc, "PersonName", &prop);
-        tmp.name = getAltLang(xmp, ns::_iptc, prop.c_str(), true);
-        SXMPUtils::ComposeStructFieldPath(ns::_mwg, cell.c_str(), ns::_iptc, "PersonDescription", &prop);
-        tmp.description = getAltLang(xmp, ns::_iptc, prop.c_str());
-        SXMPUtils::ComposeStructFieldPath(ns::_mwg, cell.c_str(), ns::_iptc, "PersonId", &prop);
-        tmp.ids = getIDs(xmp, ns::_iptc, prop.c_str());
-        
-        out.push_back(tmp);
+        tmp.name = getAltLang(xmp, ns::_iptc, groupPath(prop, g.personName, cell, i+1), a, ws);
+        tmp.description = getAltLang(xmp, ns::_iptc, groupPath(prop, g.personDescription, cell, i+1), a);
+        tmp.ids = getIDs(xmp, ns::_iptc, groupPath(prop, g.personId, cell, i+1), a, ws);
     }
 }
 
-/** Given path to a PersonInImage, add those people to out */
-static void processSimplePeople(SXMPMeta xmp, const char *pii, const Region& region, std::vector<Person>& out) {
-    XMP_Index num = xmp.CountArrayItems(ns::_iptc, pii);
+/** Given a group's PersonInImage, add those people to out */
+static void processSimplePeople(SXMPMeta xmp, const path::Group& g, int cell, const Region& region, Whitespace ws, Vec<Person>& out) {
+    Alloc a = out.get_allocator();
+    std::string prop;
+    XMP_Index num = xmp.CountArrayItems(ns::_iptc, groupPath(prop, g.simple, cell));
     for(int i=0; i<num; i+=1) {
-        Person tmp;
+        Person& tmp = out.emplace_back();
         tmp.region = region;
         
-        std::string prop;
-        SXMPUtils::ComposeArrayItemPath(ns::_iptc, pii, i+1, &prop);
-        tmp.name = getAltLang(xmp, ns::_iptc, prop.c_str(), true);
-        
-        out.push_back(tmp);
+        tmp.name = getAltLang(xmp, ns::_iptc, groupPath(prop, g.simpleItem, cell, i+1), a, ws);
     }
 }
 
-/** Given path to a ArtworkOrObject, add those objects to out */
-static void processObjects(SXMPMeta xmp, const char *aoo, const Region& region, std::vector<Object>& out) {
-    XMP_Index num = xmp.CountArrayItems(ns::_iptc, aoo);
+/** Given a group's ArtworkOrObject, add those objects to out */
+static void processObjects(SXMPMeta xmp, const path::Group& g, int cell, const Region& region, Vec<Object>& out) {
+    Alloc a = out.get_allocator();
+    std::string prop;
+    XMP_Index num = xmp.CountArrayItems(ns::_iptc, groupPath(prop, g.objects, cell));
     for(int i=0; i<num; i+=1) {
-        Object tmp;
+        Object& tmp = out.emplace_back();
         tmp.region = region;
         
-        std::string cell, prop;
-        SXMPUtils::ComposeArrayItemPath(ns::_iptc, aoo, i+1, &cell);
-        SXMPUtils::ComposeStructFieldPath(ns::_mwg, cell.c_str(), ns::_iptc, "AOTitle", &prop);
-        tmp.title = getAltLang(xmp, ns::_iptc, prop.c_str());
-        
-        out.push_back(tmp);
+        tmp.title = getAltLang(xmp, ns::_iptc, groupPath(prop, g.objectTitle, cell, i+1), a);
     }
 }
 
-static Region getRegionOf(SXMPMeta xmp, const char *cell) {
-    Region ans; ans.type = Region::Types::NONE;
-    std::string thing, item, val;
-    SXMPUtils::ComposeStructFieldPath(ns::_iptc, cell, ns::_iptc, "RegionBoundary", &thing);
-    SXMPUtils::ComposeStructFieldPath(ns::_iptc, thing.c_str(), ns::_iptc, "rbUnit", &item);
-    xmp.GetProperty(ns::_iptc, item.c_str(), &val, 0);
+static Region getRegionOf(SXMPMeta xmp, int cell, const Alloc& a) {
+    Region ans(a); ans.type = Region::Types::NONE;
+    std::string item, &val = textBuf;
+    val.clear();
+    xmp.GetProperty(ns::_iptc, path::rbUnit(item, cell), &val, 0);
     if (val != "relative") return ans; // Future Feature: add pixel-to-relative conversion
-    SXMPUtils::ComposeStructFieldPath(ns::_iptc, thing.c_str(), ns::_iptc, "rbShape", &item);
-    xmp.GetProperty(ns::_iptc, item.c_str(), &val, 0);
+    xmp.GetProperty(ns::_iptc, path::rbShape(item, cell), &val, 0);
     if (val == "circle") {
         ans.type = Region::Types::CIRCLE;
-        SXMPUtils::ComposeStructFieldPath(ns::_iptc, thing.c_str(), ns::_iptc, "rbX", &item);
-        xmp.GetProperty_Float(ns::_iptc, item.c_str(), &ans.circ.x, 0);
-        SXMPUtils::ComposeStructFieldPath(ns::_iptc, thing.c_str(), ns::_iptc, "rbY", &item);
-        xmp.GetProperty_Float(ns::_iptc, item.c_str(), &ans.circ.y, 0);
-        SXMPUtils::ComposeStructFieldPath(ns::_iptc, thing.c_str(), ns::_iptc, "rbRx", &item);
-        xmp.GetProperty_Float(ns::_iptc, item.c_str(), &ans.circ.rx, 0);
+        xmp.GetProperty_Float(ns::_iptc, path::rbX(item, cell), &ans.circ.x, 0);
+        xmp.GetProperty_Float(ns::_iptc, path::rbY(item, cell), &ans.circ.y, 0);
+        xmp.GetProperty_Float(ns::_iptc, path::rbRx(item, cell), &ans.circ.rx, 0);
     } else if (val == "rectangle") {
         ans.type = Region::Types::RECTANGLE;
-        SXMPUtils::ComposeStructFieldPath(ns::_iptc, thing.c_str(), ns::_iptc, "rbX", &item);
-        xmp.GetProperty_Float(ns::_iptc, item.c_str(), &ans.rect.x, 0);
-        SXMPUtils::ComposeStructFieldPath(ns::_iptc, thing.c_str(), ns::_iptc, "rbY", &item);
-        xmp.GetProperty_Float(ns::_iptc, item.c_str(), &ans.rect.y, 0);
-        SXMPUtils::ComposeStructFieldPath(ns::_iptc, thing.c_str(), ns::_iptc, "rbW", &item);
-        xmp.GetProperty_Float(ns::_iptc, item.c_str(), &ans.rect.w, 0);
-        SXMPUtils::ComposeStructFieldPath(ns::_iptc, thing.c_str(), ns::_iptc, "rbH", &item);
-        xmp.GetProperty_Float(ns::_iptc, item.c_str(), &ans.rect.h, 0);
+        xmp.GetProperty_Float(ns::_iptc, path::rbX(item, cell), &ans.rect.x, 0);
+        xmp.GetProperty_Float(ns::_iptc, path::rbY(item, cell), &ans.rect.y, 0);
+        xmp.GetProperty_Float(ns::_iptc, path::rbW(item, cell), &ans.rect.w, 0);
+        xmp.GetProperty_Float(ns::_iptc, path::rbH(item, cell), &ans.rect.h, 0);
         if (ans.rect.w == 0 && ans.rect.h == 0 && ans.rect.w == 1 && ans.rect.h == 1)
             ans.type = Region::Types::NONE;
     } else if (val == "polygon") {
         ans.type = Region::Types::POLYGON;
-        SXMPUtils::ComposeStructFieldPath(ns::_iptc, thing.c_str(), ns::_iptc, "rbVertices", &item);
-        XMP_Index num = xmp.CountArrayItems(ns::_iptc, item.c_str());
+        XMP_Index num = xmp.CountArrayItems(ns::_iptc, path::rbVertices(item, cell));
         for(int i=0; i<num; i+=1) {
-            std::string vert, num;
-            double x,y;
-            SXMPUtils::ComposeArrayItemPath(ns::_iptc, item.c_str(), i+1, &vert);
-            SXMPUtils::ComposeStructFieldPath(ns::_iptc, vert.c_str(), ns::_iptc, "rbX", &num);
-            xmp.GetProperty_Float(ns::_iptc, num.c_str(), &x, 0);
-            SXMPUtils::ComposeStructFieldPath(ns::_iptc, vert.c_str(), ns::_iptc, "rbY", &num);
-            xmp.GetProperty_Float(ns::_iptc, num.c_str(), &y, 0);
+            double x = 0, y = 0;
+            xmp.GetProperty_Float(ns::_iptc, path::vertexX(item, cell, i+1), &x, 0);
+            xmp.GetProperty_Float(ns::_iptc, path::vertexY(item, cell, i+1), &y, 0);
             ans.pts.push_back(std::pair<double,double>(x,y));
         }
     }
     return ans;
 }
 
-void ImageMetadata::parseFile(const char *fileName) {
-	bool ok;
-
-	SXMPMeta  xmpMeta;	
-	SXMPFiles xmpFile;
-	XMP_FileFormat format;
-	XMP_OptionBits openFlags, handlerFlags;
-	XMP_PacketInfo xmpPacket;
-	
-	xmpFile.OpenFile ( fileName, kXMP_UnknownFile, kXMPFiles_OpenForRead );
-	ok = xmpFile.GetFileInfo ( 0, &openFlags, &format, &handlerFlags );
-	if ( ! ok ) return;
-
-	ok = xmpFile.GetXMP ( &xmpMeta, 0, &xmpPacket );
-	if ( ! ok ) return;
-    
+#ifdef FHMWG_SERIAL_XMP
+std::mutex xmpLock;
+#endif
+
+/**
+ * Fills the `fields` of `md` from an already-parsed XMP data model,
+ * normalizing the whitespace in names and IDs as `ws` says. The
+ * properties of other fields are not looked up at all.
+ */
+void extract(ImageMetadata& md, SXMPMeta& xmpMeta, Whitespace ws, unsigned fields) {
 #ifdef DUMP_EVERYTHING   
     SXMPIterator it = SXMPIterator(xmpMeta, 0, 0, 0);
     std::string sna, path, val; XMP_OptionBits opt;
@@ -352,61 +282,173 @@ void ImageMetadata::parseFile(const char *fileName) {
 
     // first the simple ones: values or AltLang text directly in root
 
-    this->title = getAltLang(xmpMeta, ns::_dc, "title", true);
-    if (this->title.entries.size() == 0)
-        this->title = getAltLang(xmpMeta, ns::_ph, "Headline", true);
+    Alloc a = md.get_allocator();
+    if (fields & FIELD_TITLE) {
+        md.title = getAltLang(xmpMeta, ns::_dc, "title", a, ws);
+        if (md.title.entries.size() == 0)
+            md.title = getAltLang(xmpMeta, ns::_ph, "Headline", a, ws);
+    }
     
-    this->caption = getAltLang(xmpMeta, ns::_dc, "description");
+    if (fields & FIELD_CAPTION)
+        md.caption = getAltLang(xmpMeta, ns::_dc, "description", a);
     // no XMP defaults if missing
     
-    this->event = getAltLang(xmpMeta, ns::_iptc, "Event");
+    if (fields & FIELD_EVENT)
+        md.event = getAltLang(xmpMeta, ns::_iptc, "Event", a);
     // no XMP defaults if missing
 
-    this->date = getLineText(xmpMeta, ns::_ph, "DateCreated");
-    if (this->date.size() == 0)
-        this->date = getLineText(xmpMeta, ns::_exif, "DateTimeOriginal");
-    if (this->date.size() == 0)
-        this->date = getLineText(xmpMeta, ns::_dc, "date");
-    if (this->date.size() == 0)
-        this->date = getLineText(xmpMeta, ns::_exif, "DateTimeDigitized");
-    if (this->date.size() == 0)
-        this->date = getLineText(xmpMeta, ns::_xmp, "CreateDate");
-    if (this->date.size() == 0)
-        this->date = getLineText(xmpMeta, ns::_exif, "DateTime");
-    if (this->date.size() == 0)
-        this->date = getLineText(xmpMeta, ns::_xmp, "ModifyDate");
-    if (this->date.size() == 0)
-        this->date = getLineText(xmpMeta, ns::_xmp, "MetadataDate");
+    if (fields & FIELD_DATE) {
+        getLineText(xmpMeta, ns::_ph, "DateCreated", md.date);
+        if (md.date.size() == 0)
+            getLineText(xmpMeta, ns::_exif, "DateTimeOriginal", md.date);
+        if (md.date.size() == 0)
+            getLineText(xmpMeta, ns::_dc, "date", md.date);
+        if (md.date.size() == 0)
+            getLineText(xmpMeta, ns::_exif, "DateTimeDigitized", md.date);
+        if (md.date.size() == 0)
+            getLineText(xmpMeta, ns::_xmp, "CreateDate", md.date);
+        if (md.date.size() == 0)
+            getLineText(xmpMeta, ns::_exif, "DateTime", md.date);
+        if (md.date.size() == 0)
+            getLineText(xmpMeta, ns::_xmp, "ModifyDate", md.date);
+        if (md.date.size() == 0)
+            getLineText(xmpMeta, ns::_xmp, "MetadataDate", md.date);
+    }
 
     // then the medium complexity: structs directly in root
 
-    this->locations = getLocations(xmpMeta);
-    this->albums = getAlbums(xmpMeta);
+    if (fields & FIELD_LOCATIONS) getLocations(xmpMeta, ws, md.locations);
+    if (fields & FIELD_ALBUMS) getAlbums(xmpMeta, md.albums);
     
     // then the complex ones: regioned data
+    bool people = fields & FIELD_PEOPLE, objects = fields & FIELD_OBJECTS;
+    if (!people && !objects) return;
     // first those not covered by FHMWG: those not inside any region
-    Region region; region.type = Region::Types::NONE;
-    processPeople(xmpMeta, "PersonInImageWDetails", region, this->people);
-    processSimplePeople(xmpMeta, "PersonInImage", region, this->people);
-    processObjects(xmpMeta, "ArtworkOrObject", region, this->objects);
+    Region region(a); region.type = Region::Types::NONE;
+    if (people) {
+        processPeople(xmpMeta, path::root, 0, region, ws, md.people);
+        processSimplePeople(xmpMeta, path::root, 0, region, ws, md.people);
+    }
+    if (objects) processObjects(xmpMeta, path::root, 0, region, md.objects);
     // then those inside regions
     XMP_Index regions = xmpMeta.CountArrayItems(ns::_iptc, "ImageRegion");
     for(int i=0; i<regions; i+=1) {
-        std::string cell, path;
-        SXMPUtils::ComposeArrayItemPath(ns::_iptc, "ImageRegion", i+1, &cell);
-        region = getRegionOf(xmpMeta, cell.c_str());
-
-        SXMPUtils::ComposeStructFieldPath(ns::_iptc, cell.c_str(), ns::_iptc, "PersonInImageWDetails", &path);
-        processPeople(xmpMeta, path.c_str(), region, this->people);
-        SXMPUtils::ComposeStructFieldPath(ns::_iptc, cell.c_str(), ns::_iptc, "PersonInImage", &path);
-        processSimplePeople(xmpMeta, path.c_str(), region, this->people);
-        SXMPUtils::ComposeStructFieldPath(ns::_iptc, cell.c_str(), ns::_iptc, "ArtworkOrObject", &path);
-        processObjects(xmpMeta, path.c_str(), region, this->objects);
+        region = getRegionOf(xmpMeta, i+1, a);
+        if (people) {
+            processPeople(xmpMeta, path::inRegion, i+1, region, ws, md.people);
+            processSimplePeople(xmpMeta, path::inRegion, i+1, region, ws, md.people);
+        }
+        if (objects) processObjects(xmpMeta, path::inRegion, i+1, region, md.objects);
+    }
+}
+
+static Whitespace spaces(const ParseOptions& opts) {
+    return opts.unicodeSpaces ? UNICODE_SPACES : ASCII_SPACES;
+}
+
+void ImageMetadata::parsePacket(const char *packet, size_t len,
+    const char *extended, size_t extendedLen, const ParseOptions& opts) {
+    if (opts.stats) {
+        opts.stats->packetBytes += len + extendedLen;
+        if (!opts.stats->bytes) opts.stats->bytes = len + extendedLen;
+    }
+    // UTF-16 and UTF-32 packets are left to the toolkit
+    if (opts.streaming && !(len >= 2 && (packet[0] == 0 || packet[1] == 0))) {
+        {
+            PhaseTimer t(opts.stats, PHASE_EXTRACT);
+            streamPacket(*this, packet, len, extended, extendedLen, spaces(opts), opts.fields);
+        }
+        keepLanguages(opts.languages);
+        if (opts.stats) opts.stats->measure(*this);
+        return;
+    }
+#ifdef FHMWG_SERIAL_XMP
+    std::lock_guard<std::mutex> serial(xmpLock);
+#endif
+    PhaseTimer t(opts.stats, PHASE_GETXMP);
+    SXMPMeta xmpMeta;
+    xmpMeta.ParseFromBuffer(packet, len);
+    if (extended) {
+        SXMPMeta more;
+        more.ParseFromBuffer(extended, extendedLen);
+        SXMPUtils::MergeFromJPEG(&xmpMeta, more);
+    }
+    t.stop();
+    {
+        PhaseTimer t(opts.stats, PHASE_EXTRACT);
+        extract(*this, xmpMeta, spaces(opts), opts.fields);
+    }
+    keepLanguages(opts.languages);
+    if (opts.stats) opts.stats->measure(*this);
+}
+
+void ImageMetadata::parseBuffer(const void *data, size_t len, const ParseOptions& opts) {
+    XMPPacket packet;
+    switch(locateXMPPacket((const unsigned char *)data, len, packet)) {
+        case PACKET_FOUND: {
+            const char *ext = packet.extended.size() > 0 ? packet.extended.data() : 0;
+            parsePacket(packet.main, packet.mainLen, ext, packet.extended.size(), opts);
+            break;
+        }
+        case NO_PACKET:
+            if (opts.stats) opts.stats->bytes = len;
+            break; // nothing to extract
+        case PACKET_UNREADABLE:
+            throw std::runtime_error("the image's XMP is compressed, in a BigTIFF, or past damage, and cannot be read from memory");
+        case NOT_A_CONTAINER:
+            parsePacket((const char *)data, len, 0, 0, opts);
+            break;
     }
-    
-	xmpFile.CloseFile();
 }
 
+void ImageMetadata::parseFile(const char *fileName, const ParseOptions& opts) {
+    if (opts.packetOnly || opts.streaming) {
+        PhaseTimer t(opts.stats, PHASE_OPEN);
+        MappedFile file;
+        XMPPacket packet;
+        if (file.open(fileName) && findXMPPacket(file.data, file.size, packet)) {
+            t.stop();
+            if (opts.stats) opts.stats->bytes = file.size;
+            bool ext = packet.extended.size() > 0;
+            parsePacket(packet.main, packet.mainLen,
+                ext ? packet.extended.data() : 0, packet.extended.size(), opts);
+            return;
+        }
+    }
+#ifdef FHMWG_SERIAL_XMP
+    std::lock_guard<std::mutex> serial(xmpLock);
+#endif
+	SXMPMeta  xmpMeta;
+    bool ok;
+    SXMPFiles xmpFile;
+    XMP_FileFormat format;
+    XMP_OptionBits openFlags, handlerFlags;
+    XMP_PacketInfo xmpPacket;
+
+    PhaseTimer open(opts.stats, PHASE_OPEN);
+    xmpFile.OpenFile ( fileName, kXMP_UnknownFile, kXMPFiles_OpenForRead );
+    ok = xmpFile.GetFileInfo ( 0, &openFlags, &format, &handlerFlags );
+    if ( ! ok ) return;
+    open.stop();
+
+    PhaseTimer get(opts.stats, PHASE_GETXMP);
+    ok = xmpFile.GetXMP ( &xmpMeta, 0, &xmpPacket );
+    if ( ! ok ) return;
+    xmpFile.CloseFile();
+    get.stop();
+
+    {
+        PhaseTimer t(opts.stats, PHASE_EXTRACT);
+        extract(*this, xmpMeta, spaces(opts), opts.fields);
+    }
+    keepLanguages(opts.languages);
+    if (opts.stats) {
+        struct stat st;
+        if (stat(fileName, &st) == 0) opts.stats->bytes = st.st_size;
+        opts.stats->packetBytes += xmpPacket.length;
+        opts.stats->measure(*this);
+    }
+}
 
 
 } // namespace fhmwg
@@ -0,0 +1,454 @@
+#include "fhmwg1patch.hpp"
+#include "fhmwg1text.hpp"
+#include <charconv>
+#include <cstdio>
+#include <cmath>
+
+namespace fhmwg {
+
+/** Objects and arrays nested deeper than this are refused, so that skip() cannot exhaust the stack */
+static const int maxDepth = 256;
+
+JSONError::JSONError(size_t offset, const std::string& what)
+    : std::runtime_error("byte " + std::to_string(offset) + ": " + what), offset(offset) {}
+
+/** Skips whitespace and returns the next character, without reading it */
+char JSONReader::next() {
+    while(this->at < this->text.size()) {
+        char c = this->text[this->at];
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r') return c;
+        this->at += 1;
+    }
+    fail("unexpected end of input");
+}
+
+char JSONReader::peek() {
+    char c = next();
+    switch(c) {
+        case '{': case '[': case '"': return c;
+        case 'n': case 't': case 'f': {
+            std::string_view word = c == 'n' ? "null" : c == 't' ? "true" : "false";
+            if (this->text.substr(this->at, word.size()) == word) return c;
+            break;
+        }
+        case '-': return '0';
+    }
+    if (c >= '0' && c <= '9') return '0';
+    if (c >= ' ' && c < 0x7f) fail(std::string("unexpected '") + c + "'");
+    char hex[8];
+    snprintf(hex, sizeof(hex), "0x%02x", (unsigned char)c);
+    fail(std::string("unexpected byte ") + hex);
+}
+
+/** Fails saying `what` was expected, and what was found instead */
+void JSONReader::unexpected(const char *what) {
+    const char *found = "";
+    switch(peek()) {
+        case '{': found = "an object"; break;
+        case '[': found = "an array"; break;
+        case '"': found = "a string"; break;
+        case '0': found = "a number"; break;
+        case 'n': found = "null"; break;
+        default: found = "a boolean"; break;
+    }
+    fail(std::string("expected ") + what + ", found " + found);
+}
+
+bool JSONReader::null() {
+    if (peek() != 'n') return false;
+    literal("null");
+    return true;
+}
+
+/** Reads past `word`, which peek() has found next */
+void JSONReader::literal(std::string_view word) {
+    this->at += word.size();
+}
+
+void JSONReader::open(char c, const char *what) {
+    if (peek() != c) unexpected(what);
+    if (this->depth == maxDepth) fail("nested too deeply");
+    this->at += 1;
+    this->depth += 1;
+    this->first = true;
+}
+
+void JSONReader::beginObject(const char *what) {
+    open('{', what);
+}
+
+void JSONReader::beginArray(const char *what) {
+    open('[', what);
+}
+
+bool JSONReader::key(std::string_view& k) {
+    char c = next();
+    if (c == '}') {
+        this->at += 1;
+        this->depth -= 1;
+        this->first = false;
+        return false;
+    }
+    if (!this->first) {
+        if (c != ',') fail("expected ',' or '}'");
+        this->at += 1;
+        c = next();
+    }
+    this->first = false;
+    if (c != '"') fail("expected a key");
+    k = quoted();
+    if (next() != ':') fail("expected ':'");
+    this->at += 1;
+    return true;
+}
+
+bool JSONReader::item() {
+    char c = next();
+    if (c == ']') {
+        this->at += 1;
+        this->depth -= 1;
+        this->first = false;
+        return false;
+    }
+    if (!this->first) {
+        if (c != ',') fail("expected ',' or ']'");
+        this->at += 1;
+    }
+    this->first = false;
+    return true;
+}
+
+std::string_view JSONReader::string(const char *what) {
+    if (peek() != '"') unexpected(what);
+    return quoted();
+}
+
+/** Reads the string starting at the quotation mark under `at` */
+std::string_view JSONReader::quoted() {
+    this->at += 1;
+    size_t from = this->at;
+    bool copied = false;
+    for(;;) {
+        size_t safe = jsonSafeSpan(this->text.data() + this->at, this->text.size() - this->at);
+        checkUTF8(this->at, this->at + safe);
+        if (copied) this->scratch.append(this->text.data() + this->at, safe);
+        this->at += safe;
+        if (this->at == this->text.size()) fail("unterminated string");
+        char c = this->text[this->at];
+        if (c == '"') break;
+        if (c != '\\') fail("control character in string");
+        if (!copied) {
+            this->scratch.assign(this->text.data() + from, this->at - from);
+            copied = true;
+        }
+        escape();
+    }
+    this->at += 1;
+    if (copied) return this->scratch;
+    return this->text.substr(from, this->at - 1 - from);
+}
+
+/** Appends the character of the escape under `at` to `scratch` */
+void JSONReader::escape() {
+    const char *p = this->text.data() + this->at;
+    size_t left = this->text.size() - this->at;
+    if (left < 2) fail("unterminated string");
+    switch(p[1]) {
+        case '"': case '\\': case '/': this->scratch.push_back(p[1]); this->at += 2; return;
+        case 'b': this->scratch.push_back('\b'); this->at += 2; return;
+        case 'f': this->scratch.push_back('\f'); this->at += 2; return;
+        case 'n': this->scratch.push_back('\n'); this->at += 2; return;
+        case 'r': this->scratch.push_back('\r'); this->at += 2; return;
+        case 't': this->scratch.push_back('\t'); this->at += 2; return;
+        case 'u': break;
+        default: fail("invalid escape");
+    }
+    auto hex4 = [&](size_t i) {
+        unsigned v = 0;
+        if (left < i + 6 || p[i] != '\\' || p[i+1] != 'u') fail("invalid escape");
+        for(size_t j = i + 2; j < i + 6; j += 1) {
+            char c = p[j];
+            int d = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+            if (d < 0) fail("invalid escape");
+            v = v * 16 + d;
+        }
+        return v;
+    };
+    unsigned cp = hex4(0);
+    size_t len = 6;
+    if (cp >= 0xDC00 && cp <= 0xDFFF) fail("unpaired surrogate in escape");
+    if (cp >= 0xD800 && cp <= 0xDBFF) {
+        if (left < 8 || p[6] != '\\' || p[7] != 'u') fail("unpaired surrogate in escape");
+        unsigned low = hex4(6);
+        if (low < 0xDC00 || low > 0xDFFF) fail("unpaired surrogate in escape");
+        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+        len = 12;
+    }
+    if (cp < 0x80) this->scratch.push_back(cp);
+    else if (cp < 0x800) {
+        this->scratch.push_back(0xC0 | (cp >> 6));
+        this->scratch.push_back(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        this->scratch.push_back(0xE0 | (cp >> 12));
+        this->scratch.push_back(0x80 | ((cp >> 6) & 0x3F));
+        this->scratch.push_back(0x80 | (cp & 0x3F));
+    } else {
+        this->scratch.push_back(0xF0 | (cp >> 18));
+        this->scratch.push_back(0x80 | ((cp >> 12) & 0x3F));
+        this->scratch.push_back(0x80 | ((cp >> 6) & 0x3F));
+        this->scratch.push_back(0x80 | (cp & 0x3F));
+    }
+    this->at += len;
+}
+
+/** Fails, at the offending byte, unless the bytes from `from` to `to` are UTF-8 */
+void JSONReader::checkUTF8(size_t from, size_t to) const {
+    const unsigned char *s = (const unsigned char *)this->text.data();
+    size_t i = from;
+    while(i < to) {
+        unsigned char c = s[i];
+        if (c < 0x80) { i += 1; continue; }
+        size_t len = c >= 0xC2 && c <= 0xDF ? 2 : c >= 0xE0 && c <= 0xEF ? 3 : c >= 0xF0 && c <= 0xF4 ? 4 : 0;
+        // the second byte's range rules out overlong forms, surrogates and code points past U+10FFFF
+        unsigned char lo = c == 0xE0 ? 0xA0 : c == 0xF0 ? 0x90 : 0x80;
+        unsigned char hi = c == 0xED ? 0x9F : c == 0xF4 ? 0x8F : 0xBF;
+        bool ok = len > 0 && i + len <= to && s[i+1] >= lo && s[i+1] <= hi;
+        for(size_t j = 2; ok && j < len; j += 1) ok = s[i+j] >= 0x80 && s[i+j] <= 0xBF;
+        if (!ok) throw JSONError(i, "invalid UTF-8 in string");
+        i += len;
+    }
+}
+
+double JSONReader::number(const char *what) {
+    if (peek() != '0') unexpected(what);
+    const char *s = this->text.data(), *end = s + this->text.size();
+    const char *p = s + this->at;
+    // from_chars is laxer than JSON, so check the grammar first
+    auto digits = [&]() {
+        const char *d = p;
+        while(p < end && *p >= '0' && *p <= '9') p += 1;
+        return p > d;
+    };
+    if (*p == '-') p += 1;
+    if (p < end && *p == '0') p += 1;
+    else if (!digits()) fail("invalid number");
+    if (p < end && *p == '.') {
+        p += 1;
+        if (!digits()) fail("invalid number");
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p += 1;
+        if (p < end && (*p == '+' || *p == '-')) p += 1;
+        if (!digits()) fail("invalid number");
+    }
+    double v;
+    auto got = std::from_chars(s + this->at, p, v);
+    if (got.ec != std::errc() || got.ptr != p) fail("number out of range");
+    this->at = p - s;
+    return v;
+}
+
+void JSONReader::skip() {
+    std::string_view k;
+    switch(peek()) {
+        case '{': beginObject(); while(key(k)) skip(); break;
+        case '[': beginArray(); while(item()) skip(); break;
+        case '"': quoted(); break;
+        case '0': number(); break;
+        case 'n': literal("null"); break;
+        case 't': literal("true"); break;
+        case 'f': literal("false"); break;
+    }
+}
+
+void JSONReader::end() {
+    while(this->at < this->text.size()) {
+        char c = this->text[this->at];
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r') fail("unexpected text after the JSON value");
+        this->at += 1;
+    }
+}
+
+
+namespace {
+
+/** Reads null, a string (for "x-default"), or an object mapping language tags to strings */
+void readAltLang(JSONReader& in, AltLang& out) {
+    out.entries.clear();
+    if (in.null()) return;
+    if (in.peek() == '"') {
+        LangStr& x = out.entries.emplace_back();
+        x.lang = "x-default";
+        x.text = in.string();
+        return;
+    }
+    in.beginObject("a string or an object of language tags to strings");
+    std::string_view lang;
+    while(in.key(lang)) {
+        LangStr& x = out.entries.emplace_back();
+        x.lang = lang;
+        x.text = in.string();
+    }
+}
+
+/** Reads null or an array of strings */
+void readIds(JSONReader& in, Vec<IRI>& out) {
+    out.clear();
+    if (in.null()) return;
+    in.beginArray("an array of strings");
+    while(in.item()) out.emplace_back(in.string());
+}
+
+/** Reads an object of numbers, which must have all of `names`, into `values` */
+template<size_t N>
+void readNumbers(JSONReader& in, const char *shape, const char *const (&names)[N], double *values) {
+    bool seen[N] = {};
+    in.beginObject();
+    std::string_view k;
+    while(in.key(k)) {
+        size_t i = 0;
+        while(i < N && k != names[i]) i += 1;
+        if (i == N) in.skip();
+        else {
+            values[i] = in.number();
+            seen[i] = true;
+        }
+    }
+    for(size_t i = 0; i < N; i += 1) {
+        if (!seen[i]) in.fail(std::string(shape) + " has no \"" + names[i] + "\"");
+    }
+}
+
+/** Reads the value of a "circle", "rectangle" or "polygon" key */
+void readRegion(JSONReader& in, std::string_view shape, Region& out) {
+    static const char *const circle[] = {"x", "y", "rx"};
+    static const char *const rectangle[] = {"x", "y", "w", "h"};
+    static const char *const vertex[] = {"x", "y"};
+    if (out.type != Region::Types::NONE) in.fail("more than one of circle, rectangle and polygon");
+    if (shape == "circle") {
+        double v[3];
+        readNumbers(in, "circle", circle, v);
+        out.type = Region::Types::CIRCLE;
+        out.circ = {v[0], v[1], v[2]};
+    } else if (shape == "rectangle") {
+        double v[4];
+        readNumbers(in, "rectangle", rectangle, v);
+        out.type = Region::Types::RECTANGLE;
+        out.rect = {v[0], v[1], v[2], v[3]};
+    } else {
+        in.beginArray("an array of vertices");
+        while(in.item()) {
+            double v[2];
+            readNumbers(in, "vertex", vertex, v);
+            out.pts.emplace_back(v[0], v[1]);
+        }
+        out.type = Region::Types::POLYGON;
+    }
+}
+
+bool isShape(std::string_view k) {
+    return k == "circle" || k == "rectangle" || k == "polygon";
+}
+
+void readAlbum(JSONReader& in, Album& out) {
+    in.beginObject();
+    std::string_view k;
+    while(in.key(k)) {
+        Text *into = k == "name" ? &out.name : k == "id" ? &out.id : 0;
+        if (!into) in.skip();
+        else if (!in.null()) *into = in.string();
+    }
+}
+
+void readLocation(JSONReader& in, Location& out) {
+    out.lat = out.lon = NAN;
+    in.beginObject();
+    std::string_view k;
+    while(in.key(k)) {
+        if (k == "name") readAltLang(in, out.name);
+        else if (k == "ids") readIds(in, out.ids);
+        else if (k == "latitude" || k == "longitude") {
+            double& into = k == "latitude" ? out.lat : out.lon;
+            if (!in.null()) into = in.number();
+        }
+        else in.skip();
+    }
+}
+
+void readPerson(JSONReader& in, Person& out) {
+    in.beginObject();
+    std::string_view k;
+    while(in.key(k)) {
+        if (k == "name") readAltLang(in, out.name);
+        else if (k == "description") readAltLang(in, out.description);
+        else if (k == "ids") readIds(in, out.ids);
+        else if (isShape(k)) readRegion(in, k, out.region);
+        else in.skip();
+    }
+}
+
+void readObject(JSONReader& in, Object& out) {
+    in.beginObject();
+    std::string_view k;
+    while(in.key(k)) {
+        if (k == "title") readAltLang(in, out.title);
+        else if (isShape(k)) readRegion(in, k, out.region);
+        else in.skip();
+    }
+}
+
+/** Reads null or an array of objects into `out`, one by one with `readOne` */
+template<class T>
+void readList(JSONReader& in, Vec<T>& out, void (*readOne)(JSONReader&, T&)) {
+    out.clear();
+    if (in.null()) return;
+    in.beginArray("an array of objects");
+    while(in.item()) readOne(in, out.emplace_back());
+}
+
+} // anonymous namespace
+
+const char *Patch::key(Field f) {
+    for(int i = 0; i < FIELDS; i += 1) {
+        if (f == 1 << i) return fieldKey(i);
+    }
+    return "";
+}
+
+void Patch::read(JSONReader& in) {
+    this->given = 0;
+    this->md.reset();
+    in.beginObject("an object of the fields to edit");
+    std::string_view k;
+    while(in.key(k)) {
+        int i = 0;
+        while(i < FIELDS && k != fieldKey(i)) i += 1;
+        if (i == FIELDS) {
+            in.skip();
+            continue;
+        }
+        Field f = Field(1 << i);
+        this->given |= f;
+        switch(f) {
+            case TITLE: readAltLang(in, this->md.title); break;
+            case CAPTION: readAltLang(in, this->md.caption); break;
+            case EVENT: readAltLang(in, this->md.event); break;
+            case DATE:
+                this->md.date.clear();
+                if (!in.null()) this->md.date = in.string();
+                break;
+            case ALBUMS: readList(in, this->md.albums, readAlbum); break;
+            case LOCATIONS: readList(in, this->md.locations, readLocation); break;
+            case PEOPLE: readList(in, this->md.people, readPerson); break;
+            case OBJECTS: readList(in, this->md.objects, readObject); break;
+        }
+    }
+}
+
+void Patch::parse(std::string_view text) {
+    JSONReader in(text);
+    read(in);
+    in.end();
+}
+
+} // namespace fhmwg
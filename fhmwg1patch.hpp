@@ -0,0 +1,118 @@
+#pragma once
+#include "fhmwg1ds.hpp"
+#include <string>
+#include <string_view>
+#include <stdexcept>
+
+namespace fhmwg {
+
+/** Malformed JSON, or JSON of the wrong shape; what() starts with the byte offset */
+class JSONError : public std::runtime_error {
+public:
+    JSONError(size_t offset, const std::string& what);
+    /** Where in the text the problem was found, counting from 0 */
+    size_t offset;
+};
+
+/**
+ * Reads JSON text one value at a time without building a document: the
+ * caller asks for the value it expects next, and gets it or a JSONError.
+ *
+ * An object is read as
+ *
+ *     in.beginObject();
+ *     std::string_view key;
+ *     while (in.key(key)) { ... read or skip() the value ... }
+ *
+ * and an array as `in.beginArray(); while (in.item()) { ... }`.
+ * Strings are returned as views of the text, or of a buffer in the reader
+ * if they had escapes, so are only good until the next key() or string().
+ */
+class JSONReader {
+public:
+    explicit JSONReader(std::string_view text) : text(text) {}
+
+    /**
+     * The kind of the next value, without reading it: '{', '[', '"',
+     * '0' for a number, 'n' for null, 't' or 'f' for a boolean
+     */
+    char peek();
+    /** Reads a null if that is next; false, reading nothing, otherwise */
+    bool null();
+    /** Starts reading an object, or fails saying `what` was expected */
+    void beginObject(const char *what = "an object");
+    /** Reads the next key of the object and its colon; false once the object ends */
+    bool key(std::string_view& k);
+    /** Starts reading an array, or fails saying `what` was expected */
+    void beginArray(const char *what = "an array");
+    /** True if the array has another item to read; false once it ends */
+    bool item();
+    std::string_view string(const char *what = "a string");
+    double number(const char *what = "a number");
+    /** Reads past the next value, whatever it is */
+    void skip();
+    /** Fails unless only whitespace is left */
+    void end();
+
+    size_t offset() const { return this->at; }
+    [[noreturn]] void fail(const std::string& what) const { throw JSONError(this->at, what); }
+
+private:
+    std::string_view text;
+    size_t at = 0;
+    /** No key or item of the innermost object or array has been read yet */
+    bool first = false;
+    int depth = 0;
+    std::string scratch;
+
+    char next();
+    void open(char c, const char *what);
+    [[noreturn]] void unexpected(const char *what);
+    std::string_view quoted();
+    void escape();
+    void checkUTF8(size_t from, size_t to) const;
+    void literal(std::string_view word);
+};
+
+/**
+ * An edit for the writer, read from JSON of the shape parser prints.
+ *
+ * The new values are kept in an ImageMetadata, and `given` says which of
+ * its fields the edit replaces: a key missing from the JSON leaves that
+ * field alone, while one that is present but null or empty removes it.
+ */
+struct Patch {
+    enum Field {
+        TITLE = FIELD_TITLE,
+        CAPTION = FIELD_CAPTION,
+        EVENT = FIELD_EVENT,
+        DATE = FIELD_DATE,
+        ALBUMS = FIELD_ALBUMS,
+        LOCATIONS = FIELD_LOCATIONS,
+        PEOPLE = FIELD_PEOPLE,
+        OBJECTS = FIELD_OBJECTS,
+    };
+    /** How many Fields there are; field `i` is `Field(1 << i)` */
+    static const int FIELDS = FIELD_COUNT;
+    /** The JSON key of `f` */
+    static const char *key(Field f);
+
+    /** The Fields the edit replaces, or'ed together */
+    unsigned given = 0;
+    ImageMetadata md;
+    bool has(Field f) const { return this->given & f; }
+
+    /**
+     * Replaces the patch with the JSON object `in` reads next. Keys the
+     * writer does not know are skipped. Throws JSONError if the object is
+     * malformed or a value has the wrong type.
+     */
+    void read(JSONReader& in);
+    /** Replaces the patch with the JSON object that is all of `text` */
+    void parse(std::string_view text);
+
+    typedef Alloc allocator_type;
+    explicit Patch(const Alloc& a = {}) : md(a) {}
+};
+
+} // namespace fhmwg
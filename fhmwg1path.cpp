@@ -0,0 +1,100 @@
+#include "fhmwg1path.hpp"
+#include "fhmwg1ds.hpp"
+#include <charconv>
+
+namespace fhmwg {
+
+PathTemplate PathTemplate::field(const std::string& prefix, const char *name) const {
+    PathTemplate ans = *this;
+    ans.parts.back() += '/';
+    ans.parts.back() += prefix;
+    ans.parts.back() += name;
+    return ans;
+}
+
+PathTemplate PathTemplate::item() const {
+    PathTemplate ans = *this;
+    ans.parts.push_back(std::string());
+    return ans;
+}
+
+const char *appendIndex(std::string& out, int index) {
+    char digits[16];
+    char *end = std::to_chars(digits, digits + sizeof(digits), index).ptr;
+    out += '[';
+    out.append(digits, end - digits);
+    out += ']';
+    return out.c_str();
+}
+
+const char *PathTemplate::operator()(std::string& out, int i, int j, int k) const {
+    const int idx[] = {i, j, k};
+    out.assign(this->parts[0]);
+    for(size_t n=1; n<this->parts.size(); n+=1) {
+        appendIndex(out, idx[n-1]);
+        out += this->parts[n];
+    }
+    return out.c_str();
+}
+
+namespace path {
+    PathTemplate locationName, sublocation, city, provinceState, countryName,
+        countryCode, worldRegion, latitude, longitude, locationId;
+    PathTemplate collectionName, collectionURI;
+    PathTemplate region, boundary, rbUnit, rbShape, rbX, rbY, rbW, rbH, rbRx,
+        rbVertices, vertex, vertexX, vertexY;
+    Group root, inRegion;
+
+    static Group groupAt(const PathTemplate& base, bool top) {
+        const std::string& iptc = ns::Iptc4xmpExt;
+        Group g;
+        g.detailed = top ? PathTemplate("PersonInImageWDetails") : base.field(iptc, "PersonInImageWDetails");
+        g.personName = g.detailed.item().field(iptc, "PersonName");
+        g.personDescription = g.detailed.item().field(iptc, "PersonDescription");
+        g.personId = g.detailed.item().field(iptc, "PersonId");
+        g.simple = top ? PathTemplate("PersonInImage") : base.field(iptc, "PersonInImage");
+        g.simpleItem = g.simple.item();
+        g.objects = top ? PathTemplate("ArtworkOrObject") : base.field(iptc, "ArtworkOrObject");
+        g.objectTitle = g.objects.item().field(iptc, "AOTitle");
+        return g;
+    }
+
+    void init() {
+        const std::string& iptc = ns::Iptc4xmpExt;
+
+        PathTemplate loc = PathTemplate("LocationShown").item();
+        locationName = loc.field(iptc, "LocationName");
+        sublocation = loc.field(iptc, "Sublocation");
+        city = loc.field(iptc, "City");
+        provinceState = loc.field(iptc, "ProvinceState");
+        countryName = loc.field(iptc, "CountryName");
+        countryCode = loc.field(iptc, "CountryCode");
+        worldRegion = loc.field(iptc, "WorldRegion");
+        latitude = loc.field(ns::exif, "GPSLatitude");
+        longitude = loc.field(ns::exif, "GPSLongitude");
+        locationId = loc.field(iptc, "LocationId");
+
+        PathTemplate album = PathTemplate("Collections").item();
+        collectionName = album.field(ns::mwg_coll, "CollectionName");
+        collectionURI = album.field(ns::mwg_coll, "CollectionURI");
+
+        region = PathTemplate("ImageRegion").item();
+        boundary = region.field(iptc, "RegionBoundary");
+        rbUnit = boundary.field(iptc, "rbUnit");
+        rbShape = boundary.field(iptc, "rbShape");
+        rbX = boundary.field(iptc, "rbX");
+        rbY = boundary.field(iptc, "rbY");
+        rbW = boundary.field(iptc, "rbW");
+        rbH = boundary.field(iptc, "rbH");
+        rbRx = boundary.field(iptc, "rbRx");
+        rbVertices = boundary.field(iptc, "rbVertices");
+        vertex = rbVertices.item();
+        vertexX = vertex.field(iptc, "rbX");
+        vertexY = vertex.field(iptc, "rbY");
+
+        root = groupAt(PathTemplate(), true);
+        inRegion = groupAt(region, false);
+    }
+}
+
+} // namespace fhmwg
@@ -0,0 +1,58 @@
+#pragma once
+#include <string>
+#include <vector>
+
+namespace fhmwg {
+
+/**
+ * An XMP path with its array indices left open. The fixed text is
+ * composed once, from the registered namespace prefixes, so that using
+ * the path only formats its indices. Like the paths that
+ * SXMPUtils::ComposeStructFieldPath builds, the first step is unprefixed
+ * and relative to the schema namespace passed alongside the path.
+ */
+class PathTemplate {
+public:
+    PathTemplate() {}
+    explicit PathTemplate(const char *root) : parts(1, root) {}
+    /** This path followed by the field `name`; `prefix` includes its colon, as ns:: stores it */
+    PathTemplate field(const std::string& prefix, const char *name) const;
+    /** This path followed by an open array index */
+    PathTemplate item() const;
+    /**
+     * Writes the path into `out`, filling open indices in order with
+     * `i`, `j` and `k`, and returns out.c_str(). Reusing `out` across
+     * calls avoids any allocation once it has grown to size.
+     */
+    const char *operator()(std::string& out, int i = 0, int j = 0, int k = 0) const;
+private:
+    /** the fixed text before, between and after the open indices */
+    std::vector<std::string> parts;
+};
+
+/** Appends "[index]" to `out` and returns out.c_str() */
+const char *appendIndex(std::string& out, int index);
+
+/**
+ * The paths FHMWG reads and writes, made by ns::init(). Region-level
+ * paths take the ImageRegion index before any other index.
+ */
+namespace path {
+    extern PathTemplate locationName, sublocation, city, provinceState, countryName,
+        countryCode, worldRegion, latitude, longitude, locationId;
+    extern PathTemplate collectionName, collectionURI;
+    extern PathTemplate region, boundary, rbUnit, rbShape, rbX, rbY, rbW, rbH, rbRx,
+        rbVertices, vertex, vertexX, vertexY;
+
+    /** The people and objects of the root, or of one ImageRegion */
+    struct Group {
+        PathTemplate detailed, personName, personDescription, personId;
+        PathTemplate simple, simpleItem;
+        PathTemplate objects, objectTitle;
+    };
+    extern Group root, inRegion;
+
+    void init();
+}
+
+} // namespace fhmwg
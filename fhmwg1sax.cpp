@@ -0,0 +1,925 @@
+#include "fhmwg1sax.hpp"
+#include "fhmwg1text.hpp"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <cmath>
+#include <cctype>
+#include <initializer_list>
+
+#define TXMP_STRING_TYPE	std::string
+#include <XMP.hpp>
+
+namespace fhmwg {
+
+namespace {
+
+/** Namespaces the extractor cares about, interned once per declaration */
+enum NS { NS_NONE = -1, NS_OTHER = 0, NS_RDF, NS_XML, NS_DC, NS_IPTC, NS_MWG, NS_PH, NS_EXIF, NS_XMP, NS_TIFF };
+
+const char *tiffURI = "http://ns.adobe.com/tiff/1.0/";
+
+int internNS(std::string_view uri) {
+    if (uri == ns::_rdf) return NS_RDF;
+    if (uri == ns::_xml) return NS_XML;
+    if (uri == ns::_dc) return NS_DC;
+    if (uri == ns::_iptc) return NS_IPTC;
+    if (uri == ns::_mwg) return NS_MWG;
+    if (uri == ns::_ph) return NS_PH;
+    if (uri == ns::_exif) return NS_EXIF;
+    if (uri == ns::_xmp) return NS_XMP;
+    if (uri == tiffURI) return NS_TIFF;
+    return NS_OTHER;
+}
+
+/** One step of a property path: a qualified name, or an array index if `index` > 0 */
+struct Step {
+    int ns;
+    std::string_view local;
+    int index;
+    bool is(int n, const char *l) const { return ns == n && local == l; }
+};
+
+enum Kind { STRUCT, BAG, SEQ, ALT };
+
+struct Item {
+    std::string value, lang;
+    bool hasLang = false, simple = true;
+};
+
+/**
+ * What the toolkit would know about one property: enough to answer the
+ * GetProperty, CountArrayItems, GetArrayItem and xml:lang GetQualifier
+ * calls that fhmwg1parse.cpp makes of it. A container only records its
+ * own shape; its items are recorded in the structures that hold them.
+ */
+struct Node {
+    bool present = false, composite = false, array = false, alt = false;
+    bool container = false;
+    std::string value, lang;
+    bool hasLang = false;
+    std::vector<Item> items;
+    Node(bool container = false) : container(container) {}
+};
+
+struct PersonNode { Node name, description, ids; };
+struct ObjectNode { Node title; };
+struct AlbumNode { Node name, uri; };
+struct LocationNode {
+    Node name, sublocation, city, state, country, countryCode, worldRegion, lat, lon, ids;
+};
+
+/** The people and objects of the root or of one ImageRegion */
+struct Group {
+    Node detailedArr{true}, simpleArr{true}, objectsArr{true};
+    std::vector<PersonNode> detailed;
+    std::vector<Node> simple;
+    std::vector<ObjectNode> objects;
+};
+
+struct RegionNode {
+    Group group;
+    Node unit, shape, x, y, w, h, rx, verticesArr{true};
+    std::vector<std::pair<Node, Node>> vertices;
+};
+
+template<class T> T *itemAt(std::vector<T>& v, int index) {
+    if (index < 1) return 0;
+    if (v.size() < (size_t)index) v.resize(index);
+    return &v[index-1];
+}
+
+/** The toolkit's NormalizeLangValue, applied to every xml:lang it stores */
+void normalizeLang(std::string& lang) {
+    size_t i = 0, n = lang.size();
+    for(; i < n && lang[i] != '-'; i += 1) lang[i] = std::tolower(lang[i]);
+    if (i < n) i += 1;
+    size_t start = i;
+    for(; i < n && lang[i] != '-'; i += 1) lang[i] = std::tolower(lang[i]);
+    if (i == start + 2) {
+        lang[start] = std::toupper(lang[start]);
+        lang[start+1] = std::toupper(lang[start+1]);
+    }
+    for(; i < n; i += 1) lang[i] = std::tolower(lang[i]);
+}
+
+/** The toolkit's DetectAltText: an Alt of simple items that all have xml:lang */
+bool isAltText(const Node& n) {
+    if (!n.array || !n.alt || n.items.size() == 0) return false;
+    for(const Item& it : n.items) if (!it.simple || !it.hasLang) return false;
+    return true;
+}
+
+/** The items of an AltText array, x-default first as NormalizeLangArray leaves them */
+void altTextEntries(const Node& n, AltLang& ans, Whitespace normalize) {
+    size_t def = 0;
+    while(def < n.items.size() && n.items[def].lang != "x-default") def += 1;
+    for(size_t i=0; i<n.items.size(); i+=1) {
+        size_t from = i;
+        if (def < n.items.size() && def != 0) {
+            if (i == 0) from = def;
+            else if (i == def) from = 0;
+        }
+        LangStr& tmp = ans.entries.emplace_back();
+        tmp.text = n.items[from].value;
+        tmp.lang = n.items[from].lang;
+        whitespaceNormalize(tmp.text, normalize);
+    }
+}
+
+/** getAltLang from fhmwg1parse.cpp */
+AltLang altLang(const Node& n, const Alloc& a, Whitespace normalize=KEEP_SPACES) {
+    AltLang ans(a);
+    if (!n.present) return ans;
+    if (isAltText(n)) altTextEntries(n, ans, normalize);
+    else if (!n.composite && n.value.size() > 0) {
+        LangStr& tmp = ans.entries.emplace_back();
+        tmp.text = n.value;
+        tmp.lang = n.hasLang ? n.lang : "x-default";
+        whitespaceNormalize(tmp.text, normalize);
+    }
+    return ans;
+}
+
+/**
+ * getAltLang for dc:title and dc:description, which the toolkit always
+ * turns into AltText arrays (NormalizeDCArrays), after moving in any
+ * x-default alias such as photoshop:Caption (MoveExplicitAliases).
+ */
+AltLang dcAltLang(Node n, const Node& alias1, const Node& alias2, const Alloc& a, Whitespace normalize=KEEP_SPACES) {
+    for(const Node *alias : std::initializer_list<const Node *>{&alias1, &alias2}) {
+        if (!alias->present || alias->composite) continue;
+        Item def;
+        def.value = alias->value;
+        def.lang = "x-default";
+        def.hasLang = true;
+        if (!n.present) {
+            n.present = n.composite = n.array = n.alt = true;
+            n.items.push_back(def);
+        } else if (n.array) {
+            bool has = false;
+            for(const Item& it : n.items) has = has || (it.hasLang && it.lang == "x-default");
+            if (!has) n.items.insert(n.items.begin(), def);
+        }
+    }
+    AltLang ans(a);
+    if (!n.present) return ans;
+    if (!n.composite) {
+        LangStr& tmp = ans.entries.emplace_back();
+        tmp.text = n.value;
+        tmp.lang = n.hasLang ? n.lang : "x-default";
+        whitespaceNormalize(tmp.text, normalize);
+    } else if (isAltText(n)) {
+        altTextEntries(n, ans, normalize);
+    } else if (n.array) {
+        // RepairAltText: drop composite items and empty unlabeled ones, label the rest
+        for(const Item& it : n.items) {
+            if (!it.simple || (!it.hasLang && it.value.size() == 0)) continue;
+            LangStr& tmp = ans.entries.emplace_back();
+            tmp.text = it.value;
+            tmp.lang = it.hasLang ? it.lang : "x-repair";
+            whitespaceNormalize(tmp.text, normalize);
+        }
+    }
+    return ans;
+}
+
+/** getIDs from fhmwg1parse.cpp */
+Vec<IRI> ids(const Node& n, const Alloc& a, Whitespace ws) {
+    Vec<IRI> ans(a);
+    if (!n.present || isAltText(n)) return ans;
+    if (n.array) {
+        ans.reserve(n.items.size());
+        for(const Item& it : n.items) {
+            IRI& tmp = ans.emplace_back();
+            if (it.simple) tmp = it.value;
+            whitespaceNormalize(tmp, ws);
+        }
+    } else {
+        IRI& tmp = ans.emplace_back();
+        if (!n.composite) tmp = n.value;
+        whitespaceNormalize(tmp, ws);
+    }
+    return ans;
+}
+
+/** GetProperty: the value of a simple property, "" for composites */
+std::string_view text(const Node& n) {
+    return n.present && !n.composite ? std::string_view(n.value) : std::string_view();
+}
+
+/** GetProperty_Float: false if absent; throws like ConvertToFloat */
+bool number(const Node& n, double& out) {
+    if (!n.present) return false;
+    if (n.composite) throw XMP_Error(kXMPErr_BadXPath, "Property must be simple");
+    if (n.value.size() == 0) throw XMP_Error(kXMPErr_BadValue, "Empty convert-from string");
+    char *end;
+    errno = 0;
+    double ans = strtod(n.value.c_str(), &end);
+    if (errno != 0 || *end != 0) throw XMP_Error(kXMPErr_BadParam, "Invalid float string");
+    out = ans;
+    return true;
+}
+
+/** CountArrayItems of a container */
+size_t count(const Node& n, size_t items) {
+    if (!n.present) return 0;
+    if (!n.array) throw XMP_Error(kXMPErr_BadXPath, "The named property is not an array");
+    return items;
+}
+
+/**
+ * Receives property events from the RDF reader and keeps just the parts
+ * of the data model that the FHMWG subset reads.
+ */
+class Extractor {
+public:
+    /** set while reading an ExtendedXMP packet, whose properties replace earlier ones */
+    bool replacing = false;
+    /** how names and IDs are whitespace normalized */
+    Whitespace ws = ASCII_SPACES;
+    /** the FieldBits to record; properties of the others are ignored */
+    unsigned fields = ALL_FIELDS;
+
+    void begin(const Step *p, int n);
+    void kind(const Step *p, int n, Kind k);
+    void value(const Step *p, int n, const std::string& text, const std::string& lang, bool hasLang);
+    void finish(ImageMetadata& md);
+
+private:
+    Node title, headline, description, event;
+    Node photoshopTitle, photoshopCaption, tiffImageDescription;
+    Node dateCreated, dateTimeOriginal, dateTimeDigitized, createDate, exifDateTime, modifyDate, tiffDateTime, metadataDate;
+    Node locationsArr{true}, albumsArr{true}, regionsArr{true};
+    std::vector<LocationNode> locations;
+    std::vector<AlbumNode> albums;
+    std::vector<RegionNode> regions;
+    Group root;
+
+    /** `node` if `field` is wanted, else null */
+    Node *want(unsigned field, Node *node) { return this->fields & field ? node : 0; }
+    Node *locate(const Step *p, int n, int& used);
+    Node *locateGroup(Group& g, const Step *p, int n, int& used);
+    void reset(const Step& s);
+    void finishGroup(Group& g, const Region& region, ImageMetadata& md);
+    Region regionOf(RegionNode& r, const Alloc& a);
+};
+
+/**
+ * Finds the node that records the property at path `p` (or its nearest
+ * recorded ancestor), creating array items on the way. `used` is set to
+ * the number of steps the returned node accounts for.
+ */
+Node *Extractor::locate(const Step *p, int n, int& used) {
+    used = 1;
+    const Step& s = p[0];
+    switch(s.ns) {
+    case NS_DC:
+        if (s.local == "title") return want(FIELD_TITLE, &title);
+        if (s.local == "description") return want(FIELD_CAPTION, &description);
+        return 0; // dc:date is always a Seq once normalized, so never supplies a date
+    case NS_PH:
+        if (s.local == "Headline") return want(FIELD_TITLE, &headline);
+        if (s.local == "DateCreated") return want(FIELD_DATE, &dateCreated);
+        if (s.local == "Title") return want(FIELD_TITLE, &photoshopTitle);
+        if (s.local == "Caption") return want(FIELD_CAPTION, &photoshopCaption);
+        return 0;
+    case NS_EXIF:
+        if (s.local == "DateTimeOriginal") return want(FIELD_DATE, &dateTimeOriginal);
+        if (s.local == "DateTimeDigitized") return want(FIELD_DATE, &dateTimeDigitized);
+        if (s.local == "DateTime") return want(FIELD_DATE, &exifDateTime);
+        return 0;
+    case NS_XMP:
+        if (s.local == "CreateDate") return want(FIELD_DATE, &createDate);
+        if (s.local == "ModifyDate") return want(FIELD_DATE, &modifyDate);
+        if (s.local == "MetadataDate") return want(FIELD_DATE, &metadataDate);
+        return 0;
+    case NS_TIFF:
+        if (s.local == "DateTime") return want(FIELD_DATE, &tiffDateTime);
+        if (s.local == "ImageDescription") return want(FIELD_CAPTION, &tiffImageDescription);
+        return 0;
+    case NS_MWG: {
+        if (s.local != "Collections" || !(this->fields & FIELD_ALBUMS)) return 0;
+        if (n == 1) return &albumsArr;
+        AlbumNode *a = itemAt(albums, p[1].index);
+        if (!a || n == 2) return 0;
+        used = 3;
+        if (p[2].is(NS_MWG, "CollectionName")) return &a->name;
+        if (p[2].is(NS_MWG, "CollectionURI")) return &a->uri;
+        return 0;
+    }
+    case NS_IPTC:
+        if (s.local == "Event") return want(FIELD_EVENT, &event);
+        if (s.local == "LocationShown") {
+            if (!(this->fields & FIELD_LOCATIONS)) return 0;
+            if (n == 1) return &locationsArr;
+            LocationNode *l = itemAt(locations, p[1].index);
+            if (!l || n == 2) return 0;
+            used = 3;
+            const Step& f = p[2];
+            if (f.ns == NS_EXIF) {
+                if (f.local == "GPSLatitude") return &l->lat;
+                if (f.local == "GPSLongitude") return &l->lon;
+                return 0;
+            }
+            if (f.ns != NS_IPTC) return 0;
+            if (f.local == "LocationName") return &l->name;
+            if (f.local == "Sublocation") return &l->sublocation;
+            if (f.local == "City") return &l->city;
+            if (f.local == "ProvinceState") return &l->state;
+            if (f.local == "CountryName") return &l->country;
+            if (f.local == "CountryCode") return &l->countryCode;
+            if (f.local == "WorldRegion") return &l->worldRegion;
+            if (f.local == "LocationId") return &l->ids;
+            return 0;
+        }
+        if (s.local == "ImageRegion") {
+            if (!(this->fields & (FIELD_PEOPLE | FIELD_OBJECTS))) return 0;
+            if (n == 1) return &regionsArr;
+            RegionNode *r = itemAt(regions, p[1].index);
+            if (!r || n == 2) return 0;
+            if (!p[2].is(NS_IPTC, "RegionBoundary")) {
+                Node *ans = locateGroup(r->group, p+2, n-2, used);
+                used += 2;
+                return ans;
+            }
+            if (n == 3 || p[3].ns != NS_IPTC) return 0;
+            used = 4;
+            const Step& f = p[3];
+            if (f.local == "rbUnit") return &r->unit;
+            if (f.local == "rbShape") return &r->shape;
+            if (f.local == "rbX") return &r->x;
+            if (f.local == "rbY") return &r->y;
+            if (f.local == "rbW") return &r->w;
+            if (f.local == "rbH") return &r->h;
+            if (f.local == "rbRx") return &r->rx;
+            if (f.local != "rbVertices") return 0;
+            if (n == 4) return &r->verticesArr;
+            std::pair<Node, Node> *v = itemAt(r->vertices, p[4].index);
+            if (!v || n == 5) return 0;
+            used = 6;
+            if (p[5].is(NS_IPTC, "rbX")) return &v->first;
+            if (p[5].is(NS_IPTC, "rbY")) return &v->second;
+            return 0;
+        }
+        return locateGroup(this->root, p, n, used);
+    }
+    return 0;
+}
+
+Node *Extractor::locateGroup(Group& g, const Step *p, int n, int& used) {
+    used = 1;
+    if (p[0].ns != NS_IPTC) return 0;
+    if (p[0].local == "PersonInImageWDetails") {
+        if (!(this->fields & FIELD_PEOPLE)) return 0;
+        if (n == 1) return &g.detailedArr;
+        PersonNode *x = itemAt(g.detailed, p[1].index);
+        if (!x || n == 2) return 0;
+        used = 3;
+        if (p[2].is(NS_IPTC, "PersonName")) return &x->name;
+        if (p[2].is(NS_IPTC, "PersonDescription")) return &x->description;
+        if (p[2].is(NS_IPTC, "PersonId")) return &x->ids;
+        return 0;
+    }
+    if (p[0].local == "PersonInImage") {
+        if (!(this->fields & FIELD_PEOPLE)) return 0;
+        if (n == 1) return &g.simpleArr;
+        used = 2;
+        return itemAt(g.simple, p[1].index);
+    }
+    if (p[0].local == "ArtworkOrObject") {
+        if (!(this->fields & FIELD_OBJECTS)) return 0;
+        if (n == 1) return &g.objectsArr;
+        ObjectNode *x = itemAt(g.objects, p[1].index);
+        if (!x || n == 2) return 0;
+        used = 3;
+        if (p[2].is(NS_IPTC, "AOTitle")) return &x->title;
+        return 0;
+    }
+    return 0;
+}
+
+/** Forgets everything recorded under one top-level property */
+void Extractor::reset(const Step& s) {
+    if (s.is(NS_MWG, "Collections")) { albumsArr = Node(true); albums.clear(); return; }
+    if (s.is(NS_IPTC, "LocationShown")) { locationsArr = Node(true); locations.clear(); return; }
+    if (s.is(NS_IPTC, "ImageRegion")) { regionsArr = Node(true); regions.clear(); return; }
+    if (s.is(NS_IPTC, "PersonInImageWDetails")) { root.detailedArr = Node(true); root.detailed.clear(); return; }
+    if (s.is(NS_IPTC, "PersonInImage")) { root.simpleArr = Node(true); root.simple.clear(); return; }
+    if (s.is(NS_IPTC, "ArtworkOrObject")) { root.objectsArr = Node(true); root.objects.clear(); return; }
+    int used;
+    Node *node = locate(&s, 1, used);
+    if (node) *node = Node();
+}
+
+void Extractor::begin(const Step *p, int n) {
+    if (this->replacing && n == 1) reset(p[0]);
+    int used;
+    Node *node = locate(p, n, used);
+    if (!node) return;
+    if (n == used) node->present = true;
+    else if (n == used + 1 && !node->container) itemAt(node->items, p[used].index);
+}
+
+void Extractor::kind(const Step *p, int n, Kind k) {
+    int used;
+    Node *node = locate(p, n, used);
+    if (!node) return;
+    if (n == used) {
+        node->composite = true;
+        node->array = k != STRUCT;
+        node->alt = k == ALT;
+    } else if (n == used + 1 && !node->container) {
+        Item *it = itemAt(node->items, p[used].index);
+        if (it) it->simple = false;
+    }
+}
+
+void Extractor::value(const Step *p, int n, const std::string& text, const std::string& lang, bool hasLang) {
+    int used;
+    Node *node = locate(p, n, used);
+    if (!node) return;
+    if (n == used) {
+        node->value = text;
+        node->lang = lang;
+        node->hasLang = hasLang;
+    } else if (n == used + 1 && !node->container) {
+        Item *it = itemAt(node->items, p[used].index);
+        if (!it) return;
+        it->value = text;
+        it->lang = lang;
+        it->hasLang = hasLang;
+    }
+}
+
+/** getRegionOf from fhmwg1parse.cpp */
+Region Extractor::regionOf(RegionNode& r, const Alloc& a) {
+    Region ans(a); ans.type = Region::Types::NONE;
+    std::string_view val = text(r.unit);
+    if (val != "relative") return ans;
+    if (r.shape.present) val = text(r.shape);
+    if (val == "circle") {
+        ans.type = Region::Types::CIRCLE;
+        number(r.x, ans.circ.x);
+        number(r.y, ans.circ.y);
+        number(r.rx, ans.circ.rx);
+    } else if (val == "rectangle") {
+        ans.type = Region::Types::RECTANGLE;
+        number(r.x, ans.rect.x);
+        number(r.y, ans.rect.y);
+        number(r.w, ans.rect.w);
+        number(r.h, ans.rect.h);
+    } else if (val == "polygon") {
+        ans.type = Region::Types::POLYGON;
+        size_t num = count(r.verticesArr, r.vertices.size());
+        for(size_t i=0; i<num; i+=1) {
+            double x = 0, y = 0;
+            number(r.vertices[i].first, x);
+            number(r.vertices[i].second, y);
+            ans.pts.push_back(std::pair<double,double>(x,y));
+        }
+    }
+    return ans;
+}
+
+/** processPeople, processSimplePeople and processObjects from fhmwg1parse.cpp */
+void Extractor::finishGroup(Group& g, const Region& region, ImageMetadata& md) {
+    Alloc a = md.get_allocator();
+    size_t num = count(g.detailedArr, g.detailed.size());
+    for(size_t i=0; i<num; i+=1) {
+        Person& tmp = md.people.emplace_back();
+        tmp.region = region;
+        tmp.name = altLang(g.detailed[i].name, a, ws);
+        tmp.description = altLang(g.detailed[i].description, a);
+        tmp.ids = ids(g.detailed[i].ids, a, ws);
+    }
+    num = count(g.simpleArr, g.simple.size());
+    for(size_t i=0; i<num; i+=1) {
+        Person& tmp = md.people.emplace_back();
+        tmp.region = region;
+        tmp.name = altLang(g.simple[i], a, ws);
+    }
+    num = count(g.objectsArr, g.objects.size());
+    for(size_t i=0; i<num; i+=1) {
+        Object& tmp = md.objects.emplace_back();
+        tmp.region = region;
+        tmp.title = altLang(g.objects[i].title, a);
+    }
+}
+
+/** The rest of ImageMetadata::parseFile, in the same order */
+void Extractor::finish(ImageMetadata& md) {
+    Alloc a = md.get_allocator();
+    Node none;
+    md.title = dcAltLang(title, photoshopTitle, none, a, ws);
+    if (md.title.entries.size() == 0)
+        md.title = altLang(headline, a, ws);
+    md.caption = dcAltLang(description, tiffImageDescription, photoshopCaption, a);
+    md.event = altLang(event, a);
+
+    // an alias only fills in for a missing base property
+    const Node& modify = modifyDate.present ? modifyDate : tiffDateTime;
+    for(const Node *n : std::initializer_list<const Node *>{&dateCreated, &dateTimeOriginal, &dateTimeDigitized, &createDate, &exifDateTime, &modify, &metadataDate}) {
+        md.date = text(*n);
+        if (md.date.size() > 0) break;
+    }
+
+    size_t num = count(locationsArr, locations.size());
+    for(size_t i=0; i<num; i+=1) {
+        LocationNode& l = locations[i];
+        Location& tmp = md.locations.emplace_back();
+        tmp.name = altLang(l.name, a);
+        if (tmp.name.entries.size() == 0) {
+            // assemble a name from other parts
+            LangStr built(a);
+            built.lang = "x-default";
+            AltLang country = altLang(l.country, a);
+            if (country.entries.size() == 0) country = altLang(l.countryCode, a);
+            const AltLang parts[] = { altLang(l.sublocation, a), altLang(l.city, a), altLang(l.state, a), country, altLang(l.worldRegion, a) };
+            for(const AltLang& part : parts) {
+                if (part.entries.size() == 0) continue;
+                if (built.text.size() > 0) built.text += ", ";
+                built.text += part.entries[0].text;
+            }
+            if (built.text.size() > 0)
+                tmp.name.entries.push_back(built);
+        }
+        if (!number(l.lat, tmp.lat)) tmp.lat = NAN;
+        if (!number(l.lon, tmp.lon)) tmp.lon = NAN;
+        tmp.ids = ids(l.ids, a, ws);
+    }
+
+    num = count(albumsArr, albums.size());
+    for(size_t i=0; i<num; i+=1) {
+        std::string_view name = text(albums[i].name), id = text(albums[i].uri);
+        if (name.size() == 0 && id.size() == 0) continue;
+        Album& tmp = md.albums.emplace_back();
+        tmp.name = name;
+        tmp.id = id;
+    }
+
+    Region region(a); region.type = Region::Types::NONE;
+    finishGroup(root, region, md);
+    num = count(regionsArr, regions.size());
+    for(size_t i=0; i<num; i+=1) {
+        region = regionOf(regions[i], a);
+        finishGroup(regions[i].group, region, md);
+    }
+}
+
+
+/**
+ * A minimal namespace-aware XML tokenizer that interprets the RDF/XML
+ * forms XMP uses (attribute and element properties, rdf:parseType
+ * Resource, nested rdf:Description, rdf:value, rdf:resource, and
+ * Bag/Seq/Alt arrays) and reports them to an Extractor as paths.
+ */
+class RDFReader {
+public:
+    explicit RDFReader(Extractor& out) : out(out) {}
+    void parse(const char *packet, size_t len);
+
+private:
+    /** How the children of an element are to be read */
+    enum FrameKind { F_OUTER, F_RDF, F_NODE, F_PROP, F_ARRAY, F_SKIP };
+    struct Frame {
+        std::string_view qname;
+        FrameKind kind;
+        bool pops, leaf, hadChild, structPending, hasLang, hasResource;
+        int index;
+        size_t bindings;
+        std::string lang, resource;
+    };
+    struct Binding {
+        std::string_view prefix;
+        int ns;
+    };
+    struct Attr {
+        std::string_view qname;
+        std::string value;
+        int ns;
+        std::string_view local;
+    };
+
+    Extractor& out;
+    std::vector<Frame> frames;
+    size_t top = 0;
+    std::vector<Binding> bindings;
+    std::vector<Attr> attrs;
+    size_t nattrs = 0;
+    std::vector<Step> path;
+    std::string text, scratch;
+
+    [[noreturn]] void fail(const char *why) { throw XMP_Error(kXMPErr_BadXML, why); }
+    void decode(const char *s, const char *e, std::string& into, bool attribute);
+    void resolve(std::string_view qname, bool attribute, int& ns, std::string_view& local);
+    void startElement(std::string_view qname, bool empty);
+    void endElement(std::string_view qname);
+    void propertyAttributes(Frame& f);
+    void field(const Attr& a);
+    void emitValue(const std::string& value, const std::string& lang, bool hasLang) {
+        this->out.value(this->path.data(), this->path.size(), value, lang, hasLang);
+    }
+};
+
+/** Appends s..e to `into`, expanding references and normalizing line ends as an XML parser must */
+void RDFReader::decode(const char *s, const char *e, std::string& into, bool attribute) {
+    while(s < e) {
+        char c = *s;
+        if (c == '&') {
+            const char *semi = (const char *)memchr(s, ';', e - s);
+            if (!semi) fail("Unterminated entity reference");
+            std::string_view ref(s + 1, semi - s - 1);
+            if (ref == "lt") into += '<';
+            else if (ref == "gt") into += '>';
+            else if (ref == "amp") into += '&';
+            else if (ref == "quot") into += '"';
+            else if (ref == "apos") into += '\'';
+            else if (ref.size() > 1 && ref[0] == '#') {
+                unsigned long cp = ref[1] == 'x'
+                    ? strtoul(std::string(ref.substr(2)).c_str(), 0, 16)
+                    : strtoul(std::string(ref.substr(1)).c_str(), 0, 10);
+                if (cp == 0 || cp > 0x10FFFF) fail("Bad character reference");
+                if (cp < 0x80) into += (char)cp;
+                else if (cp < 0x800) { into += (char)(0xC0 | (cp >> 6)); into += (char)(0x80 | (cp & 0x3F)); }
+                else if (cp < 0x10000) { into += (char)(0xE0 | (cp >> 12)); into += (char)(0x80 | ((cp >> 6) & 0x3F)); into += (char)(0x80 | (cp & 0x3F)); }
+                else { into += (char)(0xF0 | (cp >> 18)); into += (char)(0x80 | ((cp >> 12) & 0x3F)); into += (char)(0x80 | ((cp >> 6) & 0x3F)); into += (char)(0x80 | (cp & 0x3F)); }
+            } else fail("Undefined entity");
+            s = semi + 1;
+        } else if (c == '\r') {
+            into += attribute ? ' ' : '\n';
+            s += (s + 1 < e && s[1] == '\n') ? 2 : 1;
+        } else if (attribute && (c == '\n' || c == '\t')) {
+            into += ' ';
+            s += 1;
+        } else {
+            const char *run = s;
+            while(s < e && *s != '&' && *s != '\r' && !(attribute && (*s == '\n' || *s == '\t'))) s += 1;
+            into.append(run, s - run);
+        }
+    }
+}
+
+void RDFReader::resolve(std::string_view qname, bool attribute, int& ns, std::string_view& local) {
+    size_t colon = qname.find(':');
+    std::string_view prefix = colon == std::string_view::npos ? std::string_view() : qname.substr(0, colon);
+    local = colon == std::string_view::npos ? qname : qname.substr(colon + 1);
+    if (prefix.size() == 0 && attribute) { ns = NS_NONE; return; }
+    if (prefix == "xml") { ns = NS_XML; return; }
+    for(size_t i = this->bindings.size(); i > 0; i -= 1) {
+        if (this->bindings[i-1].prefix == prefix) { ns = this->bindings[i-1].ns; return; }
+    }
+    if (prefix.size() == 0) { ns = NS_NONE; return; }
+    fail("Unbound namespace prefix");
+}
+
+/** Reports an attribute of a node element, or of a property element, as a simple field */
+void RDFReader::field(const Attr& a) {
+    this->path.push_back(Step{a.ns, a.local, 0});
+    this->out.begin(this->path.data(), this->path.size());
+    emitValue(a.value, std::string(), false);
+    this->path.pop_back();
+}
+
+void RDFReader::propertyAttributes(Frame& f) {
+    bool isStruct = false;
+    for(size_t i=0; i<this->nattrs; i+=1) {
+        const Attr& a = this->attrs[i];
+        if (a.ns == NS_NONE) continue;
+        if (a.ns == NS_XML) {
+            if (a.local == "lang") { f.lang = a.value; normalizeLang(f.lang); f.hasLang = true; }
+            continue;
+        }
+        if (a.ns == NS_RDF) {
+            if (a.local == "resource") { f.resource = a.value; f.hasResource = true; }
+            else if (a.local == "parseType") {
+                if (a.value != "Resource") throw XMP_Error(kXMPErr_BadXMP, "Unsupported rdf:parseType");
+                if (!isStruct) this->out.kind(this->path.data(), this->path.size(), STRUCT);
+                isStruct = true;
+                f.kind = F_NODE;
+                f.leaf = false;
+            }
+            continue;
+        }
+        if (!isStruct) this->out.kind(this->path.data(), this->path.size(), STRUCT);
+        isStruct = true;
+        f.kind = F_NODE; // any child elements are further fields
+        f.leaf = false;
+        field(a);
+    }
+}
+
+void RDFReader::startElement(std::string_view qname, bool empty) {
+    size_t mark = this->bindings.size();
+    // namespace declarations first, since they apply to this element's own names
+    for(size_t i=0; i<this->nattrs; i+=1) {
+        Attr& a = this->attrs[i];
+        if (a.qname == "xmlns") this->bindings.push_back(Binding{std::string_view(), internNS(a.value)});
+        else if (a.qname.substr(0, 6) == "xmlns:") this->bindings.push_back(Binding{a.qname.substr(6), internNS(a.value)});
+        else continue;
+        a.ns = NS_NONE;
+        a.local = std::string_view();
+        a.qname = std::string_view();
+    }
+    for(size_t i=0; i<this->nattrs; i+=1) {
+        Attr& a = this->attrs[i];
+        if (a.qname.size() > 0) resolve(a.qname, true, a.ns, a.local);
+    }
+    int ns;
+    std::string_view local;
+    resolve(qname, false, ns, local);
+
+    FrameKind parent = this->top > 0 ? this->frames[this->top-1].kind : F_OUTER;
+    if (this->top == this->frames.size()) this->frames.emplace_back();
+    Frame& f = this->frames[this->top++];
+    f.qname = qname;
+    f.pops = f.leaf = f.hadChild = f.structPending = f.hasLang = f.hasResource = false;
+    f.index = 0;
+    f.bindings = mark;
+    f.lang.clear();
+    f.resource.clear();
+    this->text.clear();
+
+    switch(parent) {
+    case F_OUTER:
+        f.kind = (ns == NS_RDF && local == "RDF") ? F_RDF : F_OUTER;
+        break;
+    case F_RDF:
+        f.kind = F_NODE;
+        for(size_t i=0; i<this->nattrs; i+=1) {
+            const Attr& a = this->attrs[i];
+            if (a.ns != NS_NONE && a.ns != NS_RDF && a.ns != NS_XML) field(a);
+        }
+        break;
+    case F_NODE: {
+        Frame& owner = this->frames[this->top-2];
+        if (ns == NS_RDF && local == "value") {
+            // the value of the enclosing property; sibling fields are its qualifiers
+            owner.structPending = false;
+            f.kind = F_PROP;
+            f.leaf = true;
+            propertyAttributes(f);
+            break;
+        }
+        if (owner.structPending) {
+            this->out.kind(this->path.data(), this->path.size(), STRUCT);
+            owner.structPending = false;
+        }
+        this->path.push_back(Step{ns, local, 0});
+        this->out.begin(this->path.data(), this->path.size());
+        f.kind = F_PROP;
+        f.pops = f.leaf = true;
+        propertyAttributes(f);
+        break;
+    }
+    case F_PROP: {
+        this->frames[this->top-2].hadChild = true;
+        if (ns == NS_RDF && (local == "Bag" || local == "Seq" || local == "Alt")) {
+            this->out.kind(this->path.data(), this->path.size(), local == "Bag" ? BAG : local == "Seq" ? SEQ : ALT);
+            f.kind = F_ARRAY;
+            break;
+        }
+        // a nested rdf:Description: a struct, unless it turns out to hold an rdf:value
+        f.kind = F_NODE;
+        f.structPending = true;
+        for(size_t i=0; i<this->nattrs; i+=1) {
+            const Attr& a = this->attrs[i];
+            if (a.ns == NS_NONE || a.ns == NS_RDF || a.ns == NS_XML) continue;
+            if (f.structPending) this->out.kind(this->path.data(), this->path.size(), STRUCT);
+            f.structPending = false;
+            field(a);
+        }
+        break;
+    }
+    case F_ARRAY: {
+        if (!(ns == NS_RDF && local == "li")) { f.kind = F_SKIP; break; }
+        Frame& array = this->frames[this->top-2];
+        array.index += 1;
+        this->path.push_back(Step{NS_RDF, std::string_view(), array.index});
+        this->out.begin(this->path.data(), this->path.size());
+        f.kind = F_PROP;
+        f.pops = f.leaf = true;
+        propertyAttributes(f);
+        break;
+    }
+    case F_SKIP:
+        f.kind = F_SKIP;
+        break;
+    }
+    if (empty) endElement(qname);
+}
+
+void RDFReader::endElement(std::string_view qname) {
+    if (this->top == 0) fail("Unmatched end tag");
+    Frame& f = this->frames[this->top-1];
+    if (f.qname != qname) fail("Mismatched end tag");
+    if (f.kind == F_PROP && f.leaf && !f.hadChild)
+        emitValue(f.hasResource ? f.resource : this->text, f.lang, f.hasLang);
+    if (f.pops) this->path.pop_back();
+    this->bindings.resize(f.bindings);
+    this->top -= 1;
+    this->text.clear();
+}
+
+static bool isNameEnd(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '/' || c == '>' || c == '=';
+}
+static const char *skipSpace(const char *s, const char *e) {
+    while(s < e && (*s == ' ' || *s == '\t' || *s == '\n' || *s == '\r')) s += 1;
+    return s;
+}
+
+void RDFReader::parse(const char *packet, size_t len) {
+    const char *s = packet, *e = packet + len;
+    while(s < e) {
+        if (*s != '<') {
+            const char *t = (const char *)memchr(s, '<', e - s);
+            if (!t) t = e;
+            if (this->top > 0 && this->frames[this->top-1].kind == F_PROP) decode(s, t, this->text, false);
+            s = t;
+            continue;
+        }
+        std::string_view rest(s, e - s);
+        if (rest.substr(0, 2) == "<?") {
+            size_t at = rest.find("?>");
+            if (at == std::string_view::npos) fail("Unterminated processing instruction");
+            s += at + 2;
+        } else if (rest.substr(0, 4) == "<!--") {
+            size_t at = rest.find("-->");
+            if (at == std::string_view::npos) fail("Unterminated comment");
+            s += at + 3;
+        } else if (rest.substr(0, 9) == "<![CDATA[") {
+            size_t at = rest.find("]]>");
+            if (at == std::string_view::npos) fail("Unterminated CDATA section");
+            if (this->top > 0 && this->frames[this->top-1].kind == F_PROP) this->text.append(s + 9, at - 9);
+            s += at + 3;
+        } else if (rest.substr(0, 2) == "<!") {
+            size_t at = rest.find('[') < rest.find('>') ? rest.find("]>") : rest.find('>');
+            if (at == std::string_view::npos) fail("Unterminated declaration");
+            s += at + (rest[at] == ']' ? 2 : 1);
+        } else if (rest.substr(0, 2) == "</") {
+            const char *name = s + 2, *n = name;
+            while(n < e && !isNameEnd(*n)) n += 1;
+            const char *close = skipSpace(n, e);
+            if (close >= e || *close != '>') fail("Malformed end tag");
+            endElement(std::string_view(name, n - name));
+            s = close + 1;
+        } else {
+            const char *name = s + 1, *n = name;
+            while(n < e && !isNameEnd(*n)) n += 1;
+            if (n == name) fail("Malformed start tag");
+            std::string_view qname(name, n - name);
+            this->nattrs = 0;
+            bool empty = false;
+            for(;;) {
+                n = skipSpace(n, e);
+                if (n >= e) fail("Unterminated start tag");
+                if (*n == '>') { n += 1; break; }
+                if (*n == '/') {
+                    if (n + 1 >= e || n[1] != '>') fail("Malformed start tag");
+                    n += 2;
+                    empty = true;
+                    break;
+                }
+                const char *an = n;
+                while(n < e && !isNameEnd(*n)) n += 1;
+                std::string_view aname(an, n - an);
+                n = skipSpace(n, e);
+                if (n >= e || *n != '=' || aname.size() == 0) fail("Malformed attribute");
+                n = skipSpace(n + 1, e);
+                if (n >= e || (*n != '"' && *n != '\'')) fail("Unquoted attribute value");
+                const char *close = (const char *)memchr(n + 1, *n, e - n - 1);
+                if (!close) fail("Unterminated attribute value");
+                if (this->nattrs == this->attrs.size()) this->attrs.emplace_back();
+                Attr& a = this->attrs[this->nattrs++];
+                a.qname = aname;
+                a.value.clear();
+                decode(n + 1, close, a.value, true);
+                n = close + 1;
+            }
+            startElement(qname, empty);
+            s = n;
+        }
+    }
+    if (this->top > 0) fail("Unclosed element");
+}
+
+} // anonymous namespace
+
+void streamPacket(ImageMetadata& md, const char *packet, size_t len,
+    const char *extended, size_t extendedLen, Whitespace ws, unsigned fields) {
+    Extractor ex;
+    ex.ws = ws;
+    ex.fields = fields;
+    RDFReader(ex).parse(packet, len);
+    if (extended) {
+        ex.replacing = true;
+        RDFReader(ex).parse(extended, extendedLen);
+    }
+    ex.finish(md);
+}
+
+} // namespace fhmwg
@@ -0,0 +1,27 @@
+#pragma once
+#include "fhmwg1ds.hpp"
+#include "fhmwg1text.hpp"
+#include <cstddef>
+
+namespace fhmwg {
+
+/**
+ * Fills `md` from an RDF/XML packet in a single streaming pass, without
+ * building an SXMPMeta tree. `extended`, if not null, is a JPEG
+ * ExtendedXMP packet whose top-level properties replace those of the main
+ * packet, as SXMPUtils::MergeFromJPEG would.
+ *
+ * Mirrors the toolkit's parsing rules that affect the FHMWG subset
+ * (AltText detection and x-default ordering, xml:lang normalization, the
+ * dc: array forms, and the tiff: and photoshop: aliases of the title,
+ * caption and modification date) so that the result matches
+ * ImageMetadata::parsePacket with the toolkit. Errors are thrown as
+ * XMP_Error, like the toolkit's. Names and IDs are whitespace
+ * normalized as `ws` says. Only the FieldBits in `fields` are filled in,
+ * and the properties of the others are not recorded as they stream past.
+ */
+void streamPacket(ImageMetadata& md, const char *packet, size_t len,
+    const char *extended = 0, size_t extendedLen = 0, Whitespace ws = ASCII_SPACES,
+    unsigned fields = ALL_FIELDS);
+
+} // namespace fhmwg
@@ -0,0 +1,323 @@
+#include "fhmwg1serve.hpp"
+#include "fhmwg1arena.hpp"
+#include "fhmwg1write.hpp"
+#include "fhmwg1stats.hpp"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <system_error>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <csignal>
+#include <climits>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+namespace fhmwg {
+
+namespace {
+
+/** Payloads larger than this are refused, so that a bad length cannot exhaust memory */
+const size_t maxPayload = (size_t)64 << 20;
+
+/** The limit for the verbs whose payload is at most a path */
+const size_t maxPathPayload = PATH_MAX;
+
+/** Connections being answered; serve() turns away those beyond its limit */
+std::atomic<unsigned> sessions(0);
+
+/** Buffered reading of the header lines and payloads arriving on a socket */
+class Reader {
+public:
+    explicit Reader(int fd) : fd(fd) {}
+    /** Reads through the next LF into `out`, without the LF. False at EOF, on error, or past `max` bytes. */
+    bool line(std::string& out, size_t max = 256);
+    /** Reads exactly `len` bytes into `out` */
+    bool bytes(size_t len, std::string& out);
+private:
+    int fd;
+    char buf[64 * 1024];
+    size_t at = 0, end = 0;
+    ssize_t readSome(char *into, size_t len);
+};
+
+ssize_t Reader::readSome(char *into, size_t len) {
+    for(;;) {
+        ssize_t got = read(this->fd, into, len);
+        if (got >= 0 || errno != EINTR) return got;
+    }
+}
+
+bool Reader::line(std::string& out, size_t max) {
+    out.clear();
+    for(;;) {
+        if (this->at == this->end) {
+            ssize_t got = readSome(this->buf, sizeof(this->buf));
+            if (got <= 0) return false;
+            this->at = 0;
+            this->end = got;
+        }
+        const char *from = this->buf + this->at;
+        const char *lf = (const char *)memchr(from, '\n', this->end - this->at);
+        size_t n = lf ? lf - from : this->end - this->at;
+        out.append(from, n);
+        this->at += n;
+        if (lf) { this->at += 1; return true; }
+        if (out.size() > max) return false;
+    }
+}
+
+bool Reader::bytes(size_t len, std::string& out) {
+    out.resize(len);
+    size_t have = std::min(len, this->end - this->at);
+    memcpy(&out[0], this->buf + this->at, have);
+    this->at += have;
+    // anything more goes straight into `out`, not through the buffer
+    while(have < len) {
+        ssize_t got = readSome(&out[have], len - have);
+        if (got <= 0) return false;
+        have += got;
+    }
+    return true;
+}
+
+/** Sends `head` and then `body`, however many writes that takes */
+bool sendAll(int fd, std::string_view head, std::string_view body) {
+    struct iovec iov[2] = {
+        { (void *)head.data(), head.size() },
+        { (void *)body.data(), body.size() },
+    };
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    while(iov[0].iov_len + iov[1].iov_len > 0) {
+        ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        for(struct iovec& v : iov) {
+            size_t n = std::min((size_t)sent, v.iov_len);
+            v.iov_base = (char *)v.iov_base + n;
+            v.iov_len -= n;
+            sent -= n;
+        }
+    }
+    return true;
+}
+
+/** Phase timings of every PARSE and PACKET request since the server started */
+StatsSummary served;
+
+/** Carries out one request, putting the reply's payload in `reply`. False for an ERR reply. */
+bool handle(std::string_view verb, const ParseOptions& opts, bool asGEDCOM,
+    const std::string& payload, Arena& arena, ImageMetadata& md, std::string& reply) {
+    if (verb == "PARSE" || verb == "PACKET") {
+        md.reset();
+        arena.reset();
+        FileStats stats;
+        ParseOptions timed = opts;
+        timed.stats = &stats;
+        size_t blocks = arena.heapAllocations();
+        try {
+            if (verb == "PACKET") {
+                stats.bytes = payload.size();
+                md.parseBuffer(payload.data(), payload.size(), timed);
+            }
+            else if (payload.find('\0') != std::string::npos) { reply = "path contains NUL"; return false; }
+            else md.parseFile(payload.c_str(), timed);
+        } catch (...) {
+            served.fail();
+            throw;
+        }
+        stats.allocations = arena.heapAllocations() - blocks;
+        {
+            PhaseTimer t(&stats, PHASE_SERIALIZE);
+            OutBuf o(reply);
+            if (asGEDCOM) md.dumpGEDCOM(o);
+            else { md.dumpJSON(o); o.put('\n'); }
+        }
+        served.add(stats);
+        return true;
+    }
+    if (verb == "STATS") {
+        OutBuf o(reply);
+        served.dumpJSON(o);
+        o.put('\n');
+        return true;
+    }
+    if (verb == "WRITE") {
+        size_t a = payload.find('\0');
+        size_t b = a == std::string::npos ? a : payload.find('\0', a + 1);
+        if (b == std::string::npos) { reply = "WRITE needs input path, NUL, output path, NUL, JSON"; return false; }
+        std::string from = payload.substr(0, a), to = payload.substr(a + 1, b - a - 1);
+        Patch patch;
+        patch.parse(std::string_view(payload).substr(b + 1));
+        return writeCopy(from.c_str(), to.c_str(), patch, reply);
+    }
+    reply = "unknown request ";
+    reply += verb;
+    return false;
+}
+
+/** Answers the requests on one connection until the client hangs up */
+void session(int fd, ParseOptions defaults) {
+    // declared before the model, so that it outlives it
+    Arena arena;
+    ImageMetadata md(&arena);
+    Reader in(fd);
+    std::string header, payload, reply;
+    char verb[16], flags[16];
+    while(in.line(header)) {
+        size_t len = 0;
+        int used = 0;
+        if (sscanf(header.c_str(), "%15s %15s %zu%n", verb, flags, &len, &used) != 3
+        || used != (int)header.size()
+        || len > (!strcmp(verb, "PARSE") || !strcmp(verb, "STATS") ? maxPathPayload : maxPayload)) {
+            sendAll(fd, "ERR 18\n", "bad request header");
+            break;
+        }
+        if (!in.bytes(len, payload)) break;
+
+        ParseOptions opts = defaults;
+        bool asGEDCOM = false, ok = true;
+        reply.clear();
+        for(const char *f = flags; *f && ok; f += 1) {
+            switch(*f) {
+                case '-': break;
+                case 'g': asGEDCOM = true; break;
+                case 'x': opts.packetOnly = true; break;
+                case 's': opts.streaming = true; break;
+                case 'w': opts.unicodeSpaces = true; break;
+                default: ok = false; reply = "unknown flag "; reply += *f;
+            }
+        }
+        if (ok) {
+            try {
+                ok = handle(verb, opts, asGEDCOM, payload, arena, md, reply);
+            } catch (XMP_Error ex) {
+                ok = false;
+                reply = "XMP error " + std::to_string(ex.GetID()) + ": " + ex.GetErrMsg();
+            } catch (const std::exception& ex) {
+                ok = false;
+                reply = ex.what();
+            }
+        }
+        header = (ok ? "OK " : "ERR ") + std::to_string(reply.size()) + "\n";
+        if (!sendAll(fd, header, reply)) break;
+    }
+    close(fd);
+    sessions -= 1;
+}
+
+bool address(const char *socketPath, struct sockaddr_un& addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    strcpy(addr.sun_path, socketPath);
+    return true;
+}
+
+} // anonymous namespace
+
+bool serve(const char *socketPath, const ParseOptions& defaults, unsigned maxSessions) {
+    struct sockaddr_un addr;
+    if (!address(socketPath, addr)) return false;
+
+    // replace a socket left behind by a server that died, but not a live one
+    struct stat st;
+    if (lstat(socketPath, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        int live = connectTo(socketPath);
+        if (live >= 0) {
+            close(live);
+            errno = EADDRINUSE;
+            return false;
+        }
+        unlink(socketPath);
+    }
+
+    int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (s < 0) return false;
+    // WRITE can copy any file the server can read, so only its own user may connect;
+    // the socket is created that way, as a chmod after bind would leave a window open
+    mode_t mask = umask(077);
+    int bound = bind(s, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+    if (bound < 0 || listen(s, SOMAXCONN) < 0) {
+        int e = errno;
+        close(s);
+        errno = e;
+        return false;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    for(;;) {
+        int fd = accept4(s, 0, 0, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO) continue;
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                usleep(10 * 1000); // wait for connections to close
+                continue;
+            }
+            int e = errno;
+            close(s);
+            errno = e;
+            return false;
+        }
+        if (sessions.fetch_add(1) >= maxSessions) {
+            sessions -= 1;
+            sendAll(fd, "ERR 11\n", "server busy");
+            close(fd);
+            continue;
+        }
+        try {
+            std::thread(session, fd, defaults).detach();
+        } catch (const std::system_error&) {
+            sessions -= 1;
+            close(fd); // out of threads: the client sees the hangup and can retry
+        }
+    }
+}
+
+int connectTo(const char *socketPath) {
+    struct sockaddr_un addr;
+    if (!address(socketPath, addr)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        int e = errno;
+        close(fd);
+        errno = e;
+        return -1;
+    }
+    return fd;
+}
+
+bool call(int fd, const char *verb, const char *flags, std::string_view payload, std::string& reply) {
+    char head[64];
+    snprintf(head, sizeof(head), "%s %s %zu\n", verb, flags && *flags ? flags : "-", payload.size());
+    if (!sendAll(fd, head, payload)) {
+        reply = strerror(errno);
+        return false;
+    }
+    Reader in(fd);
+    std::string line;
+    char status[4];
+    size_t len = 0;
+    int used = 0;
+    if (!in.line(line) || sscanf(line.c_str(), "%3s %zu%n", status, &len, &used) != 2
+    || used != (int)line.size() || len > maxPayload || !in.bytes(len, reply)) {
+        reply = "connection to server lost";
+        return false;
+    }
+    return !strcmp(status, "OK");
+}
+
+} // namespace fhmwg
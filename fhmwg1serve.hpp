@@ -0,0 +1,52 @@
+#pragma once
+#include "fhmwg1ds.hpp"
+#include <string>
+#include <string_view>
+
+namespace fhmwg {
+
+/**
+ * Parse-as-a-service over a Unix domain socket.
+ *
+ * Each connection carries any number of requests, answered in order.
+ * A request is a header line `VERB FLAGS LENGTH` followed by exactly
+ * LENGTH bytes of payload; a reply is `OK LENGTH` or `ERR LENGTH` and a
+ * payload, which for OK is the parser's output and for ERR a message.
+ * Payloads are limited to 64 MiB, and to PATH_MAX bytes for PARSE and
+ * STATS; a longer one ends the connection.
+ *
+ * - `PARSE`: the payload is the path of an image to parse
+ * - `PACKET`: the payload is an image file's bytes, or a bare XMP packet
+ * - `WRITE`: the payload is the input path, a NUL, the output path, a
+ *   NUL, and the JSON edits that writer reads from stdin
+ * - `STATS`: the payload is ignored; the reply is one JSON line with the
+ *   counts and per-phase latency histograms of every PARSE and PACKET
+ *   request the server has answered, as parser's --stats prints
+ *
+ * FLAGS is `-` or letters, each like the parser option of the same
+ * name: `g` (GEDCOM), `x` (packet only), `s` (streaming), `w` (Unicode
+ * spaces). They are added to the options the server was started with.
+ */
+
+/**
+ * Listens on `socketPath` and serves requests, one thread per connection,
+ * until the process is killed. The toolkit and ns::init must already be
+ * initialized. A stale socket left at `socketPath` is replaced, and the
+ * new one is made accessible to the server's user only (the umask is
+ * changed while it is created, so no other thread should create files then). Connections
+ * beyond `maxSessions` at once get `ERR server busy` and are closed.
+ * Returns false, with errno set, only if it cannot start listening.
+ */
+bool serve(const char *socketPath, const ParseOptions& defaults, unsigned maxSessions = 64);
+
+/** Connects to a server, returning the socket or -1 with errno set */
+int connectTo(const char *socketPath);
+
+/**
+ * Sends one request on `fd` and waits for its reply. Returns true for OK,
+ * with the reply's payload in `reply`; false for ERR (the message is in
+ * `reply`) or if the connection failed (`reply` says so).
+ */
+bool call(int fd, const char *verb, const char *flags, std::string_view payload, std::string& reply);
+
+} // namespace fhmwg
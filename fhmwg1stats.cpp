@@ -0,0 +1,136 @@
+#include "fhmwg1stats.hpp"
+
+namespace fhmwg {
+
+static const char *phaseNames[PHASES] = {"open", "getxmp", "extract", "serialize"};
+
+const char *phaseName(Phase p) {
+    return phaseNames[p];
+}
+
+void FileStats::measure(const ImageMetadata& md) {
+    this->people = md.people.size();
+    this->objects = md.objects.size();
+    this->regions = 0;
+    this->vertices = 0;
+    auto area = [&](const Region& r) {
+        if (r.type != Region::Types::NONE) this->regions += 1;
+        this->vertices += r.pts.size();
+    };
+    for(const Person& p : md.people) area(p.region);
+    for(const Object& o : md.objects) area(o.region);
+}
+
+uint64_t FileStats::totalNs() const {
+    uint64_t t = 0;
+    for(uint64_t ns : this->ns) t += ns;
+    return t;
+}
+
+void FileStats::dumpJSON(OutBuf& o) const {
+    char pfx = '{';
+    for(int p = 0; p < PHASES; p += 1) {
+        o.put(pfx).put('"').put(phaseNames[p]).put("_us\":").number(this->ns[p] / 1e3);
+        pfx = ',';
+    }
+    o.put(",\"bytes\":").integer(this->bytes)
+     .put(",\"packet_bytes\":").integer(this->packetBytes)
+     .put(",\"regions\":").integer(this->regions)
+     .put(",\"people\":").integer(this->people)
+     .put(",\"objects\":").integer(this->objects)
+     .put(",\"vertices\":").integer(this->vertices)
+     .put(",\"allocations\":").integer(this->allocations);
+    if (this->cached) o.put(",\"cached\":true");
+    o.put('}');
+}
+
+void Histogram::add(uint64_t ns) {
+    this->buckets[63 - __builtin_clzll(ns | 1)] += 1;
+    this->n += 1;
+    this->sum += ns;
+    if (ns > this->max) this->max = ns;
+}
+
+uint64_t Histogram::percentile(double p) const {
+    if (this->n == 0) return 0;
+    uint64_t rank = (uint64_t)(p / 100 * this->n + 0.999999), seen = 0;
+    if (rank < 1) rank = 1;
+    for(int i = 0; i < 64; i += 1) {
+        seen += this->buckets[i];
+        if (seen >= rank) {
+            uint64_t upper = i == 63 ? UINT64_MAX : ((uint64_t)2 << i) - 1;
+            return upper < this->max ? upper : this->max;
+        }
+    }
+    return this->max;
+}
+
+void Histogram::dumpJSON(OutBuf& o) const {
+    o.put("{\"calls\":").integer(this->n)
+     .put(",\"seconds\":").number(this->sum / 1e9)
+     .put(",\"mean_us\":").number(this->n ? this->sum / 1e3 / this->n : 0)
+     .put(",\"p50_us\":").number(percentile(50) / 1e3)
+     .put(",\"p90_us\":").number(percentile(90) / 1e3)
+     .put(",\"p99_us\":").number(percentile(99) / 1e3)
+     .put(",\"max_us\":").number(this->max / 1e3)
+     .put(",\"histogram\":[");
+    char pfx = '[';
+    for(int i = 0; i < 64; i += 1) {
+        if (!this->buckets[i]) continue;
+        if (pfx == ',') o.put(',');
+        pfx = ',';
+        o.put('[').number((((uint64_t)2 << i) - 1) / 1e3).put(',').integer(this->buckets[i]).put(']');
+    }
+    o.put("]}");
+}
+
+void StatsSummary::add(const FileStats& file) {
+    std::lock_guard<std::mutex> hold(this->lock);
+    this->files += 1;
+    if (file.cached) this->cached += 1;
+    for(int p = 0; p < PHASES; p += 1) {
+        // a phase that did not happen (a cache hit's parse, say) is not a zero-length one
+        if (file.ns[p] > 0) this->phases[p].add(file.ns[p]);
+    }
+    this->total.add(file.totalNs());
+    this->bytes += file.bytes;
+    this->packetBytes += file.packetBytes;
+    this->regions += file.regions;
+    this->people += file.people;
+    this->objects += file.objects;
+    this->vertices += file.vertices;
+    this->allocations += file.allocations;
+}
+
+void StatsSummary::fail() {
+    std::lock_guard<std::mutex> hold(this->lock);
+    this->failed += 1;
+}
+
+void StatsSummary::dumpJSON(OutBuf& o) const {
+    std::lock_guard<std::mutex> hold(this->lock);
+    double wall = (monotonicNs() - this->started) / 1e9;
+    o.put("{\"files\":").integer(this->files)
+     .put(",\"cached\":").integer(this->cached)
+     .put(",\"failed\":").integer(this->failed)
+     .put(",\"wall_seconds\":").number(wall)
+     .put(",\"files_per_second\":").number(wall > 0 ? this->files / wall : 0)
+     .put(",\"bytes\":").integer(this->bytes)
+     .put(",\"packet_bytes\":").integer(this->packetBytes)
+     .put(",\"regions\":").integer(this->regions)
+     .put(",\"people\":").integer(this->people)
+     .put(",\"objects\":").integer(this->objects)
+     .put(",\"vertices\":").integer(this->vertices)
+     .put(",\"allocations\":").integer(this->allocations)
+     .put(",\"phases\":{");
+    for(int p = 0; p < PHASES; p += 1) {
+        if (p) o.put(',');
+        o.put('"').put(phaseNames[p]).put("\":");
+        this->phases[p].dumpJSON(o);
+    }
+    o.put("},\"file\":");
+    this->total.dumpJSON(o);
+    o.put('}');
+}
+
+} // namespace fhmwg
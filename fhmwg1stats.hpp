@@ -0,0 +1,119 @@
+#pragma once
+#include "fhmwg1ds.hpp"
+#include "fhmwg1out.hpp"
+#include <chrono>
+#include <mutex>
+#include <cstdint>
+
+namespace fhmwg {
+
+/** The phases of handling one file that are timed separately */
+enum Phase {
+    /** SXMPFiles::OpenFile, or mapping the file and locating its packet (-x, -s) */
+    PHASE_OPEN = 0,
+    /** SXMPFiles::GetXMP, or parsing a located packet into the toolkit's model */
+    PHASE_GETXMP,
+    /** Filling ImageMetadata from the toolkit's model; with -s, the whole streaming parse */
+    PHASE_EXTRACT,
+    /** Rendering the result as JSON or GEDCOM */
+    PHASE_SERIALIZE,
+    PHASES
+};
+
+/** The name of `p` in stats output */
+const char *phaseName(Phase p);
+
+/**
+ * What handling one file cost. ImageMetadata::parseFile and parsePacket
+ * fill it in if given one in ParseOptions::stats; the caller adds the
+ * serialization time and anything it knows better, such as allocations.
+ */
+struct FileStats {
+    uint64_t ns[PHASES] = {};
+    /** Size of the file, or of the bytes handed to parsePacket */
+    uint64_t bytes = 0;
+    /** Size of the XMP packet, plus any JPEG ExtendedXMP */
+    uint64_t packetBytes = 0;
+    /** People and objects with an area, people, objects, and polygon vertices */
+    uint32_t regions = 0, people = 0, objects = 0, vertices = 0;
+    /** Blocks the model's Arena took from the heap for this file */
+    uint32_t allocations = 0;
+    /** The result came from the cache, so nothing was parsed */
+    bool cached = false;
+
+    /** Sets the counts of regions, people, objects and vertices from `md` */
+    void measure(const ImageMetadata& md);
+    uint64_t totalNs() const;
+    /** Appends the stats as a JSON object, with times in microseconds */
+    void dumpJSON(OutBuf& o) const;
+};
+
+/** A monotonic clock reading in nanoseconds */
+inline uint64_t monotonicNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Adds the time from its construction to stop() (or its destruction) to
+ * one phase of `stats`. Does nothing, not even read the clock, if
+ * `stats` is null, so timing costs nothing unless asked for.
+ */
+class PhaseTimer {
+public:
+    PhaseTimer(FileStats *stats, Phase phase) : stats(stats), phase(phase) {
+        if (stats) this->start = monotonicNs();
+    }
+    ~PhaseTimer() { stop(); }
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+    void stop() {
+        if (!this->stats) return;
+        this->stats->ns[this->phase] += monotonicNs() - this->start;
+        this->stats = 0;
+    }
+private:
+    FileStats *stats;
+    Phase phase;
+    uint64_t start = 0;
+};
+
+/**
+ * A latency histogram with one bucket per power of two nanoseconds, so it
+ * is fixed-size and cheap to add to, with percentiles good to a factor of two.
+ */
+class Histogram {
+public:
+    void add(uint64_t ns);
+    uint64_t count() const { return this->n; }
+    uint64_t totalNs() const { return this->sum; }
+    /** An upper bound on the `p`th percentile (0 to 100), in nanoseconds */
+    uint64_t percentile(double p) const;
+    /** Appends calls, seconds, mean, p50, p90, p99 and max, and the non-empty buckets as [upper bound in us, count] pairs */
+    void dumpJSON(OutBuf& o) const;
+private:
+    uint64_t buckets[64] = {};
+    uint64_t n = 0, sum = 0, max = 0;
+};
+
+/**
+ * Totals and per-phase latency histograms over many files. add() may be
+ * called from several threads at once.
+ */
+class StatsSummary {
+public:
+    StatsSummary() : started(monotonicNs()) {}
+    void add(const FileStats& file);
+    /** Counts a file that failed, whose stats are not added */
+    void fail();
+    /** Appends the summary as one JSON object */
+    void dumpJSON(OutBuf& o) const;
+private:
+    mutable std::mutex lock;
+    uint64_t started;
+    uint64_t files = 0, cached = 0, failed = 0;
+    /** Sums of the FileStats fields, wide enough for any number of files */
+    uint64_t bytes = 0, packetBytes = 0, regions = 0, people = 0, objects = 0, vertices = 0, allocations = 0;
+    Histogram phases[PHASES], total;
+};
+
+} // namespace fhmwg
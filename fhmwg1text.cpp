@@ -0,0 +1,201 @@
+#include "fhmwg1text.hpp"
+#include <cstring>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace fhmwg {
+
+namespace {
+
+/**
+ * The byte classes the kernels look for. Each kernel returns the length
+ * of the prefix with none of its bytes, so that callers can copy that
+ * much in one go and look at the byte after it themselves.
+ */
+enum Class {
+    /** Control characters, '"' and '\\' */
+    JSON_ESCAPE,
+    /** Every byte up to and including ' ' */
+    ASCII_SPACE,
+    /** As ASCII_SPACE, plus the lead bytes of the multibyte UTF-8 spaces */
+    UNICODE_SPACE,
+};
+
+typedef size_t (*Scan)(const unsigned char *s, size_t len);
+
+template<int C> inline bool special(unsigned char c) {
+    if (C == JSON_ESCAPE) return c < 0x20 || c == '"' || c == '\\';
+    if (c <= 0x20) return true;
+    return C == UNICODE_SPACE && (c == 0xC2 || c == 0xE1 || c == 0xE2 || c == 0xE3);
+}
+
+template<int C> size_t scanScalar(const unsigned char *s, size_t len) {
+    size_t i = 0;
+    while(i < len && !special<C>(s[i])) i += 1;
+    return i;
+}
+
+#if defined(__SSE2__)
+template<int C> size_t scanSSE2(const unsigned char *s, size_t len) {
+    size_t i = 0;
+    for(; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        // unsigned v <= k exactly when min(v, k) == v
+        __m128i m = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(C == JSON_ESCAPE ? 0x1F : 0x20)), v);
+        if (C == JSON_ESCAPE) {
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+        } else if (C == UNICODE_SPACE) {
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8((char)0xC2)));
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8((char)0xE1)));
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8((char)0xE2)));
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8((char)0xE3)));
+        }
+        int bits = _mm_movemask_epi8(m);
+        if (bits) return i + __builtin_ctz(bits);
+    }
+    return i + scanScalar<C>(s + i, len - i);
+}
+#endif
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#define FHMWG_AVX2 1
+template<int C> __attribute__((target("avx2"))) size_t scanAVX2(const unsigned char *s, size_t len) {
+    size_t i = 0;
+    for(; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i m = _mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(C == JSON_ESCAPE ? 0x1F : 0x20)), v);
+        if (C == JSON_ESCAPE) {
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+        } else if (C == UNICODE_SPACE) {
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)0xC2)));
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)0xE1)));
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)0xE2)));
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)0xE3)));
+        }
+        unsigned bits = _mm256_movemask_epi8(m);
+        if (bits) return i + __builtin_ctz(bits);
+    }
+    // the tail is under 32 bytes: SSE2 takes a 16-byte step if there is one.
+    // Clear the upper halves first, or its legacy SSE instructions run slowly.
+    _mm256_zeroupper();
+    return i + scanSSE2<C>(s + i, len - i);
+}
+#endif
+
+struct Kernels {
+    TextKernel which;
+    Scan json, asciiSpace, unicodeSpace;
+};
+
+Kernels kernelsFor(TextKernel k) {
+    switch(k) {
+#if defined(FHMWG_AVX2)
+        case AVX2_KERNEL: return Kernels{k, scanAVX2<JSON_ESCAPE>, scanAVX2<ASCII_SPACE>, scanAVX2<UNICODE_SPACE>};
+#endif
+#if defined(__SSE2__)
+        case SSE2_KERNEL: return Kernels{k, scanSSE2<JSON_ESCAPE>, scanSSE2<ASCII_SPACE>, scanSSE2<UNICODE_SPACE>};
+#endif
+        default: return Kernels{SCALAR_KERNEL, scanScalar<JSON_ESCAPE>, scanScalar<ASCII_SPACE>, scanScalar<UNICODE_SPACE>};
+    }
+}
+
+bool supported(TextKernel k) {
+    switch(k) {
+        case SCALAR_KERNEL: return true;
+#if defined(__SSE2__)
+        case SSE2_KERNEL: return true;
+#endif
+#if defined(FHMWG_AVX2)
+        case AVX2_KERNEL: return __builtin_cpu_supports("avx2");
+#endif
+        default: return false;
+    }
+}
+
+Kernels& kernels() {
+    // not AVX2 even where it runs: on the short strings of image metadata it
+    // measured slower than SSE2, as the wider loads rarely fill; see benchtext
+    static Kernels active = kernelsFor(supported(SSE2_KERNEL) ? SSE2_KERNEL : SCALAR_KERNEL);
+    return active;
+}
+
+/** The length of the whitespace character at `s`, or 0 if there is none there */
+size_t spaceLength(const unsigned char *s, size_t len, Whitespace ws) {
+    unsigned char c = s[0];
+    if (c == ' ' || (c >= '\t' && c <= '\r')) return 1;
+    if (ws != UNICODE_SPACES || c < 0x80) return 0;
+    if (c == 0xC2) return len >= 2 && (s[1] == 0x85 || s[1] == 0xA0) ? 2 : 0; // NEL, NBSP
+    if (len < 3) return 0;
+    if (c == 0xE1) return s[1] == 0x9A && s[2] == 0x80 ? 3 : 0; // U+1680
+    if (c == 0xE3) return s[1] == 0x80 && s[2] == 0x80 ? 3 : 0; // U+3000
+    if (c != 0xE2) return 0;
+    if (s[1] == 0x81) return s[2] == 0x9F ? 3 : 0; // U+205F
+    if (s[1] != 0x80) return 0;
+    // U+2000 to U+200A, U+2028, U+2029, U+202F
+    return (s[2] >= 0x80 && s[2] <= 0x8A) || s[2] == 0xA8 || s[2] == 0xA9 || s[2] == 0xAF ? 3 : 0;
+}
+
+} // namespace
+
+size_t whitespaceNormalize(char *str, size_t len, Whitespace ws) {
+    if (ws == KEEP_SPACES) return len;
+    unsigned char *s = (unsigned char *)str;
+    Scan scan = ws == UNICODE_SPACES ? kernels().unicodeSpace : kernels().asciiSpace;
+    size_t r = 0, w = 0;
+    bool was = true;
+    while(r < len) {
+        size_t n = scan(s + r, len - r);
+        if (n > 0) {
+            if (w != r) memmove(s + w, s + r, n);
+            r += n;
+            w += n;
+            was = false;
+            if (r == len) break;
+        }
+        size_t sp = spaceLength(s + r, len - r, ws);
+        if (sp == 0) {
+            // a control character or a lead byte that did not start a space
+            s[w++] = s[r++];
+            was = false;
+            continue;
+        }
+        if (!was) s[w++] = ' ';
+        was = true;
+        r += sp;
+    }
+    if (was && w > 0) w -= 1; // the space written for trailing whitespace
+    return w;
+}
+
+size_t whitespaceNormalize(char *s, Whitespace ws) {
+    size_t len = whitespaceNormalize(s, strlen(s), ws);
+    s[len] = 0;
+    return len;
+}
+
+void whitespaceNormalize(std::string& s, Whitespace ws) {
+    s.resize(whitespaceNormalize(&s[0], s.size(), ws));
+}
+
+void whitespaceNormalize(std::pmr::string& s, Whitespace ws) {
+    s.resize(whitespaceNormalize(&s[0], s.size(), ws));
+}
+
+size_t jsonSafeSpan(const char *s, size_t len) {
+    return kernels().json((const unsigned char *)s, len);
+}
+
+TextKernel textKernel() {
+    return kernels().which;
+}
+
+bool useTextKernel(TextKernel k) {
+    if (!supported(k)) return false;
+    kernels() = kernelsFor(k);
+    return true;
+}
+
+} // namespace fhmwg
@@ -0,0 +1,65 @@
+#pragma once
+#include <string>
+#include <memory_resource>
+#include <cstddef>
+
+namespace fhmwg {
+
+/** Which characters whitespaceNormalize treats as whitespace */
+enum Whitespace {
+    /** Leave the text alone */
+    KEEP_SPACES = 0,
+    /** Space, tab, LF, VT, FF and CR, as std::isspace in the "C" locale */
+    ASCII_SPACES,
+    /**
+     * The ASCII spaces plus the UTF-8 encodings of Unicode's other
+     * White_Space characters: NEL, NBSP, U+1680, U+2000 to U+200A,
+     * the line and paragraph separators, U+202F, U+205F and U+3000.
+     */
+    UNICODE_SPACES,
+};
+
+/**
+ * Edits a char* in place to whitespace normalize it: that is, strips
+ * leading and trailing whitespace and collapses each other substring
+ * of whitespace with a single space character.
+ *
+ * Returns the new length of the string.
+ */
+size_t whitespaceNormalize(char *s, Whitespace ws = ASCII_SPACES);
+
+/** As above, but for the `len` bytes at `s`, which need not be NUL-terminated */
+size_t whitespaceNormalize(char *s, size_t len, Whitespace ws);
+
+/**
+ * Edits a std::string in place to whitespace normalize it: that is,
+ * strips leading and trailing whitespace and collapses each other
+ * substring of whitespace with a single space character.
+ */
+void whitespaceNormalize(std::string& s, Whitespace ws = ASCII_SPACES);
+void whitespaceNormalize(std::pmr::string& s, Whitespace ws = ASCII_SPACES);
+
+/**
+ * Returns the length of the longest prefix of the `len` bytes at `s`
+ * that can go into a JSON string unescaped: that is, that has no
+ * control characters, quotation marks or backslashes.
+ */
+size_t jsonSafeSpan(const char *s, size_t len);
+
+/**
+ * Instruction sets for the scanning loops behind the functions above.
+ * SSE2 is used where the build has it, otherwise the scalar loops; AVX2
+ * is only there to be compared against it with useTextKernel.
+ */
+enum TextKernel { SCALAR_KERNEL, SSE2_KERNEL, AVX2_KERNEL };
+
+/** The kernel in use */
+TextKernel textKernel();
+
+/**
+ * Switches to kernel `k`, for benchmarking. Returns false and changes
+ * nothing if this CPU or build cannot run it. Not thread-safe.
+ */
+bool useTextKernel(TextKernel k);
+
+} // namespace fhmwg
@@ -0,0 +1,75 @@
+#include "fhmwg1trace.hpp"
+#include <atomic>
+#include <unistd.h>
+
+namespace fhmwg {
+
+/** A small number for the calling thread, which Chrome trace viewers show as its track */
+static unsigned track() {
+    static std::atomic<unsigned> tracks(0);
+    static thread_local unsigned mine = ++tracks;
+    return mine;
+}
+
+TraceLog::~TraceLog() {
+    close();
+}
+
+bool TraceLog::open(const char *path) {
+    close();
+    this->out = fopen(path, "w");
+    if (!this->out) return false;
+    this->opened = monotonicNs();
+    this->count = 0;
+    if (this->chrome) fputs("[\n", this->out);
+    return true;
+}
+
+void TraceLog::close() {
+    if (!this->out) return;
+    if (this->chrome) fputs("\n]\n", this->out);
+    fclose(this->out);
+    this->out = 0;
+}
+
+bool TraceLog::wants(const FileStats& stats) const {
+    return (this->slowNs > 0 && stats.totalNs() >= this->slowNs)
+        || (this->largeBytes > 0 && stats.bytes >= this->largeBytes);
+}
+
+void TraceLog::record(std::string_view file, const FileStats& stats, uint64_t started, const char *error) {
+    if (!this->out || !(error || wants(stats))) return;
+    std::string text;
+    OutBuf o(text);
+    if (!this->chrome) {
+        o.put("{\"file\":").json(file).put(",\"total_us\":").number(stats.totalNs() / 1e3).put(",\"stats\":");
+        stats.dumpJSON(o);
+        if (error) o.put(",\"error\":").json(error);
+        o.put("}\n");
+    } else {
+        // complete ("X") events, timed in microseconds from when the log was opened
+        double ts = started > this->opened ? (started - this->opened) / 1e3 : 0;
+        o.put("{\"name\":").json(file).put(",\"cat\":\"file\",\"ph\":\"X\",\"ts\":").number(ts)
+         .put(",\"dur\":").number(stats.totalNs() / 1e3)
+         .put(",\"pid\":").integer(getpid()).put(",\"tid\":").integer(track())
+         .put(",\"args\":{\"stats\":");
+        stats.dumpJSON(o);
+        if (error) o.put(",\"error\":").json(error);
+        o.put("}}");
+        for(int p = 0; p < PHASES; p += 1) {
+            if (!stats.ns[p]) continue;
+            o.put(",\n{\"name\":\"").put(phaseName((Phase)p)).put("\",\"cat\":\"phase\",\"ph\":\"X\",\"ts\":").number(ts)
+             .put(",\"dur\":").number(stats.ns[p] / 1e3)
+             .put(",\"pid\":").integer(getpid()).put(",\"tid\":").integer(track()).put('}');
+            ts += stats.ns[p] / 1e3;
+        }
+    }
+
+    std::lock_guard<std::mutex> hold(this->lock);
+    if (this->chrome && this->count > 0) fputs(",\n", this->out);
+    fwrite(text.data(), 1, text.size(), this->out);
+    fflush(this->out);
+    this->count += 1;
+}
+
+} // namespace fhmwg
@@ -0,0 +1,58 @@
+#pragma once
+#include "fhmwg1stats.hpp"
+#include <string>
+#include <string_view>
+#include <mutex>
+#include <cstdio>
+#include <cstdint>
+
+namespace fhmwg {
+
+/**
+ * A log of the files that were slow or large, for finding the few
+ * pathological files that dominate a batch's tail latency.
+ *
+ * Each traced file gets its path, phase timings, sizes and region and
+ * vertex counts (FileStats), and the error if it failed. The log is
+ * either one JSON object per line or, with `chrome` set, a Chrome
+ * trace-event array that chrome://tracing and Perfetto open directly,
+ * with one slice per file and one nested slice per phase, on a track
+ * per worker thread.
+ *
+ * record() may be called from several threads at once. Records are
+ * flushed as they are written, so a run that dies still leaves its log.
+ */
+class TraceLog {
+public:
+    /** Trace files whose phases took at least this long in total; 0 for no latency threshold */
+    uint64_t slowNs = 0;
+    /** Trace files of at least this many bytes; 0 for no size threshold */
+    uint64_t largeBytes = 0;
+    /** Write the Chrome trace-event format instead of JSON lines */
+    bool chrome = false;
+
+    ~TraceLog();
+    /** Creates or truncates the log at `path`. False, with errno set, on failure. */
+    bool open(const char *path);
+    /** Ends the trace-event array, if any, and closes the log */
+    void close();
+
+    /** Whether a file with these stats crosses a threshold */
+    bool wants(const FileStats& stats) const;
+    /**
+     * Logs `file` if wants() its stats, or if `error` is given. `started` is
+     * monotonicNs() from when its handling began; phases are laid out one
+     * after another from there, in the order of Phase.
+     */
+    void record(std::string_view file, const FileStats& stats, uint64_t started, const char *error = 0);
+
+    size_t traced() const { return this->count; }
+
+private:
+    std::mutex lock;
+    FILE *out = 0;
+    uint64_t opened = 0;
+    size_t count = 0;
+};
+
+} // namespace fhmwg
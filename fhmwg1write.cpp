@@ -0,0 +1,573 @@
+#include "fhmwg1write.hpp"
+#include "fhmwg1path.hpp"
+#include "fhmwg1out.hpp"
+
+#include <vector>
+#include <map>
+#include <atomic>
+#include <cmath>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+namespace fhmwg {
+
+/**
+ * Special handling to bypass an oddity with the toolkit.
+ * XMP says
+ * 
+ * - if known, default MUST be first
+ * - if present, "x-default" MUST be default
+ * - if present and not alone, "x-default" SHOULD have languaged copy
+ * 
+ * but the toolkit pretends that second SHOULD is a MUST and using
+ * SetLocalizedText forces x-default to match the first non-x-default
+ * language, changing the value of the first added to enforce this.
+ * 
+ * This function is a work-around to support the optional nature of the
+ * SHOULD rule above.
+ */
+static void setAltLang(SXMPMeta xmp, const char *iri, const char *prop, const AltLang& altLang) {
+	// Complicated workaround.
+	
+	// 1. Find the x-default, if any
+	const char *def = "";
+	for(const LangStr& x : altLang.entries) {
+		if (x.lang == "x-default") def = x.text.c_str();
+	}
+	
+	if (!*def) {
+		// 2. If no x-default, no workaround needed
+		for(const LangStr& x : altLang.entries) {
+			xmp.SetLocalizedText(iri, prop, NULL, x.lang.c_str(), x.text.c_str(), 0);
+		}
+	} else {
+		// 3. Put the x-default first
+		xmp.SetLocalizedText(iri, prop, NULL, "x-default", def, 0);
+		const char *defLang = "";
+		// 4. And then its language-tagged copy, if any
+		bool other = false;
+		for(const LangStr& x : altLang.entries) {
+			if (x.text == def && x.lang != "x-default") {
+				xmp.SetLocalizedText(iri, prop, NULL, x.lang.c_str(), x.text.c_str(), 0);
+				defLang = x.lang.c_str();
+				break;
+			} else { other = true; }
+		}
+		if (other && !*defLang) {
+			// 5. If no language-tagged copy, make a language-tagged copy with tag `und`
+			xmp.SetLocalizedText(iri, prop, NULL, "und", def, 0);
+		}
+		// 6. then put all the non-default languages
+		for(const LangStr& x : altLang.entries) {
+			if (x.lang != defLang && x.lang != "x-default") {
+				xmp.SetLocalizedText(iri, prop, NULL, x.lang.c_str(), x.text.c_str(), 0);
+			}
+		}
+	}
+}
+
+static void setRegionArea(SXMPMeta xmp, int cell, const Region& region) {
+	std::string s_bounds, item;
+	const char *bounds = path::boundary(s_bounds, cell);
+	xmp.SetProperty(ns::_iptc, bounds, 0, kXMP_PropValueIsStruct);
+	xmp.SetStructField(ns::_iptc, bounds, ns::_iptc, "rbUnit", "relative", 0);
+	switch(region.type) {
+	case Region::Types::CIRCLE:
+		xmp.SetStructField(ns::_iptc, bounds, ns::_iptc, "rbShape", "circle", 0);
+		xmp.SetProperty_Float(ns::_iptc, path::rbX(item, cell), region.circ.x, 0);
+		xmp.SetProperty_Float(ns::_iptc, path::rbY(item, cell), region.circ.y, 0);
+		xmp.SetProperty_Float(ns::_iptc, path::rbRx(item, cell), region.circ.rx, 0);
+		break;
+	case Region::Types::RECTANGLE:
+		xmp.SetStructField(ns::_iptc, bounds, ns::_iptc, "rbShape", "rectangle", 0);
+		xmp.SetProperty_Float(ns::_iptc, path::rbX(item, cell), region.rect.x, 0);
+		xmp.SetProperty_Float(ns::_iptc, path::rbY(item, cell), region.rect.y, 0);
+		xmp.SetProperty_Float(ns::_iptc, path::rbW(item, cell), region.rect.w, 0);
+		xmp.SetProperty_Float(ns::_iptc, path::rbH(item, cell), region.rect.h, 0);
+		break;
+	case Region::Types::POLYGON: {
+		xmp.SetStructField(ns::_iptc, bounds, ns::_iptc, "rbShape", "polygon", 0);
+		std::string vertices;
+		path::rbVertices(vertices, cell);
+		XMP_Index point = 0;
+		for(const std::pair<double,double>& pt : region.pts) {
+			xmp.AppendArrayItem(ns::_iptc, vertices.c_str(), kXMP_PropArrayIsOrdered, 0, kXMP_PropValueIsStruct);
+			point += 1;
+			xmp.SetProperty_Float(ns::_iptc, path::vertexX(item, cell, point), pt.first, 0);
+			xmp.SetProperty_Float(ns::_iptc, path::vertexY(item, cell, point), pt.second, 0);
+		}
+		break;
+	}
+	case Region::Types::NONE:
+		// use the whole-image region
+		xmp.SetStructField(ns::_iptc, bounds, ns::_iptc, "rbShape", "rectangle", 0);
+		xmp.SetStructField(ns::_iptc, bounds, ns::_iptc, "rbX", "0", 0);
+		xmp.SetStructField(ns::_iptc, bounds, ns::_iptc, "rbY", "0", 0);
+		xmp.SetStructField(ns::_iptc, bounds, ns::_iptc, "rbW", "1", 0);
+		xmp.SetStructField(ns::_iptc, bounds, ns::_iptc, "rbH", "1", 0);
+		break;
+	}
+}
+
+/**
+ * Hands out the ImageRegions that new people and objects go in, one per
+ * distinct area, so that entries sharing an area share its region
+ * instead of each repeating the same RegionBoundary.
+ *
+ * The parser reads people and objects back region by region, so an entry
+ * only joins an earlier region if that is no earlier than the region of
+ * the previous entry in its list; otherwise it gets a region of its own,
+ * and a round trip keeps the order of both lists.
+ */
+class Regions {
+public:
+	explicit Regions(SXMPMeta xmp) : xmp(xmp) {}
+	/** The region for an entry with area `area`, where `last` is the region of the previous entry in its list (or 0) and is updated */
+	XMP_Index place(const Region& area, XMP_Index& last);
+private:
+	SXMPMeta xmp;
+	/** The newest region made for each area, keyed on geometry() */
+	std::map<std::string, XMP_Index> made;
+	static std::string geometry(const Region& area);
+};
+
+/** A key that is equal for areas that setRegionArea writes the same way */
+std::string Regions::geometry(const Region& area) {
+	std::string key;
+	OutBuf o(key);
+	area.dumpJSON(o, ' '); // nothing for the whole image
+	return key;
+}
+
+XMP_Index Regions::place(const Region& area, XMP_Index& last) {
+	std::string key = geometry(area);
+	auto it = this->made.find(key);
+	if (it != this->made.end() && it->second >= last) return last = it->second;
+
+	std::string cell;
+	this->xmp.AppendArrayItem(ns::_iptc, "ImageRegion", kXMP_PropValueIsArray, 0, kXMP_PropValueIsStruct);
+	XMP_Index r = this->xmp.CountArrayItems(ns::_iptc, "ImageRegion");
+	// add a struct with an area to that region
+	this->xmp.SetProperty(ns::_iptc, path::region(cell, r), 0, kXMP_PropValueIsStruct);
+	setRegionArea(this->xmp, r, area);
+	this->made[key] = r;
+	return last = r;
+}
+
+/**
+ * Works from a Patch instead of from ImageMetadata alone because we want
+ * a missing key to be ignored, while an empty key removes.
+ */
+void updateMetadata(SXMPMeta xmp, const Patch& patch) {
+	const ImageMetadata& md = patch.md;
+
+	if (patch.has(Patch::CAPTION)) {
+		xmp.DeleteProperty(ns::_dc, "description");
+		setAltLang(xmp, ns::_dc, "description", md.caption);
+	}
+	if (patch.has(Patch::TITLE)) {
+		xmp.DeleteProperty(ns::_dc, "title");
+		setAltLang(xmp, ns::_dc, "title", md.title);
+	}
+	if (patch.has(Patch::EVENT)) {
+		xmp.DeleteProperty(ns::_iptc, "Event");
+		setAltLang(xmp, ns::_iptc, "Event", md.event);
+	}
+	if (patch.has(Patch::DATE)) {
+		xmp.DeleteProperty(ns::_ph, "DateCreated");
+		if (md.date.size() > 0)
+			xmp.SetProperty(ns::_ph, "DateCreated", md.date.c_str(), 0);
+	}
+	
+	if (patch.has(Patch::ALBUMS)) {
+		xmp.DeleteProperty(ns::_mwg, "Collections");
+		if (md.albums.size() > 0) {
+			xmp.SetProperty(ns::_mwg, "Collections", 0, kXMP_PropValueIsArray);
+			std::string entry;
+			XMP_Index album = 0;
+			for (const Album& a : md.albums) {
+				xmp.AppendArrayItem(ns::_mwg, "Collections", 0, 0, kXMP_PropValueIsStruct);
+				album += 1;
+				if (a.name.size() > 0)
+					xmp.SetProperty(ns::_mwg, path::collectionName(entry, album), a.name.c_str(), 0);
+				if (a.id.size() > 0)
+					xmp.SetProperty(ns::_mwg, path::collectionURI(entry, album), a.id.c_str(), 0);
+			}
+		}
+	}
+
+	if (patch.has(Patch::LOCATIONS)) {
+		xmp.DeleteProperty(ns::_iptc, "LocationShown");
+		if (md.locations.size() > 0) {
+			xmp.SetProperty(ns::_iptc, "LocationShown", 0, kXMP_PropValueIsArray);
+			std::string entry;
+			XMP_Index loc = 0;
+			for (const Location& a : md.locations) {
+				xmp.AppendArrayItem(ns::_iptc, "LocationShown", 0, 0, kXMP_PropValueIsStruct);
+				loc += 1;
+				setAltLang(xmp, ns::_iptc, path::locationName(entry, loc), a.name);
+				if (!std::isnan(a.lat) && !std::isnan(a.lon)) {
+					xmp.SetProperty_Float(ns::_iptc, path::latitude(entry, loc), a.lat, 0);
+					xmp.SetProperty_Float(ns::_iptc, path::longitude(entry, loc), a.lon, 0);
+				}
+				if (a.ids.size() > 0) {
+					path::locationId(entry, loc);
+					for(const IRI& iri : a.ids) {
+						xmp.AppendArrayItem(ns::_iptc, entry.c_str(), kXMP_PropValueIsArray, iri.c_str(), 0);
+					}
+				}
+			}
+		}
+	}
+
+	bool people = patch.has(Patch::PEOPLE), objects = patch.has(Patch::OBJECTS);
+	std::string cell, prop;
+	if (people || objects) {
+		// remove the old ones, both at top level and in regions, in one pass over the regions
+		if (people) {
+			xmp.DeleteProperty(ns::_iptc, "PersonInImage");
+			xmp.DeleteProperty(ns::_iptc, "PersonInImageWDetails");
+		}
+		if (objects)
+			xmp.DeleteProperty(ns::_iptc, "ArtworkOrObject");
+		XMP_Index regions = xmp.CountArrayItems(ns::_iptc, "ImageRegion");
+		
+		// iterate backwards so that removing regions does not re-index yet-to-be-visited regions
+		for(int i=regions; i>0; i-=1) {
+			if (people) {
+				xmp.DeleteProperty(ns::_iptc, path::inRegion.detailed(prop, i));
+				xmp.DeleteProperty(ns::_iptc, path::inRegion.simple(prop, i));
+			}
+			if (objects)
+				xmp.DeleteProperty(ns::_iptc, path::inRegion.objects(prop, i));
+			
+			// a region without an area is removed; one with an area keeps whatever else it has
+			if (!xmp.DoesPropertyExist(ns::_iptc, path::boundary(cell, i)))
+				xmp.DeleteArrayItem(ns::_iptc, "ImageRegion", i);
+		}
+	}
+
+	Regions made(xmp);
+	if (people) {
+		// add each person to a region with their area, as PersonInImageWDetails[n]
+		XMP_Index last = 0;
+		for(const Person& person : md.people) {
+			XMP_Index r = made.place(person.region, last);
+			xmp.AppendArrayItem(ns::_iptc, path::inRegion.detailed(prop, r), kXMP_PropValueIsArray, 0, kXMP_PropValueIsStruct);
+			XMP_Index n = xmp.CountArrayItems(ns::_iptc, path::inRegion.detailed(prop, r));
+			// add details about the person to that array item
+			setAltLang(xmp, ns::_iptc, path::inRegion.personName(prop, r, n), person.name);
+			setAltLang(xmp, ns::_iptc, path::inRegion.personDescription(prop, r, n), person.description);
+			if (person.ids.size() > 0) {
+				const char *entry = path::inRegion.personId(prop, r, n);
+				for(const IRI& iri : person.ids) {
+					xmp.AppendArrayItem(ns::_iptc, entry, kXMP_PropValueIsArray, iri.c_str(), 0);
+				}
+			}
+		}
+	}
+
+	if (objects) {
+		// add each object to a region with its area, as ArtworkOrObject[n]
+		XMP_Index last = 0;
+		for(const Object& object : md.objects) {
+			XMP_Index r = made.place(object.region, last);
+			xmp.AppendArrayItem(ns::_iptc, path::inRegion.objects(prop, r), kXMP_PropValueIsArray, 0, kXMP_PropValueIsStruct);
+			XMP_Index n = xmp.CountArrayItems(ns::_iptc, path::inRegion.objects(prop, r));
+			// add details about the object to that array item
+			setAltLang(xmp, ns::_iptc, path::inRegion.objectTitle(prop, r, n), object.title);
+		}
+	}
+
+}
+
+/**
+ * Copies the rest of `r` into `w`, trying the fastest means first: a
+ * reflink sharing the source's blocks, then an in-kernel copy, then a
+ * read/write loop with a large buffer.
+ */
+static bool copyContents(int r, int w) {
+#ifdef FICLONE
+	if (ioctl(w, FICLONE, r) == 0) return true;
+#endif
+	struct stat st;
+	if (fstat(r, &st) < 0) return false;
+	off_t left = st.st_size;
+	// either may be unsupported between these two files, in which case it fails
+	// without copying; both advance the file offsets, so each picks up where the last stopped
+	while (left > 0) {
+		ssize_t got = copy_file_range(r, 0, w, 0, left, 0);
+		if (got < 0 && errno == EINTR) continue;
+		if (got <= 0) break;
+		left -= got;
+	}
+	while (left > 0) {
+		ssize_t got = sendfile(w, r, 0, left);
+		if (got < 0 && errno == EINTR) continue;
+		if (got <= 0) break;
+		left -= got;
+	}
+	// whatever is left, including anything appended since the fstat
+	std::vector<char> buffer(1 << 20);
+	for (;;) {
+		ssize_t got = read(r, buffer.data(), buffer.size());
+		if (got < 0 && errno == EINTR) continue;
+		if (got < 0) return false;
+		if (got == 0) return true;
+		for (ssize_t sofar = 0; sofar < got; ) {
+			ssize_t wrote = write(w, buffer.data() + sofar, got - sofar);
+			if (wrote < 0 && errno == EINTR) continue;
+			if (wrote < 0) return false;
+			sofar += wrote;
+		}
+	}
+}
+
+bool copyFile(const char *from, const char *to) {
+	int r = open(from, O_RDONLY | O_CLOEXEC);
+	if (r < 0) return false;
+	int w = open(to, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0644);
+	if (w < 0) { close(r); return false; }
+	bool ok = copyContents(r, w);
+	close(r);
+	ok = close(w) == 0 && ok;
+	if (!ok) unlink(to);
+	return ok;
+}
+
+void updatePacket(const char *packet, size_t len, const char *extended, size_t extendedLen,
+	const Patch& patch, std::string& out, XMP_StringLen padding) {
+#ifdef FHMWG_SERIAL_XMP
+	std::lock_guard<std::mutex> serial(xmpLock);
+#endif
+	SXMPMeta xmp;
+	if (len > 0) xmp.ParseFromBuffer(packet, len);
+	if (extended) {
+		SXMPMeta more;
+		more.ParseFromBuffer(extended, extendedLen);
+		SXMPUtils::MergeFromJPEG(&xmp, more);
+	}
+	updateMetadata(xmp, patch);
+	out.clear();
+	xmp.SerializeToBuffer(&out, kXMP_UseCompactFormat, padding);
+}
+
+/** The part of `md` that `field` sets, as parser prints it */
+static std::string view(const ImageMetadata& md, Patch::Field field) {
+	std::string out;
+	OutBuf o(out);
+	switch (field) {
+	case Patch::TITLE: md.title.dumpJSON(o); break;
+	case Patch::CAPTION: md.caption.dumpJSON(o); break;
+	case Patch::EVENT: md.event.dumpJSON(o); break;
+	case Patch::DATE: o.json(md.date); break;
+	// the separators keep entries that print as nothing from going uncounted
+	case Patch::ALBUMS: for (const Album& x : md.albums) { x.dumpJSON(o); o.put(','); } break;
+	case Patch::LOCATIONS: for (const Location& x : md.locations) { x.dumpJSON(o); o.put(','); } break;
+	case Patch::PEOPLE: for (const Person& x : md.people) { x.dumpJSON(o); o.put(','); } break;
+	case Patch::OBJECTS: for (const Object& x : md.objects) { x.dumpJSON(o); o.put(','); } break;
+	}
+	return out;
+}
+
+/**
+ * Applies `patch` to a copy of `xmp`, leaving the result in `edited`, and
+ * lists in `changed` the keys of `patch` whose part of the FHMWG view it changes
+ */
+static void edit(SXMPMeta& xmp, const Patch& patch, SXMPMeta& edited, std::vector<std::string>& changed) {
+	edited = xmp.Clone();
+	updateMetadata(edited, patch);
+	ImageMetadata before, after;
+	extract(before, xmp, ASCII_SPACES);
+	extract(after, edited, ASCII_SPACES);
+	changed.clear();
+	for (int i = 0; i < Patch::FIELDS; i += 1) {
+		Patch::Field field = Patch::Field(1 << i);
+		if (patch.has(field) && view(before, field) != view(after, field)) changed.push_back(Patch::key(field));
+	}
+}
+
+/** writeCopy, but making no copy at all if the edits change nothing and `copyUnchanged` is false */
+static bool editCopy(const char *from, const char *to, const Patch& patch, std::string& why,
+	WriteReport& report, bool copyUnchanged) {
+#ifdef FHMWG_SERIAL_XMP
+	std::lock_guard<std::mutex> serial(xmpLock);
+#endif
+	SXMPMeta  xmpMeta, edited;
+	{
+		SXMPFiles source;
+		if (!source.OpenFile ( from, kXMP_UnknownFile, kXMPFiles_OpenForRead )
+		|| !source.GetXMP ( &xmpMeta, 0, 0 )) {
+			why = std::string("Failed to open and parse \"") + from + "\"";
+			return false;
+		}
+		source.CloseFile();
+	}
+	edit(xmpMeta, patch, edited, report.changed);
+	if (report.changed.size() == 0 && !copyUnchanged) return true;
+
+	if (!copyFile(from, to)) {
+		why = std::string("Failed to create \"") + to + "\"";
+		return false;
+	}
+	if (report.changed.size() == 0) return true;
+
+	// don't leave a half-edited copy behind, so the edit can simply be retried
+	SXMPFiles file;
+	try {
+		if (!file.OpenFile ( to, kXMP_UnknownFile, kXMPFiles_OpenForUpdate )) {
+			why = std::string("Failed to open \"") + to + "\" for update";
+			unlink(to);
+			return false;
+		}
+		file.PutXMP(edited);
+		file.CloseFile();
+	} catch (...) {
+		file.CloseFile();
+		unlink(to);
+		throw;
+	}
+	return true;
+}
+
+bool writeCopy(const char *from, const char *to, const Patch& patch, std::string& why, WriteReport *report) {
+	WriteReport ignored;
+	return editCopy(from, to, patch, why, report ? *report : ignored, true);
+}
+
+/** The namespace of xmpNote:HasExtendedXMP, which names a JPEG's ExtendedXMP */
+static const char xmpNoteNS[] = "http://ns.adobe.com/xmp/note/";
+
+/** Whether `a` has an x-default entry, which is what the toolkit maps to and from IPTC and EXIF */
+static bool hasDefault(const AltLang& a) {
+	for (const LangStr& s : a.entries) if (s.lang == "x-default") return true;
+	return false;
+}
+
+/**
+ * Whether going from `before` to `after` takes away a title, caption or
+ * date, which the toolkit's file handlers would bring back from the
+ * image's EXIF or IPTC on the next read if only the XMP were rewritten
+ */
+static bool dropsReconciled(const ImageMetadata& before, const ImageMetadata& after) {
+	return (hasDefault(before.title) && !hasDefault(after.title))
+		|| (hasDefault(before.caption) && !hasDefault(after.caption))
+		|| (before.date.size() > 0 && after.date.size() == 0);
+}
+
+/**
+ * Applies `patch` by overwriting the packet in `path` where it lies, if the
+ * file has a writeable packet with room for the result, or by doing
+ * nothing if `patch` changes nothing in it. False, leaving the file
+ * untouched, if neither.
+ *
+ * What changes is judged on the same read as parser and writeCopy make,
+ * with the toolkit's file handler merging any JPEG ExtendedXMP and
+ * reconciling EXIF and IPTC. The packet scanner that does the overwrite
+ * sees only the main packet, so it is used only where that packet alone
+ * gives the same view, and where no later read would undo the edit: not
+ * if the image has ExtendedXMP, which the handler merges over the main
+ * packet, nor if the edit removes a title, caption or date that the
+ * handler could import again from EXIF or IPTC.
+ */
+static bool overwritePacket(const char *path, const Patch& patch, WriteReport& report) {
+#ifdef FHMWG_SERIAL_XMP
+	std::lock_guard<std::mutex> serial(xmpLock);
+#endif
+	SXMPMeta  xmpMeta, edited;
+	{
+		SXMPFiles source;
+		if (!source.OpenFile ( path, kXMP_UnknownFile, kXMPFiles_OpenForRead )
+		|| !source.GetXMP ( &xmpMeta, 0, 0 ))
+			return false;
+		source.CloseFile();
+	}
+	edit(xmpMeta, patch, edited, report.changed);
+	if (report.changed.size() == 0) return true;
+
+	ImageMetadata before, after;
+	extract(before, xmpMeta, ASCII_SPACES);
+	extract(after, edited, ASCII_SPACES);
+	if (dropsReconciled(before, after)) return false;
+
+	SXMPMeta  packet;
+	SXMPFiles file;
+	XMP_PacketInfo info;
+
+	// the packet scanner writes only in place, and only a packet of the same length
+	if (!file.OpenFile ( path, kXMP_UnknownFile, kXMPFiles_OpenForUpdate | kXMPFiles_OpenUsePacketScanning ))
+		return false;
+	try {
+		if (!file.GetXMP ( &packet, 0, &info ) || packet.DoesPropertyExist(xmpNoteNS, "HasExtendedXMP")) {
+			file.CloseFile();
+			return false;
+		}
+		ImageMetadata scanned;
+		extract(scanned, packet, ASCII_SPACES);
+		for (int i = 0; i < Patch::FIELDS; i += 1) {
+			Patch::Field field = Patch::Field(1 << i);
+			if (view(scanned, field) != view(before, field)) {
+				file.CloseFile();
+				return false;
+			}
+		}
+		// edit the packet as found, keeping whatever the handler's read added out of it
+		updateMetadata(packet, patch);
+		if (!info.writeable || !file.CanPutXMP(packet)) {
+			file.CloseFile();
+			return false;
+		}
+		file.PutXMP(packet);
+		file.CloseFile();
+	} catch (...) {
+		file.CloseFile();
+		throw;
+	}
+	return true;
+}
+
+bool writeInPlace(const char *path, const Patch& patch, std::string& why, WriteReport *report) {
+	WriteReport ignored;
+	WriteReport& r = report ? *report : ignored;
+	r.rewrote = false;
+	struct stat st;
+	if (stat(path, &st) < 0) {
+		why = std::string("Cannot find \"") + path + "\": " + strerror(errno);
+		return false;
+	}
+	if (overwritePacket(path, patch, r)) return true;
+
+	// build the edited file next to the original, then swap it in in one step;
+	// the name is unique to this call, as other threads may be editing other images in the same place
+	static std::atomic<unsigned> calls(0);
+	std::string tmp = std::string(path) + ".tmp" + std::to_string(getpid()) + "." + std::to_string(calls++);
+	if (!editCopy(path, tmp.c_str(), patch, why, r, false)) return false;
+	if (r.changed.size() == 0) return true;
+	int fd = open(tmp.c_str(), O_RDONLY | O_CLOEXEC);
+	bool ok = fd >= 0 && fchmod(fd, st.st_mode & 07777) == 0 && fsync(fd) == 0;
+	if (fd >= 0) close(fd);
+	if (!ok || rename(tmp.c_str(), path) < 0) {
+		why = std::string("Failed to replace \"") + path + "\": " + strerror(errno);
+		unlink(tmp.c_str());
+		return false;
+	}
+	// make the rename itself durable
+	std::string dir = path;
+	size_t slash = dir.rfind('/');
+	dir = slash == std::string::npos ? "." : slash == 0 ? "/" : dir.substr(0, slash);
+	fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+	r.rewrote = true;
+	return true;
+}
+
+} // namespace fhmwg
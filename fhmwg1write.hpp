@@ -0,0 +1,82 @@
+#pragma once
+#include "fhmwg1ds.hpp"
+#include "fhmwg1text.hpp"
+#include "fhmwg1patch.hpp"
+#include <string>
+#include <vector>
+
+#define TXMP_STRING_TYPE	std::string
+#define XMP_INCLUDE_XMPFILES 1
+#include <XMP.hpp>
+
+namespace fhmwg {
+
+/**
+ * Applies the edits in `patch` to `xmp`: each field it gives replaces
+ * what `xmp` has for that field, and the others are left alone.
+ */
+void updateMetadata(SXMPMeta xmp, const Patch& patch);
+
+/**
+ * Applies the edits in `patch` to the serialized XMP `packet`, merged with
+ * the JPEG ExtendedXMP packet `extended` if there is one, and puts the
+ * edited packet, with `padding` bytes of padding, in `out`; an empty
+ * `packet` starts from no XMP at all. Like updateMetadata, it needs no
+ * file; toolkit errors are thrown as XMP_Error.
+ */
+void updatePacket(const char *packet, size_t len, const char *extended, size_t extendedLen,
+	const Patch& patch, std::string& out, XMP_StringLen padding = 2048);
+
+/** Copies `from` to `to`, which must not exist yet */
+bool copyFile(const char *from, const char *to);
+
+/**
+ * Fills the `fields` of `md` from an XMP data model as ImageMetadata::parseFile
+ * does (in fhmwg1parse.cpp)
+ */
+void extract(ImageMetadata& md, SXMPMeta& xmpMeta, Whitespace ws, unsigned fields = ALL_FIELDS);
+
+/** What a write did */
+struct WriteReport {
+	/**
+	 * The keys of the edits whose part of the FHMWG view (as parser would
+	 * print it) differs after the edit; if none, nothing was written
+	 */
+	std::vector<std::string> changed;
+	/** writeInPlace had to rewrite the whole file */
+	bool rewrote = false;
+};
+
+/**
+ * Copies `from` to the new file `to` and applies the edits in `patch` to
+ * the copy's XMP. Returns false, saying why in `why`, if the copy cannot be
+ * made or opened; toolkit errors while editing are thrown as XMP_Error.
+ * Either way, a copy it made is removed again.
+ *
+ * If the edits would leave the FHMWG view of the image as it is, the
+ * copy is a plain copy of the bytes and the XMP is not rewritten.
+ *
+ * The toolkit's file handler serializes the new packet itself, with its
+ * own padding: SXMPFiles::PutXMP parses a serialized packet it is given
+ * back into a model, so there is no choosing the padding here.
+ */
+bool writeCopy(const char *from, const char *to, const Patch& patch, std::string& why, WriteReport *report = 0);
+
+/**
+ * Applies the edits in `patch` to the image at `path` itself. If its packet
+ * is writeable and the edited packet fits in it (padding included), only
+ * the packet's bytes are overwritten. Otherwise an edited copy is made as
+ * by writeCopy and renamed over the original, so a crash leaves either
+ * the old file or the new one. If the edits change nothing, the file is
+ * not touched at all.
+ *
+ * The in-place update changes only the XMP, not the EXIF and IPTC that
+ * the toolkit reconciles with it on a full rewrite. The digests of those
+ * recorded in the XMP still match them, so the toolkit goes on
+ * preferring the XMP when reading. It is only used where the main packet
+ * alone gives the view parser reports, so an image with ExtendedXMP or
+ * with EXIF or IPTC that shows through in that view is always rewritten.
+ */
+bool writeInPlace(const char *path, const Patch& patch, std::string& why, WriteReport *report = 0);
+
+} // namespace fhmwg
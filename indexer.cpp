@@ -0,0 +1,130 @@
+#include "fhmwg1ds.hpp"
+#include "fhmwg1batch.hpp"
+#include "fhmwg1arena.hpp"
+#include "fhmwg1cache.hpp"
+#include "fhmwg1index.hpp"
+#define TXMP_STRING_TYPE	std::string
+#define XMP_INCLUDE_XMPFILES 1
+#include <XMP.hpp>
+#include <XMP.incl_cpp>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <thread>
+
+/** The results of earlier runs, if -c was given */
+static fhmwg::Cache *cache = 0;
+
+/**
+ * Parses one file and puts its model in serialized form into `out`, or
+ * leaves `out` empty if the file could not be parsed. Runs on worker threads.
+ */
+static void extract(const std::string& filename, const fhmwg::ParseOptions& opts, std::string& out) {
+    static thread_local fhmwg::Arena arena;
+    static thread_local fhmwg::ImageMetadata md(&arena);
+    md.reset();
+    arena.reset();
+    out.clear();
+    fhmwg::FileIdentity id;
+    if (!cache || !cache->lookup(filename.c_str(), opts, id, md)) {
+        try {
+            md.parseFile(filename.c_str(), opts);
+        } catch (XMP_Error ex) {
+            fprintf(stderr, "%s: skipped, error %d: %s\n", filename.c_str(), ex.GetID(), ex.GetErrMsg());
+            return;
+        }
+        if (cache) cache->store(id, opts, md);
+    }
+    md.serialize(out);
+}
+
+static int usage(const char *name) {
+    fprintf(stderr, "USAGE: %s -o indexfile [-j N] [-r] [-e ext,...] [-0] [-x] [-s] [-w] [-c cachefile [-H]] imagefile...\n"
+        "    -o FILE write the index to FILE (replacing it once complete)\n"
+        "    the other options are those of parser\n", name);
+    return -1;
+}
+
+int main(int argc, char *argv[]) {
+    int jobs = 1;
+    fhmwg::ParseOptions opts;
+    fhmwg::PathSource files;
+    const char *indexFile = 0;
+    fhmwg::Cache results;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp("-o", argv[i])) {
+            if (i+1 >= argc) return usage(argv[0]);
+            indexFile = argv[++i];
+            continue;
+        }
+        if (!strcmp("-r", argv[i])) { files.recursive = true; continue; }
+        if (!strcmp("-0", argv[i])) { files.separator('\0'); continue; }
+        if (!strcmp("-x", argv[i])) { opts.packetOnly = true; continue; }
+        if (!strcmp("-s", argv[i])) { opts.streaming = true; continue; }
+        if (!strcmp("-w", argv[i])) { opts.unicodeSpaces = true; continue; }
+        if (!strcmp("-H", argv[i])) { results.hashContents = true; continue; }
+        if (!strcmp("-c", argv[i])) {
+            if (i+1 >= argc) return usage(argv[0]);
+            if (!results.open(argv[++i])) {
+                fprintf(stderr, "Cannot use \"%s\" as a cache: %s\n", argv[i], strerror(errno));
+                return -1;
+            }
+            cache = &results;
+            continue;
+        }
+        if (!strcmp("-e", argv[i])) {
+            if (i+1 >= argc) return usage(argv[0]);
+            files.extensions(argv[++i]);
+            continue;
+        }
+        if (!strncmp("-j", argv[i], 2)) {
+            const char *n = argv[i][2] ? argv[i]+2 : (i+1 < argc ? argv[++i] : "");
+            char *end;
+            jobs = strtol(n, &end, 10);
+            if (!*n || *end || jobs < 0) return usage(argv[0]);
+            if (jobs == 0) jobs = std::thread::hardware_concurrency();
+            continue;
+        }
+        files.add(argv[i]);
+    }
+    if (!indexFile) return usage(argv[0]);
+
+    if (!SXMPMeta::Initialize()) {
+        fprintf(stderr, "## SXMPMeta::Initialize failed!\n");
+        return -1;
+    }
+    if (!SXMPFiles::Initialize()) {
+        fprintf(stderr, "## SXMPFiles::Initialize failed!\n");
+        return -1;
+    }
+    fhmwg::ns::init();
+
+    // the builder takes the images in input order, so their numbers are stable across runs
+    fhmwg::IndexBuilder builder;
+    fhmwg::ImageMetadata md;
+    size_t skipped = 0;
+    fhmwg::runBatch(jobs, true,
+        [&](std::string& file) { return files.next(file); },
+        [&](const std::string& file, std::string& out) { extract(file, opts, out); },
+        [&](const std::string& file, const std::string& out) {
+            if (out.size() > 0 && md.deserialize(out)) builder.add(file, md);
+            else skipped += 1;
+        });
+
+    SXMPFiles::Terminate();
+    SXMPMeta::Terminate();
+
+    if (cache) {
+        cache->close();
+        fprintf(stderr, "cache: %zu hits, %zu misses\n", cache->hits(), cache->misses());
+    }
+    if (!builder.write(indexFile)) {
+        fprintf(stderr, "Cannot write \"%s\": %s\n", indexFile, strerror(errno));
+        return -1;
+    }
+    fprintf(stderr, "indexed %zu images", builder.size());
+    if (skipped) fprintf(stderr, ", skipped %zu", skipped);
+    fprintf(stderr, "\n");
+    return skipped ? 1 : 0;
+}
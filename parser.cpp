@@ -1,35 +1,394 @@
 #include "fhmwg1ds.hpp"
+#include "fhmwg1batch.hpp"
+#include "fhmwg1packet.hpp"
+#include "fhmwg1arena.hpp"
+#include "fhmwg1serve.hpp"
+#include "fhmwg1cache.hpp"
+#include "fhmwg1stats.hpp"
+#include "fhmwg1trace.hpp"
+#include "fhmwg1checkpoint.hpp"
 #define TXMP_STRING_TYPE	std::string
 #define XMP_INCLUDE_XMPFILES 1
 #include <XMP.hpp>
 #include <XMP.incl_cpp>
 #include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <thread>
+#include <atomic>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/** Renders `md` into `out`, replacing its contents but keeping its capacity */
+static void render(const fhmwg::ImageMetadata& md, bool asGEDCOM, std::string& out) {
+    out.clear();
+    fhmwg::OutBuf o(out);
+    if (asGEDCOM) md.dumpGEDCOM(o);
+    else { md.dumpJSON(o); o.put('\n'); }
+}
+
+/** The results of earlier runs, if -c was given */
+static fhmwg::Cache *cache = 0;
+
+/** Phase timings over the whole run, if --stats or --file-stats was given */
+static fhmwg::StatsSummary *summary = 0;
+/** Follow each file's JSON record with a record of its phase timings (--file-stats) */
+static bool fileStats = false;
+/** Where slow and large files are logged, if --trace or --chrome-trace was given */
+static fhmwg::TraceLog *trace = 0;
+
+static std::atomic<int> failures(0);
+
+/**
+ * Renders a record of why `filename` could not be parsed into `out`, in
+ * place of its result, so that the batch carries on and the output still
+ * has one record per input in input order.
+ */
+static void failed(const std::string& filename, int code, const char *message, bool asGEDCOM, std::string& out) {
+    failures += 1;
+    fprintf(stderr, "%s: error %d: %s\n", filename.c_str(), code, message);
+    out.clear();
+    fhmwg::OutBuf o(out);
+    if (asGEDCOM) o.put("0 _ERROR ").put(message).put("\n1 _FILE ").put(filename).put('\n');
+    else o.put("{\"file\":").json(filename).put(",\"error\":{\"code\":").integer(code)
+        .put(",\"message\":").json(message).put("}}\n");
+}
+
+/**
+ * Parses one file and renders it into `out`. Runs on worker threads, so
+ * it writes into a string rather than to stdout directly.
+ */
+static void describe(const std::string& filename, const fhmwg::ParseOptions& opts, bool asGEDCOM, std::string& out) {
+    // one model per worker, built in an arena that is recycled between files
+    static thread_local fhmwg::Arena arena;
+    static thread_local fhmwg::ImageMetadata md(&arena);
+    md.reset();
+    arena.reset();
+    fhmwg::FileStats stats;
+    fhmwg::ParseOptions timed = opts;
+    if (summary || trace) timed.stats = &stats;
+    uint64_t started = trace ? fhmwg::monotonicNs() : 0;
+    size_t blocks = arena.heapAllocations();
+    fhmwg::FileIdentity id;
+    if (cache && cache->lookup(filename.c_str(), opts, id, md)) {
+        stats.cached = true;
+        if (timed.stats) stats.measure(md);
+    } else {
+        int code = 0;
+        std::string error;
+        try {
+            md.parseFile(filename.c_str(), timed);
+        } catch (XMP_Error ex) {
+            code = ex.GetID();
+            error = ex.GetErrMsg();
+        } catch (const std::exception& ex) {
+            code = kXMPErr_Unknown;
+            error = ex.what();
+        }
+        if (error.size() > 0) {
+            if (summary) summary->fail();
+            if (trace) trace->record(filename, stats, started, error.c_str());
+            failed(filename, code, error.c_str(), asGEDCOM, out);
+            return;
+        }
+        if (cache) cache->store(id, opts, md);
+    }
+    stats.allocations = arena.heapAllocations() - blocks;
+    {
+        fhmwg::PhaseTimer t(timed.stats, fhmwg::PHASE_SERIALIZE);
+        render(md, asGEDCOM, out);
+    }
+    if (trace) trace->record(filename, stats, started);
+    if (!summary) return;
+    summary->add(stats);
+    if (fileStats) {
+        fhmwg::OutBuf o(out);
+        o.put("{\"file\":").json(filename).put(",\"stats\":");
+        stats.dumpJSON(o);
+        o.put("}\n");
+    }
+}
+
+static std::atomic<int> mismatches(0);
+
+/**
+ * Parses the packet of one file both with the toolkit and with the
+ * streaming extractor, reports any difference on stderr, and renders
+ * the toolkit's result into `out`.
+ */
+static void differential(const std::string& filename, const fhmwg::ParseOptions& base, bool asGEDCOM, std::string& out) {
+    fhmwg::MappedFile file;
+    fhmwg::XMPPacket packet;
+    if (!file.open(filename.c_str()) || !fhmwg::findXMPPacket(file.data, file.size, packet)) {
+        fhmwg::ParseOptions opts = base;
+        opts.packetOnly = opts.streaming = false;
+        describe(filename, opts, asGEDCOM, out);
+        return;
+    }
+    const char *ext = packet.extended.size() > 0 ? packet.extended.data() : 0;
+    std::string json[2], error[2];
+    fhmwg::ImageMetadata md[2];
+    for(int i=0; i<2; i+=1) {
+        fhmwg::ParseOptions opts = base;
+        opts.packetOnly = false;
+        opts.streaming = i == 1;
+        try {
+            md[i].parsePacket(packet.main, packet.mainLen, ext, packet.extended.size(), opts);
+            render(md[i], false, json[i]);
+        } catch (XMP_Error ex) {
+            error[i] = ex.GetErrMsg();
+            json[i] = "error: " + error[i] + "\n";
+        }
+    }
+    if (json[0] != json[1]) {
+        mismatches += 1;
+        fprintf(stderr, "MISMATCH %s\n  toolkit:   %s  streaming: %s", filename.c_str(), json[0].c_str(), json[1].c_str());
+    }
+    if (error[0].size() > 0) {
+        failed(filename, kXMPErr_BadXML, error[0].c_str(), asGEDCOM, out);
+        return;
+    }
+    if (asGEDCOM) render(md[0], true, out);
+    else out = json[0];
+}
+
+static int usage(const char *name) {
+    fprintf(stderr, "USAGE: %s [-g] [-j N] [-u] [-r] [-e ext,...] [-0] [-x] [-s|-d] [-w] [-c cachefile [-H]]\n"
+        "       [--fields list] [--langs list] [--stats|--file-stats]\n"
+        "       [--trace|--chrome-trace logfile [--slow-ms N] [--large-kb N]]\n"
+        "       [--checkpoint file [--checkpoint-every N]] imagefile...\n"
+        "       %s [-x] [-s] [-w] [--fields list] [--langs list] [--max-sessions N] --serve socket\n"
+        "    -g      GEDCOM output instead of JSON\n"
+        "    -j N    parse with N worker threads (0 = one per core)\n"
+        "    -u      emit results as they finish instead of in input order\n"
+        "    -r      walk directories recursively\n"
+        "    -e LIST only parse walked files with these extensions (e.g. jpg,tif,png)\n"
+        "    -0      paths read from stdin are NUL-separated, not newline-separated\n"
+        "    -x      read only the XMP packet of JPEG, PNG and TIFF files (no EXIF/IPTC reconciliation)\n"
+        "    -s      like -x, but extract from the packet in one streaming pass without the toolkit\n"
+        "    -d      parse each packet both with the toolkit and streaming; report differences on stderr\n"
+        "    -c FILE reuse results cached in FILE for files whose size and mtime are unchanged, and add new ones\n"
+        "    -H      with -c, also compare a hash of each file's contents (reads every file)\n"
+        "    -w      also collapse non-ASCII Unicode spaces (no-break, ideographic, ...) in names\n"
+        "    --fields LIST  only extract these fields, e.g. date,people (title, caption, event, date, albums,\n"
+        "                  locations, people, objects); the lookups for the others are skipped\n"
+        "    --langs LIST   only keep text in these languages, e.g. en,x-default (en also keeps en-GB)\n"
+        "    --stats print a summary of files, sizes and per-phase latency histograms on stderr at exit\n"
+        "    --file-stats  also follow each file's JSON record with a record of its own timings (not with -g)\n"
+        "    --trace FILE  log the path, phase timings, sizes and counts of slow or large files to FILE as JSON lines\n"
+        "    --chrome-trace FILE  the same, as Chrome trace events (open in chrome://tracing or Perfetto)\n"
+        "    --slow-ms N   trace files taking at least N ms (the default is 100 unless --large-kb is given)\n"
+        "    --large-kb N  trace files of at least N KiB\n"
+        "    --checkpoint FILE  record progress in FILE every 1000 files; if FILE exists, resume after the files it\n"
+        "                  records, cutting off any later output if stdout is a file (append to it with >>)\n"
+        "    --checkpoint-every N  record progress every N files instead\n"
+        "    an imagefile of - reads the list of paths from stdin\n"
+        "    --serve answers parse and write requests on a Unix domain socket (see README)\n"
+        "    --max-sessions N  with --serve, turn away connections beyond N at once (default 64)\n", name, name);
+    return -1;
+}
 
 int main(int argc, char *argv[]) {
+    bool asGEDCOM = false, ordered = true, compare = false;
+    int jobs = 1;
+    fhmwg::ParseOptions opts;
+    fhmwg::PathSource files;
+    const char *serveOn = 0;
+    fhmwg::Cache results;
+    fhmwg::StatsSummary totals;
+    fhmwg::TraceLog slow;
+    const char *traceTo = 0;
+    const char *checkpointTo = 0;
+    long checkpointEvery = 1000;
+    long maxSessions = 64;
+
+	for (int i = 1; i < argc; ++i) {
+        if (!strcmp("--serve", argv[i])) {
+            if (i+1 >= argc) return usage(argv[0]);
+            serveOn = argv[++i];
+            continue;
+        }
+        if (!strcmp("--stats", argv[i])) { summary = &totals; continue; }
+        if (!strcmp("--file-stats", argv[i])) { summary = &totals; fileStats = true; continue; }
+        if (!strcmp("--trace", argv[i]) || !strcmp("--chrome-trace", argv[i])) {
+            if (i+1 >= argc) return usage(argv[0]);
+            slow.chrome = argv[i][2] == 'c';
+            traceTo = argv[++i];
+            continue;
+        }
+        if (!strcmp("--slow-ms", argv[i]) || !strcmp("--large-kb", argv[i])) {
+            char *end;
+            long n = i+1 < argc ? strtol(argv[i+1], &end, 10) : -1;
+            if (n < 1 || *end) return usage(argv[0]);
+            if (argv[i][2] == 's') slow.slowNs = n * 1000000ull;
+            else slow.largeBytes = n * 1024ull;
+            i += 1;
+            continue;
+        }
+        if (!strcmp("--fields", argv[i])) {
+            opts.fields = i+1 < argc ? fhmwg::parseFields(argv[++i]) : 0;
+            if (!opts.fields) return usage(argv[0]);
+            continue;
+        }
+        if (!strcmp("--langs", argv[i])) {
+            if (i+1 >= argc) return usage(argv[0]);
+            opts.languages = argv[++i];
+            continue;
+        }
+        if (!strcmp("--checkpoint", argv[i])) {
+            if (i+1 >= argc) return usage(argv[0]);
+            checkpointTo = argv[++i];
+            continue;
+        }
+        if (!strcmp("--max-sessions", argv[i])) {
+            char *end;
+            maxSessions = i+1 < argc ? strtol(argv[++i], &end, 10) : -1;
+            if (maxSessions < 1 || *end) return usage(argv[0]);
+            continue;
+        }
+        if (!strcmp("--checkpoint-every", argv[i])) {
+            char *end;
+            checkpointEvery = i+1 < argc ? strtol(argv[++i], &end, 10) : -1;
+            if (checkpointEvery < 1 || *end) return usage(argv[0]);
+            continue;
+        }
+        if (!strcmp("-g", argv[i])) { asGEDCOM = true; continue; }
+        if (!strcmp("-u", argv[i])) { ordered = false; continue; }
+        if (!strcmp("-r", argv[i])) { files.recursive = true; continue; }
+        if (!strcmp("-0", argv[i])) { files.separator('\0'); continue; }
+        if (!strcmp("-x", argv[i])) { opts.packetOnly = true; continue; }
+        if (!strcmp("-s", argv[i])) { opts.streaming = true; continue; }
+        if (!strcmp("-d", argv[i])) { compare = true; continue; }
+        if (!strcmp("-w", argv[i])) { opts.unicodeSpaces = true; continue; }
+        if (!strcmp("-H", argv[i])) { results.hashContents = true; continue; }
+        if (!strcmp("-c", argv[i])) {
+            if (i+1 >= argc) return usage(argv[0]);
+            if (!results.open(argv[++i])) {
+                fprintf(stderr, "Cannot use \"%s\" as a cache: %s\n", argv[i], strerror(errno));
+                return -1;
+            }
+            cache = &results;
+            continue;
+        }
+        if (!strcmp("-e", argv[i])) {
+            if (i+1 >= argc) return usage(argv[0]);
+            files.extensions(argv[++i]);
+            continue;
+        }
+        if (!strncmp("-j", argv[i], 2)) {
+            const char *n = argv[i][2] ? argv[i]+2 : (i+1 < argc ? argv[++i] : "");
+            char *end;
+            jobs = strtol(n, &end, 10);
+            if (!*n || *end || jobs < 0) return usage(argv[0]);
+            if (jobs == 0) jobs = std::thread::hardware_concurrency();
+            continue;
+        }
+        files.add(argv[i]);
+    }
+
+    if (fileStats && asGEDCOM) return usage(argv[0]);
+    // a checkpoint is a count of inputs finished in order, which -u does not give
+    if (checkpointTo && !ordered) return usage(argv[0]);
+    if (traceTo) {
+        if (!slow.slowNs && !slow.largeBytes) slow.slowNs = 100000000;
+        if (!slow.open(traceTo)) {
+            fprintf(stderr, "Cannot write a trace to \"%s\": %s\n", traceTo, strerror(errno));
+            return -1;
+        }
+        trace = &slow;
+    }
+
     if (!SXMPMeta::Initialize()) {
 		fprintf(stderr, "## SXMPMeta::Initialize failed!\n");
 		return -1;
-	}	
+	}
+    // initialize everything global before any worker thread touches the toolkit
+    if (!SXMPFiles::Initialize()) {
+		fprintf(stderr, "## SXMPFiles::Initialize failed!\n");
+		return -1;
+	}
 
     fhmwg::ns::init();
-    
-    bool asGEDCOM = false;
 
-	for (int i = 1; i < argc; ++i) {
-        if (!strcmp("-g", argv[i])) { asGEDCOM = true; continue; }
-        fhmwg::ImageMetadata md;
-        try {
-            md.parseFile(argv[i]);
-        } catch (XMP_Error ex) {
-            fprintf(stderr, "CRASHED with error %d:\n  %s\n", ex.GetID(), ex.GetErrMsg());
-            throw ex;
+    if (serveOn) {
+        fhmwg::serve(serveOn, opts, maxSessions);
+        fprintf(stderr, "Cannot serve on \"%s\": %s\n", serveOn, strerror(errno));
+        return -1;
+    }
+
+    fhmwg::Checkpoint progress;
+    if (checkpointTo) {
+        if (progress.load(checkpointTo)) {
+            // the inputs come in the same order as before, so skip as many as were finished
+            std::string file;
+            uint64_t skipped = 0;
+            while(skipped < progress.done && files.next(file)) skipped += 1;
+            if (skipped < progress.done || file != progress.last) {
+                fprintf(stderr, "The checkpoint \"%s\" is for other inputs: it ends with file %llu, \"%s\"\n",
+                    checkpointTo, (unsigned long long)progress.done, progress.last.c_str());
+                return -1;
+            }
+            // results written after the checkpoint are about to be written again
+            struct stat st;
+            if (progress.outputBytes >= 0 && fstat(fileno(stdout), &st) == 0 && S_ISREG(st.st_mode)) {
+                if (st.st_size > progress.outputBytes && ftruncate(fileno(stdout), progress.outputBytes) < 0)
+                    fprintf(stderr, "Cannot cut output back to the checkpoint: %s\n", strerror(errno));
+                else if (st.st_size < progress.outputBytes)
+                    fprintf(stderr, "Output is shorter than at the checkpoint; append to it with >> when resuming\n");
+                fseeko(stdout, 0, SEEK_END);
+            }
+            fprintf(stderr, "resuming after %llu files\n", (unsigned long long)progress.done);
+        } else if (errno != ENOENT) {
+            fprintf(stderr, "Cannot resume from \"%s\": %s\n", checkpointTo, strerror(errno));
+            return -1;
         }
-        if (asGEDCOM) md.dumpGEDCOM(stdout);
-        else { md.dumpJSON(stdout); putc('\n', stdout); }
     }
-		
+
+    fhmwg::runBatch(jobs, ordered,
+        [&](std::string& file) { return files.next(file); },
+        [&](const std::string& file, std::string& out) {
+            if (compare) differential(file, opts, asGEDCOM, out);
+            else describe(file, opts, asGEDCOM, out);
+        },
+        [&](const std::string& file, const std::string& out) {
+            fwrite(out.data(), 1, out.size(), stdout);
+            if (!checkpointTo) return;
+            progress.done += 1;
+            if (progress.done % checkpointEvery != 0) return;
+            // the output must reach the file before the checkpoint says it has
+            fflush(stdout);
+            struct stat st;
+            progress.outputBytes = fstat(fileno(stdout), &st) == 0 && S_ISREG(st.st_mode) ? st.st_size : -1;
+            progress.last = file;
+            if (!progress.save(checkpointTo))
+                fprintf(stderr, "Cannot save a checkpoint to \"%s\": %s\n", checkpointTo, strerror(errno));
+        });
+    // a finished run leaves nothing to resume
+    fflush(stdout);
+    if (checkpointTo) unlink(checkpointTo);
+
 	SXMPFiles::Terminate();
 	SXMPMeta::Terminate();
 
-    return 0;
+    if (cache) {
+        cache->close();
+        fprintf(stderr, "cache: %zu hits, %zu misses\n", cache->hits(), cache->misses());
+    }
+    if (trace) {
+        trace->close();
+        fprintf(stderr, "trace: %zu slow or large files logged\n", trace->traced());
+    }
+    if (summary) {
+        fhmwg::OutBuf o(stderr);
+        o.put("stats: ");
+        summary->dumpJSON(o);
+        o.put('\n');
+    }
+    if (failures > 0)
+        fprintf(stderr, "%d files could not be parsed\n", (int)failures);
+    if (mismatches > 0) {
+        fprintf(stderr, "%d files differ between toolkit and streaming parses\n", (int)mismatches);
+        return 1;
+    }
+    return failures > 0 ? 1 : 0;
 }
@@ -0,0 +1,104 @@
+#include "fhmwg1index.hpp"
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+
+static int usage(const char *name) {
+    fprintf(stderr, "USAGE: %s indexfile [--person IRI] [--name NAME] [--album IRI] [--album-name NAME]\n"
+        "           [--location IRI] [--from DATE] [--to DATE] [--near LAT,LON,KM] [--bbox S,W,N,E] [-c] [-0]\n"
+        "    prints the paths of the images matching every criterion given\n"
+        "    --person IRI      a person identified by IRI\n"
+        "    --name NAME       a person named NAME in any language (case- and whitespace-insensitive)\n"
+        "    --album IRI       in the album identified by IRI\n"
+        "    --album-name NAME in an album named NAME (case- and whitespace-insensitive)\n"
+        "    --location IRI    at the location identified by IRI\n"
+        "    --from DATE       dated DATE or later; DATE may be partial, e.g. 1962 or 1962-07\n"
+        "    --to DATE         dated DATE or earlier, where 1962 means the end of 1962\n"
+        "    --near LAT,LON,KM within KM kilometres of a point given in decimal degrees\n"
+        "    --bbox S,W,N,E    inside the box from latitude S to N and longitude W to E\n"
+        "                      (W greater than E for a box crossing the 180th meridian)\n"
+        "    -c                print only the number of matching images\n"
+        "    -0                separate paths with NUL instead of newline\n"
+        "    a criterion ending in * matches everything it is a prefix of, e.g. --name 'smith*'\n", name);
+    return -1;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) return usage(argv[0]);
+    fhmwg::Index index;
+    if (!index.open(argv[1])) {
+        fprintf(stderr, "Cannot open \"%s\" as an index: %s\n", argv[1], strerror(errno));
+        return -1;
+    }
+
+    static const struct { const char *flag; fhmwg::IndexTable table; bool name; } criteria[] = {
+        {"--person", fhmwg::PERSON_IDS, false},
+        {"--name", fhmwg::PERSON_NAMES, true},
+        {"--album", fhmwg::ALBUM_IDS, false},
+        {"--album-name", fhmwg::ALBUM_NAMES, true},
+        {"--location", fhmwg::LOCATION_IDS, false},
+    };
+
+    std::vector<uint32_t> found;
+    bool narrowed = false;
+    auto narrow = [&](const std::vector<uint32_t>& images) {
+        found = narrowed ? fhmwg::intersect(found, images) : images;
+        narrowed = true;
+    };
+    uint64_t from = 0, to = 0;
+    bool dated = false, countOnly = false;
+    char separator = '\n';
+
+    for (int i = 2; i < argc; ++i) {
+        if (!strcmp("-c", argv[i])) { countOnly = true; continue; }
+        if (!strcmp("-0", argv[i])) { separator = '\0'; continue; }
+        if (i+1 >= argc) return usage(argv[0]);
+        if (!strcmp("--from", argv[i]) || !strcmp("--to", argv[i])) {
+            bool isFrom = argv[i][2] == 'f';
+            uint64_t key = fhmwg::dateKey(argv[++i], isFrom ? 0 : 9);
+            if (!key) return usage(argv[0]);
+            if (!dated) { from = 0; to = UINT64_MAX; dated = true; }
+            if (isFrom) from = key;
+            else to = key;
+            continue;
+        }
+        if (!strcmp("--near", argv[i])) {
+            double lat, lon, km;
+            int used = 0;
+            if (sscanf(argv[++i], "%lf,%lf,%lf%n", &lat, &lon, &km, &used) != 3 || argv[i][used]
+            || !(lat >= -90 && lat <= 90 && lon >= -180 && lon <= 180 && km >= 0)) return usage(argv[0]);
+            narrow(index.near(lat, lon, km));
+            continue;
+        }
+        if (!strcmp("--bbox", argv[i])) {
+            fhmwg::GeoBox box;
+            int used = 0;
+            if (sscanf(argv[++i], "%lf,%lf,%lf,%lf%n", &box.south, &box.west, &box.north, &box.east, &used) != 4 || argv[i][used]
+            || !(box.south <= box.north && box.west >= -180 && box.east <= 180)) return usage(argv[0]);
+            narrow(index.within(box));
+            continue;
+        }
+        size_t c = 0;
+        while(c < sizeof(criteria)/sizeof(*criteria) && strcmp(criteria[c].flag, argv[i])) c += 1;
+        if (c == sizeof(criteria)/sizeof(*criteria)) return usage(argv[0]);
+        const char *term = argv[++i];
+        narrow(index.find(criteria[c].table, criteria[c].name ? fhmwg::normalizeName(term) : std::string(term)));
+    }
+    if (dated) narrow(index.dated(from, to));
+    if (!narrowed) {
+        // no criteria: every image
+        found.resize(index.size());
+        for(size_t i=0; i<found.size(); i+=1) found[i] = i;
+    }
+
+    if (countOnly) {
+        printf("%zu\n", found.size());
+        return 0;
+    }
+    for(uint32_t image : found) {
+        std::string_view path = index.path(image);
+        fwrite(path.data(), 1, path.size(), stdout);
+        putchar(separator);
+    }
+    return 0;
+}
@@ -1,5 +1,7 @@
-#include "fhmwg1ds.hpp"
-#include "json.hpp"
+#include "fhmwg1write.hpp"
+#include "fhmwg1serve.hpp"
+#include "fhmwg1batch.hpp"
+#include "fhmwg1out.hpp"
 
 #define TXMP_STRING_TYPE	std::string
 #define XMP_INCLUDE_XMPFILES 1
@@ -7,362 +9,292 @@
 #include <XMP.incl_cpp>
 
 #include <unistd.h>
-#include <fcntl.h>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <map>
+#include <mutex>
 
-using json = nlohmann::ordered_json;
+static int usage(const char *name) {
+	fprintf(stdout, "USAGE: %s inputimage outputimage\n"
+		"       %s --in-place image\n"
+		"       %s --connect socket inputimage outputimage\n"
+		"       %s --batch [-j N] [-u] [--in-place] [editsfile]\n"
+		"    inputimage must exist and be an image file\n"
+		"    outputimage must not exist\n"
+		"    metadata to edit is provided as a JSON object on stdin\n"
+		"    --in-place  edit image itself: only its packet is overwritten if the edit fits there,\n"
+		"                otherwise an edited copy replaces it\n"
+		"    --connect   sends the edit to a running `parser --serve socket` instead\n"
+		"    --batch     reads one {\"input\":...,\"output\":...,\"patch\":{...}} object per line\n"
+		"                from editsfile (or stdin) and prints one status object per line;\n"
+		"                with --in-place the objects have no \"output\"\n"
+		"    -j N        make N edits at once (0 = one per core)\n"
+		"    -u          print each status as soon as it is ready instead of in input order\n", name, name, name, name);
+	return -1;
+}
 
-namespace fhmwg {
+/** Edit images themselves instead of copies (--in-place) */
+static bool inPlace = false;
 
-/**
- * Special handling to bypass an oddity with the toolkit.
- * XMP says
- * 
- * - if known, default MUST be first
- * - if present, "x-default" MUST be default
- * - if present and not alone, "x-default" SHOULD have languaged copy
- * 
- * but the toolkit pretends that second SHOULD is a MUST and using
- * SetLocalizedText forces x-default to match the first non-x-default
- * language, changing the value of the first added to enforce this.
- * 
- * This function is a work-around to support the optional nature of the
- * SHOULD rule above.
- */
-static void setAltLang(SXMPMeta xmp, const char *iri, const char *prop, json altLang) {
-	if (altLang.is_string())
-		altLang = json::object({{"x-default",altLang}});
-	
-	// Complicated workaround.
-	
-	// 1. Find the x-default, if any
-	std::string def;
-	for(auto& pair : altLang.items()) {
-		if (pair.key() == "x-default") def = pair.value();
-	}
-	
-	if (def.length() == 0) {
-		// 2. If no x-default, no workaround needed
-		for(auto& pair : altLang.items()) {
-			xmp.SetLocalizedText(iri, prop, NULL, pair.key().c_str(), pair.value(), 0);
-		}
-	} else {
-		// 3. Put the x-default first
-		xmp.SetLocalizedText(iri, prop, NULL, "x-default", def, 0);
-		std::string defLang;
-		// 4. And then its language-tagged copy, if any
-		bool other = false;
-		for(auto& pair : altLang.items()) {
-			if (pair.value() == def && pair.key() != "x-default") {
-				xmp.SetLocalizedText(iri, prop, NULL, pair.key().c_str(), pair.value(), 0);
-				defLang = pair.key();
-				break;
-			} else { other = true; }
-		}
-		if (other && defLang.length() == 0) {
-			// 5. If no language-tagged copy, make a language-tagged copy with tag `und`
-			xmp.SetLocalizedText(iri, prop, NULL, "und", def, 0);
-		}
-		// 6. then put all the non-default languages
-		for(auto& pair : altLang.items()) {
-			if (pair.key() != defLang && pair.key() != "x-default") {
-				xmp.SetLocalizedText(iri, prop, NULL, pair.key().c_str(), pair.value().get<std::string>(), 0);
-			}
-		}
-	}
+/** `path` made absolute, as the server may be running in another directory */
+static std::string absolute(const char *path) {
+	if (path[0] == '/') return path;
+	char *cwd = getcwd(0, 0);
+	std::string ans = cwd ? cwd : ".";
+	free(cwd);
+	return ans + "/" + path;
 }
 
-static void setRegionArea(SXMPMeta xmp, const char *prop, const json& object) {
-	std::string s_path, item;
-	SXMPUtils::ComposeStructFieldPath(ns::_iptc, prop, ns::_iptc, "RegionBoundary", &s_path);
-	const char *path = s_path.c_str();
-	xmp.SetProperty(ns::_iptc, path, 0, kXMP_PropValueIsStruct);
-	xmp.SetStructField(ns::_iptc, path, ns::_iptc, "rbUnit", "relative", 0);
-	if (object.contains("circle")) {
-		xmp.SetStructField(ns::_iptc, path, ns::_iptc, "rbShape", "circle", 0);
-		SXMPUtils::ComposeStructFieldPath(ns::_iptc, path, ns::_iptc, "rbX", &item);
-		xmp.SetProperty_Float(ns::_iptc, item.c_str(), object["circle"]["x"], 0);
-		SXMPUtils::ComposeStructFieldPath(ns::_iptc, path, ns::_iptc, "rbY", &item);
-		xmp.SetProperty_Float(ns::_iptc, item.c_str(), object["circle"]["y"], 0);
-		SXMPUtils::ComposeStructFieldPath(ns::_iptc, path, ns::_iptc, "rbRx", &item);
-		xmp.SetProperty_Float(ns::_iptc, item.c_str(), object["circle"]["rx"], 0);
-	} else if (object.contains("rectangle")) {
-		xmp.SetStructField(ns::_iptc, path, ns::_iptc, "rbShape", "rectangle", 0);
-		SXMPUtils::ComposeStructFieldPath(ns::_iptc, path, ns::_iptc, "rbX", &item);
-		xmp.SetProperty_Float(ns::_iptc, item.c_str(), object["rectangle"]["x"], 0);
-		SXMPUtils::ComposeStructFieldPath(ns::_iptc, path, ns::_iptc, "rbY", &item);
-		xmp.SetProperty_Float(ns::_iptc, item.c_str(), object["rectangle"]["y"], 0);
-		SXMPUtils::ComposeStructFieldPath(ns::_iptc, path, ns::_iptc, "rbW", &item);
-		xmp.SetProperty_Float(ns::_iptc, item.c_str(), object["rectangle"]["w"], 0);
-		SXMPUtils::ComposeStructFieldPath(ns::_iptc, path, ns::_iptc, "rbH", &item);
-		xmp.SetProperty_Float(ns::_iptc, item.c_str(), object["rectangle"]["h"], 0);
-	} else if (object.contains("polygon")) {
-		xmp.SetStructField(ns::_iptc, path, ns::_iptc, "rbShape", "polygon", 0);
-		SXMPUtils::ComposeStructFieldPath(ns::_iptc, path, ns::_iptc, "rbVertices", &item);
-		for(auto& pt : object["polygon"]) {
-			std::string point, coord;
-			xmp.AppendArrayItem(ns::_iptc, item.c_str(), kXMP_PropArrayIsOrdered, 0, kXMP_PropValueIsStruct);
-			SXMPUtils::ComposeArrayItemPath(ns::_iptc, item.c_str(), xmp.CountArrayItems(ns::_iptc, item.c_str()), &point);
-			SXMPUtils::ComposeStructFieldPath(ns::_iptc, point.c_str(), ns::_iptc, "rbX", &coord);
-			xmp.SetProperty_Float(ns::_iptc, coord.c_str(), pt["x"], 0);
-			SXMPUtils::ComposeStructFieldPath(ns::_iptc, point.c_str(), ns::_iptc, "rbY", &coord);
-			xmp.SetProperty_Float(ns::_iptc, coord.c_str(), pt["y"], 0);
-		}
-	} else {
-		// use the whole-image region
-		xmp.SetStructField(ns::_iptc, path, ns::_iptc, "rbShape", "rectangle", 0);
-		xmp.SetStructField(ns::_iptc, path, ns::_iptc, "rbX", "0", 0);
-		xmp.SetStructField(ns::_iptc, path, ns::_iptc, "rbY", "0", 0);
-		xmp.SetStructField(ns::_iptc, path, ns::_iptc, "rbW", "1", 0);
-		xmp.SetStructField(ns::_iptc, path, ns::_iptc, "rbH", "1", 0);
+/** Has the server listening on `server` make the edit */
+static int remote(const char *server, const char *from, const char *to) {
+	std::string payload = absolute(from);
+	payload += '\0';
+	payload += absolute(to);
+	payload += '\0';
+	char buffer[4096];
+	size_t got;
+	while ((got = fread(buffer, 1, sizeof(buffer), stdin)) > 0)
+		payload.append(buffer, got);
+
+	int fd = fhmwg::connectTo(server);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to connect to \"%s\": %s\n", server, strerror(errno));
+		return -1;
+	}
+	std::string reply;
+	bool ok = fhmwg::call(fd, "WRITE", "-", payload, reply);
+	close(fd);
+	if (!ok) {
+		fprintf(stderr, "%s\n", reply.c_str());
+		return -1;
 	}
+	return 0;
 }
 
+static std::atomic<int> failures(0);
+
 /**
- * Works directly on JSON instead of on ImageMetadata because we want
- * a missing key to be ignored, while an empty key removes.
+ * Holds an image for one thread of a batch while it edits it in place, so
+ * that two lines naming the same image take turns instead of the later
+ * write losing the earlier one's edits. Images are told apart by their
+ * real paths, as renaming the edited copy over one gives it a new inode.
  */
-void updateMetadata(SXMPMeta xmp, json j) {
-
-	if (j.contains("caption")) {
-		xmp.DeleteProperty(ns::_dc, "description");
-		if (j["caption"].is_object() || j["caption"].is_string())
-			setAltLang(xmp, ns::_dc, "description", j["caption"]);
-	}
-	if (j.contains("title")) {
-		xmp.DeleteProperty(ns::_dc, "title");
-		if (j["title"].is_object() || j["title"].is_string())
-			setAltLang(xmp, ns::_dc, "title", j["title"]);
-	}
-	if (j.contains("event")) {
-		xmp.DeleteProperty(ns::_iptc, "Event");
-		if (j["event"].is_object() || j["event"].is_string())
-			setAltLang(xmp, ns::_iptc, "Event", j["event"]);
-	}
-	if (j.contains("date")) {
-		xmp.DeleteProperty(ns::_ph, "DateCreated");
-		if (j["date"].is_string())
-			xmp.SetProperty(ns::_ph, "DateCreated", j["date"], 0);
-	}
-	
-	if (j.contains("albums")) {
-		xmp.DeleteProperty(ns::_mwg, "Collections");
-		if (j["albums"].is_array()) {
-			xmp.SetProperty(ns::_mwg, "Collections", 0, kXMP_PropValueIsArray);
-			for (auto& a : j["albums"]) {
-				xmp.AppendArrayItem(ns::_mwg, "Collections", 0, 0, kXMP_PropValueIsStruct);
-				std::string album;
-				SXMPUtils::ComposeArrayItemPath(ns::_mwg, "Collections", xmp.CountArrayItems(ns::_mwg, "Collections"), &album);
-				std::string entry;
-				if (a.contains("name")) {
-					SXMPUtils::ComposeStructFieldPath(ns::_mwg, album.c_str(), ns::_mwg, "CollectionName", &entry);
-					xmp.SetProperty(ns::_mwg, entry.c_str(), a["name"], 0);
-				}
-				if (a.contains("id")) {
-					SXMPUtils::ComposeStructFieldPath(ns::_mwg, album.c_str(), ns::_mwg, "CollectionURI", &entry);
-					xmp.SetProperty(ns::_mwg, entry.c_str(), a["id"], 0);
-				}
-			}
+class Editing {
+public:
+	explicit Editing(const std::string& path) {
+		char *real = realpath(path.c_str(), 0);
+		std::string key = real ? real : path;
+		free(real);
+		{
+			std::lock_guard<std::mutex> hold(lock);
+			this->at = held.try_emplace(key).first;
+			this->at->second.users += 1;
 		}
+		// waited for outside `lock`, so that other threads can take other images meanwhile
+		this->at->second.lock.lock();
 	}
-
-	if (j.contains("locations")) {
-		xmp.DeleteProperty(ns::_iptc, "LocationShown");
-		if (j["locations"].is_array()) {
-			xmp.SetProperty(ns::_iptc, "LocationShown", 0, kXMP_PropValueIsArray);
-			for (auto& a : j["locations"]) {
-				xmp.AppendArrayItem(ns::_iptc, "LocationShown", 0, 0, kXMP_PropValueIsStruct);
-				std::string loc;
-				SXMPUtils::ComposeArrayItemPath(ns::_iptc, "LocationShown", xmp.CountArrayItems(ns::_iptc, "LocationShown"), &loc);
-				std::string entry;
-				if (a.contains("name")) {
-					SXMPUtils::ComposeStructFieldPath(ns::_iptc, loc.c_str(), ns::_iptc, "LocationName", &entry);
-					setAltLang(xmp, ns::_iptc, entry.c_str(), a["name"]);
-				}
-				if (a.contains("latitude") && a.contains("longitude")) {
-					SXMPUtils::ComposeStructFieldPath(ns::_iptc, loc.c_str(), ns::_exif, "GPSLatitude", &entry);
-					xmp.SetProperty_Float(ns::_iptc, entry.c_str(), a["latitude"], 0);
-					SXMPUtils::ComposeStructFieldPath(ns::_iptc, loc.c_str(), ns::_exif, "GPSLongitude", &entry);
-					xmp.SetProperty_Float(ns::_iptc, entry.c_str(), a["longitude"], 0);
-				}
-				if (a.contains("ids")) {
-					SXMPUtils::ComposeStructFieldPath(ns::_iptc, loc.c_str(), ns::_iptc, "LocationId", &entry);
-					for(const std::string& iri : a["ids"]) {
-						xmp.AppendArrayItem(ns::_iptc, entry.c_str(), kXMP_PropValueIsArray, iri.c_str(), 0);
-					}
-				}
-			}
-		}
+	~Editing() {
+		this->at->second.lock.unlock();
+		std::lock_guard<std::mutex> hold(lock);
+		if (--this->at->second.users == 0) held.erase(this->at);
 	}
+private:
+	struct Held { std::mutex lock; int users = 0; };
+	static std::mutex lock;
+	static std::map<std::string, Held> held;
+	std::map<std::string, Held>::iterator at;
+};
 
-	if (j.contains("people")) {
-		// remove all PersonInImage and PersonInImageWDetails, both at top level and in regions. If this renders a region empty, also remove the region.
-		xmp.DeleteProperty(ns::_iptc, "PersonInImage");
-		xmp.DeleteProperty(ns::_iptc, "PersonInImageWDetails");
-		XMP_Index regions = xmp.CountArrayItems(ns::_iptc, "ImageRegion");
-		
-		// iterate backwards so that removing regions does not re-index yet-to-be-visited regions
-		for(int i=regions; i>0; i-=1) {
-			// remove people from this region
-			std::string cell, path;
-			SXMPUtils::ComposeArrayItemPath(ns::_iptc, "ImageRegion", i, &cell);
-			SXMPUtils::ComposeStructFieldPath(ns::_iptc, cell.c_str(), ns::_iptc, "PersonInImageWDetails", &path);
-			xmp.DeleteProperty(ns::_iptc, path.c_str());
-			SXMPUtils::ComposeStructFieldPath(ns::_iptc, cell.c_str(), ns::_iptc, "PersonInImage", &path);
-			xmp.DeleteProperty(ns::_iptc, path.c_str());
-			
-			// and if the region is now empty, remove the region too
-			auto iter = SXMPIterator (xmp, ns::_iptc, cell.c_str(), kXMP_IterJustChildren | kXMP_IterOmitQualifiers);
-			std::string kpath;
-			bool empty = true;
-			while(iter.Next(0, &kpath, 0, 0))
-				if(kpath.find("/Iptc4xmpExt:RegionBoundary") != std::string::npos) { empty = false; break; }
-			if (empty)
-				xmp.DeleteArrayItem(ns::_iptc, "ImageRegion", i);
+std::mutex Editing::lock;
+std::map<std::string, Editing::Held> Editing::held;
+
+/**
+ * Makes the edit described by one line of a batch, putting its status
+ * record into `out`. Runs on worker threads. `item` is the line number,
+ * a tab, and the line.
+ */
+static void edit(const std::string& item, std::string& out) {
+	size_t tab = item.find('\t');
+	std::string_view line(item.data() + tab + 1, item.size() - tab - 1);
+	std::string from, to, why;
+	bool ok = false;
+	fhmwg::WriteReport report;
+	try {
+		fhmwg::JSONReader in(line);
+		fhmwg::Patch patch;
+		bool hasOutput = false, hasPatch = false;
+		in.beginObject();
+		std::string_view key;
+		while (in.key(key)) {
+			if (key == "input") from = in.string();
+			else if (key == "output") { to = in.string(); hasOutput = true; }
+			else if (key == "patch") { patch.read(in); hasPatch = true; }
+			else in.skip();
 		}
-		
-		// add a region with a PersonInImageWDetails[1] for each person
-		for(auto& person : j["people"]) {
-			// add a region
-			xmp.AppendArrayItem(ns::_iptc, "ImageRegion", kXMP_PropValueIsArray, 0, kXMP_PropValueIsStruct);
-			std::string cell, path, item, entry;
-			SXMPUtils::ComposeArrayItemPath(ns::_iptc, "ImageRegion", xmp.CountArrayItems(ns::_iptc, "ImageRegion"), &cell);
-			
-			// add a struct with an area to that region
-			xmp.SetProperty(ns::_iptc, cell.c_str(), 0, kXMP_PropValueIsStruct);
-			setRegionArea(xmp, cell.c_str(), person);
-			// add a person array with one person in it to that struct
-			SXMPUtils::ComposeStructFieldPath(ns::_iptc, cell.c_str(), ns::_iptc, "PersonInImageWDetails", &path);
-			xmp.AppendArrayItem(ns::_iptc, path.c_str(), kXMP_PropValueIsArray, 0, kXMP_PropValueIsStruct);
-			SXMPUtils::ComposeArrayItemPath(ns::_iptc, path.c_str(), 1, &item);
-			// add details about the person to that array item
-			if (person.contains("name")) {
-				SXMPUtils::ComposeStructFieldPath(ns::_iptc, item.c_str(), ns::_iptc, "PersonName", &entry);
-				setAltLang(xmp, ns::_iptc, entry.c_str(), person["name"]);
-			}
-			if (person.contains("description")) {
-				SXMPUtils::ComposeStructFieldPath(ns::_iptc, item.c_str(), ns::_iptc, "PersonDescription", &entry);
-				setAltLang(xmp, ns::_iptc, entry.c_str(), person["description"]);
-			}
-			if (person.contains("ids")) {
-				SXMPUtils::ComposeStructFieldPath(ns::_iptc, item.c_str(), ns::_iptc, "PersonId", &entry);
-				for(const std::string& iri : person["ids"]) {
-					xmp.AppendArrayItem(ns::_iptc, entry.c_str(), kXMP_PropValueIsArray, iri.c_str(), 0);
-				}
+		in.end();
+		if (from.size() == 0 || hasOutput == inPlace || (!inPlace && to.size() == 0) || !hasPatch) {
+			why = inPlace ? "expected {\"input\":string,\"patch\":object}"
+				: "expected {\"input\":string,\"output\":string,\"patch\":object}";
+		} else {
+			if (access(from.c_str(), inPlace ? R_OK | W_OK : R_OK) != 0) why = "cannot use input: " + std::string(strerror(errno));
+			else if (inPlace) {
+				Editing image(from);
+				ok = fhmwg::writeInPlace(from.c_str(), patch, why, &report);
 			}
+			else if (access(to.c_str(), F_OK) == 0) why = "output already exists";
+			else ok = fhmwg::writeCopy(from.c_str(), to.c_str(), patch, why, &report);
 		}
+	} catch (XMP_Error ex) {
+		why = "XMP error " + std::to_string(ex.GetID()) + ": " + ex.GetErrMsg();
+	} catch (const std::exception& ex) {
+		why = ex.what();
 	}
+	if (!ok) failures += 1;
 
-	if (j.contains("objects")) {
-		// remove all ArtworkOrObject, both at top level and in regions. If this renders a region empty, also remove the region.
-		xmp.DeleteProperty(ns::_iptc, "ArtworkOrObject");
-		XMP_Index regions = xmp.CountArrayItems(ns::_iptc, "ImageRegion");
-		
-		// iterate backwards so that removing regions does not re-index yet-to-be-visited regions
-		for(int i=regions; i>0; i-=1) {
-			// remove people from this region
-			std::string cell, path;
-			SXMPUtils::ComposeArrayItemPath(ns::_iptc, "ImageRegion", i, &cell);
-			SXMPUtils::ComposeStructFieldPath(ns::_iptc, cell.c_str(), ns::_iptc, "ArtworkOrObject", &path);
-			xmp.DeleteProperty(ns::_iptc, path.c_str());
-			
-			// and if the region is now empty, remove the region too
-			auto iter = SXMPIterator (xmp, ns::_iptc, cell.c_str(), kXMP_IterJustChildren | kXMP_IterOmitQualifiers);
-			std::string kpath;
-			bool empty = true;
-			while(iter.Next(0, &kpath, 0, 0))
-				if(kpath.find("/Iptc4xmpExt:RegionBoundary") != std::string::npos) { empty = false; break; }
-			if (empty)
-				xmp.DeleteArrayItem(ns::_iptc, "ImageRegion", i);
-		}
-		
-		// add a region with a ArtworkOrObject[1] for each object
-		for(auto& object : j["objects"]) {
-			// add a region
-			xmp.AppendArrayItem(ns::_iptc, "ImageRegion", kXMP_PropValueIsArray, 0, kXMP_PropValueIsStruct);
-			std::string cell, path, item, entry;
-			SXMPUtils::ComposeArrayItemPath(ns::_iptc, "ImageRegion", xmp.CountArrayItems(ns::_iptc, "ImageRegion"), &cell);
-			
-			// add a struct with an area to that region
-			xmp.SetProperty(ns::_iptc, cell.c_str(), 0, kXMP_PropValueIsStruct);
-			setRegionArea(xmp, cell.c_str(), object);
-			// add a person array with one person in it to that struct
-			SXMPUtils::ComposeStructFieldPath(ns::_iptc, cell.c_str(), ns::_iptc, "ArtworkOrObject", &path);
-			xmp.AppendArrayItem(ns::_iptc, path.c_str(), kXMP_PropValueIsArray, 0, kXMP_PropValueIsStruct);
-			SXMPUtils::ComposeArrayItemPath(ns::_iptc, path.c_str(), 1, &item);
-			// add details about the person to that array item
-			if (object.contains("title")) {
-				SXMPUtils::ComposeStructFieldPath(ns::_iptc, item.c_str(), ns::_iptc, "AOTitle", &entry);
-				setAltLang(xmp, ns::_iptc, entry.c_str(), object["title"]);
-			}
+	out.clear();
+	fhmwg::OutBuf o(out);
+	o.put("{\"line\":").put(std::string_view(item.data(), tab));
+	if (from.size() > 0) o.put(",\"input\":").json(from);
+	if (to.size() > 0) o.put(",\"output\":").json(to);
+	if (report.rewrote) o.put(",\"rewritten\":true");
+	o.put(ok ? ",\"ok\":true" : ",\"ok\":false,\"error\":");
+	if (!ok) o.json(why);
+	else {
+		o.put(",\"changed\":[");
+		for (size_t i = 0; i < report.changed.size(); i += 1) {
+			if (i) o.put(',');
+			o.json(report.changed[i]);
 		}
+		o.put(']');
 	}
+	o.put("}\n");
+}
 
+/** Applies a JSON Lines stream of edits; a bad line or image fails only that edit */
+static int batch(FILE *edits, int jobs, bool ordered) {
+	size_t number = 0;
+	char *line = 0;
+	size_t cap = 0;
+	fhmwg::runBatch(jobs, ordered,
+		[&](std::string& item) {
+			for(;;) {
+				ssize_t len = getline(&line, &cap, edits);
+				if (len < 0) return false;
+				number += 1;
+				while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r')) len -= 1;
+				if (len == 0) continue; // blank lines are not edits
+				item = std::to_string(number) + '\t';
+				item.append(line, len);
+				return true;
+			}
+		},
+		edit,
+		[&](const std::string&, const std::string& status) {
+			fwrite(status.data(), 1, status.size(), stdout);
+			if (!ordered) fflush(stdout);
+		});
+	free(line);
+	return failures > 0 ? 1 : 0;
 }
 
-bool copyFile(const char *from, const char *to) {
-	char buffer[4096];
-	int r = open(from, O_RDONLY);
-	if (r < 0) return false;
-	int w = open(to, O_CREAT | O_EXCL | O_WRONLY, 0644);
-	if (w < 0) { close(r); return false; }
-	ssize_t got;
-	while ((got = read(r, buffer, sizeof(buffer))) > 0) {
-		ssize_t sofar = 0;
-		while(sofar < got) {
-			ssize_t wrote = write(w, buffer, got);
-			if (wrote < 0) return false;
-			sofar += wrote;
+int main(int argc, char *argv[]) {
+	const char *name = argv[0], *server = 0;
+	bool batched = false, ordered = true;
+	int jobs = 1;
+	std::vector<const char *> paths;
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp("--connect", argv[i])) {
+			if (i+1 >= argc) return usage(name);
+			server = argv[++i];
+			continue;
+		}
+		if (!strcmp("--batch", argv[i])) { batched = true; continue; }
+		if (!strcmp("--in-place", argv[i])) { inPlace = true; continue; }
+		if (batched && !strcmp("-u", argv[i])) { ordered = false; continue; }
+		if (batched && !strncmp("-j", argv[i], 2)) {
+			const char *n = argv[i][2] ? argv[i]+2 : (i+1 < argc ? argv[++i] : "");
+			char *end;
+			jobs = strtol(n, &end, 10);
+			if (!*n || *end || jobs < 0) return usage(name);
+			if (jobs == 0) jobs = std::thread::hardware_concurrency();
+			continue;
 		}
+		paths.push_back(argv[i]);
 	}
-	close(r);
-	close(w);
-	return true;
-}
 
-} // namespace fhmwg
-
-int main(int argc, char *argv[]) {
-	
-	if (argc != 3
-	|| access(argv[1], R_OK) != 0
-	|| access(argv[2], F_OK) == 0
-	) {
-		fprintf(stdout, "USAGE: %s inputimage outputimage\n    inputimage must exist and be an image file\n    outputimage must not exist\n    metadata to edit is provided as a JSON object on stdin\n", argv[0]);
-		return -1;
+	FILE *edits = stdin;
+	if (batched) {
+		if (server || paths.size() > 1) return usage(name);
+		if (paths.size() == 1 && strcmp(paths[0], "-")) edits = fopen(paths[0], "r");
+		if (!edits) {
+			fprintf(stderr, "Cannot read \"%s\": %s\n", paths[0], strerror(errno));
+			return -1;
+		}
+	} else if (inPlace) {
+		if (server || paths.size() != 1 || access(paths[0], R_OK | W_OK) != 0) return usage(name);
+	} else {
+		if (paths.size() != 2
+		|| access(paths[0], R_OK) != 0
+		|| access(paths[1], F_OK) == 0
+		) return usage(name);
+		if (server) return remote(server, paths[0], paths[1]);
 	}
-	
+
 	if (!SXMPMeta::Initialize()) {
 		fprintf(stderr, "## SXMPMeta::Initialize failed!\n");
 		return -1;
 	}	
+	if (!SXMPFiles::Initialize()) {
+		fprintf(stderr, "## SXMPFiles::Initialize failed!\n");
+		return -1;
+	}
 
 	fhmwg::ns::init();
-	
-	SXMPMeta  xmpMeta;
-	SXMPFiles file;
 
-	if (!fhmwg::copyFile(argv[1], argv[2])) {
-		fprintf(stderr, "Failed to create \"%s\"\n", argv[2]);
-		return -1;
+	if (batched) {
+		int status = batch(edits, jobs, ordered);
+		SXMPFiles::Terminate();
+		SXMPMeta::Terminate();
+		return status;
 	}
-	
-	if (!file.OpenFile ( argv[2], kXMP_UnknownFile, kXMPFiles_OpenForUpdate )
-	|| !file.GetXMP ( &xmpMeta, 0, 0 )) {
-		fprintf(stderr, "Failed to open and parse \"%s\"\n", argv[1]);
+
+	std::string text;
+	char buffer[4096];
+	size_t got;
+	while ((got = fread(buffer, 1, sizeof(buffer), stdin)) > 0)
+		text.append(buffer, got);
+	fhmwg::Patch patch;
+	try {
+		patch.parse(text);
+	} catch (const fhmwg::JSONError& ex) {
+		fprintf(stderr, "Bad edits on stdin: %s\n", ex.what());
 		return -1;
 	}
 
-	auto j = json::parse(stdin);
+	std::string why;
 	try {
-		fhmwg::updateMetadata(xmpMeta, j);
+		fhmwg::WriteReport report;
+		bool ok = inPlace ? fhmwg::writeInPlace(paths[0], patch, why, &report)
+			: fhmwg::writeCopy(paths[0], paths[1], patch, why, &report);
+		if (!ok) {
+			fprintf(stderr, "%s\n", why.c_str());
+			return -1;
+		}
+		if (report.changed.size() == 0) fprintf(stderr, "unchanged\n");
+		else {
+			fprintf(stderr, "changed:");
+			for (const std::string& key : report.changed) fprintf(stderr, " %s", key.c_str());
+			fprintf(stderr, "\n");
+		}
 	} catch (XMP_Error ex) {
 		fprintf(stderr, "CRASHED with error %d:\n  %s\n", ex.GetID(), ex.GetErrMsg());
 		throw ex;
 	}
 
-	file.PutXMP(xmpMeta);
-	file.CloseFile();
-		
 	SXMPFiles::Terminate();
 	SXMPMeta::Terminate();
 